@@ -0,0 +1,764 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <zlib.h>
+
+#include "nbt.h"
+#include "encoder.h"
+
+
+/* Counting every allocation in the process, the library's included, so the
+ * suite can report allocations per document.
+ */
+namespace {
+	std::atomic<size_t> allocation_count(0);
+}
+
+void *operator new(size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if(void *p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	std::free(p);
+}
+
+
+namespace {
+
+using namespace nbt::io;
+
+enum Corpus {
+	CORPUS_LEVEL_DAT,
+	CORPUS_PLAYER,
+	CORPUS_OLD_CHUNK,
+	CORPUS_MODERN_CHUNK,
+	CORPUS_DEEP_NESTING,
+	CORPUS_HUGE_ARRAY,
+	CORPUS_COUNT
+};
+
+void encode_byte_array(Encoder &e, const std::string &name, uint32_t size, unsigned char seed) {
+	e.named(TAG_TYPE_BYTE_ARRAY, name);
+	e.u32(size);
+	for(uint32_t i = 0; i < size; ++i) {
+		e.u8(static_cast<unsigned char>(i * 31 + seed));
+	}
+}
+
+void encode_item(Encoder &e, int slot) {
+	e.named(TAG_TYPE_BYTE, "Slot");
+	e.u8(slot);
+	e.named(TAG_TYPE_STRING, "id");
+	e.string("minecraft:diamond_pickaxe");
+	e.named(TAG_TYPE_BYTE, "Count");
+	e.u8(1);
+	e.named(TAG_TYPE_COMPOUND, "tag");
+	e.named(TAG_TYPE_INT, "Damage");
+	e.u32(slot * 3);
+	e.named(TAG_TYPE_LIST, "Enchantments");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(2);
+	for(int i = 0; i < 2; ++i) {
+		e.named(TAG_TYPE_STRING, "id");
+		e.string(i ? "minecraft:unbreaking" : "minecraft:efficiency");
+		e.named(TAG_TYPE_SHORT, "lvl");
+		e.u16(3);
+		e.u8(TAG_TYPE_END);
+	}
+	e.u8(TAG_TYPE_END);
+	e.u8(TAG_TYPE_END);
+}
+
+// A modern level.dat, decompressed: many scalars and a big GameRules compound.
+std::vector<unsigned char> make_level_dat() {
+	Encoder e;
+	e.named(TAG_TYPE_COMPOUND, "");
+	e.named(TAG_TYPE_COMPOUND, "Data");
+	static const char *scalars[] = {
+		"allowCommands", "hardcore", "initialized", "raining", "thundering",
+		"Difficulty", "DifficultyLocked", "WasModded"
+	};
+	for(const char *name : scalars) {
+		e.named(TAG_TYPE_BYTE, name);
+		e.u8(0);
+	}
+	static const char *ints[] = {
+		"DataVersion", "GameType", "SpawnX", "SpawnY", "SpawnZ", "clearWeatherTime",
+		"rainTime", "thunderTime", "version", "WanderingTraderSpawnChance"
+	};
+	for(const char *name : ints) {
+		e.named(TAG_TYPE_INT, name);
+		e.u32(3465);
+	}
+	e.named(TAG_TYPE_LONG, "DayTime");
+	e.u64(123456);
+	e.named(TAG_TYPE_LONG, "LastPlayed");
+	e.u64(1700000000000ULL);
+	e.named(TAG_TYPE_LONG, "Time");
+	e.u64(987654);
+	e.named(TAG_TYPE_STRING, "LevelName");
+	e.string("New World");
+	e.named(TAG_TYPE_COMPOUND, "GameRules");
+	for(int i = 0; i < 48; ++i) {
+		e.named(TAG_TYPE_STRING, "gameRule" + std::to_string(i));
+		e.string(i % 3 ? "true" : "100");
+	}
+	e.u8(TAG_TYPE_END);
+	e.named(TAG_TYPE_COMPOUND, "Version");
+	e.named(TAG_TYPE_INT, "Id");
+	e.u32(3465);
+	e.named(TAG_TYPE_STRING, "Name");
+	e.string("1.20.1");
+	e.named(TAG_TYPE_STRING, "Series");
+	e.string("main");
+	e.named(TAG_TYPE_BYTE, "Snapshot");
+	e.u8(0);
+	e.u8(TAG_TYPE_END);
+	e.named(TAG_TYPE_COMPOUND, "WorldGenSettings");
+	e.named(TAG_TYPE_LONG, "seed");
+	e.u64(0x1234567890abcdefULL);
+	e.named(TAG_TYPE_COMPOUND, "dimensions");
+	static const char *dimensions[] = {"minecraft:overworld", "minecraft:the_nether", "minecraft:the_end"};
+	for(const char *name : dimensions) {
+		e.named(TAG_TYPE_COMPOUND, name);
+		e.named(TAG_TYPE_STRING, "type");
+		e.string(name);
+		e.named(TAG_TYPE_COMPOUND, "generator");
+		e.named(TAG_TYPE_STRING, "type");
+		e.string("minecraft:noise");
+		e.named(TAG_TYPE_STRING, "settings");
+		e.string(name);
+		e.u8(TAG_TYPE_END);
+		e.u8(TAG_TYPE_END);
+	}
+	e.u8(TAG_TYPE_END);
+	e.u8(TAG_TYPE_END);
+	e.u8(TAG_TYPE_END);
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+// A player file: position, attributes, and a full inventory.
+std::vector<unsigned char> make_player() {
+	Encoder e;
+	e.named(TAG_TYPE_COMPOUND, "");
+	e.named(TAG_TYPE_LIST, "Pos");
+	e.u8(TAG_TYPE_DOUBLE);
+	e.u32(3);
+	for(int i = 0; i < 3; ++i) {
+		e.u64(0x4059000000000000ULL);
+	}
+	e.named(TAG_TYPE_LIST, "Rotation");
+	e.u8(TAG_TYPE_FLOAT);
+	e.u32(2);
+	e.u32(0);
+	e.u32(0);
+	e.named(TAG_TYPE_INT_ARRAY, "UUID");
+	e.u32(4);
+	for(int i = 0; i < 4; ++i) {
+		e.u32(0x01234567 * (i + 1));
+	}
+	e.named(TAG_TYPE_FLOAT, "Health");
+	e.u32(0x41a00000);
+	e.named(TAG_TYPE_INT, "XpLevel");
+	e.u32(30);
+	e.named(TAG_TYPE_LIST, "Attributes");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(6);
+	for(int i = 0; i < 6; ++i) {
+		e.named(TAG_TYPE_STRING, "Name");
+		e.string("minecraft:generic.attribute_" + std::to_string(i));
+		e.named(TAG_TYPE_DOUBLE, "Base");
+		e.u64(0x3ff0000000000000ULL);
+		e.u8(TAG_TYPE_END);
+	}
+	e.named(TAG_TYPE_LIST, "Inventory");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(36);
+	for(int i = 0; i < 36; ++i) {
+		encode_item(e, i);
+	}
+	e.named(TAG_TYPE_LIST, "EnderItems");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(27);
+	for(int i = 0; i < 27; ++i) {
+		encode_item(e, i);
+	}
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+// A pre-1.13 Anvil chunk: byte arrays of block ids and nibbles.
+std::vector<unsigned char> make_old_chunk() {
+	Encoder e;
+	e.named(TAG_TYPE_COMPOUND, "");
+	e.named(TAG_TYPE_COMPOUND, "Level");
+	e.named(TAG_TYPE_INT, "xPos");
+	e.u32(12);
+	e.named(TAG_TYPE_INT, "zPos");
+	e.u32(-7);
+	e.named(TAG_TYPE_LONG, "LastUpdate");
+	e.u64(4000000);
+	e.named(TAG_TYPE_BYTE, "TerrainPopulated");
+	e.u8(1);
+	encode_byte_array(e, "Biomes", 256, 4);
+	e.named(TAG_TYPE_INT_ARRAY, "HeightMap");
+	e.u32(256);
+	for(int i = 0; i < 256; ++i) {
+		e.u32(64 + i % 8);
+	}
+	e.named(TAG_TYPE_LIST, "Sections");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(16);
+	for(int y = 0; y < 16; ++y) {
+		e.named(TAG_TYPE_BYTE, "Y");
+		e.u8(y);
+		encode_byte_array(e, "Blocks", 4096, y);
+		encode_byte_array(e, "Data", 2048, y + 1);
+		encode_byte_array(e, "BlockLight", 2048, 0);
+		encode_byte_array(e, "SkyLight", 2048, 0xff);
+		e.u8(TAG_TYPE_END);
+	}
+	e.named(TAG_TYPE_LIST, "Entities");
+	e.u8(TAG_TYPE_END);
+	e.u32(0);
+	e.named(TAG_TYPE_LIST, "TileEntities");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(4);
+	for(int i = 0; i < 4; ++i) {
+		e.named(TAG_TYPE_STRING, "id");
+		e.string("Chest");
+		e.named(TAG_TYPE_INT, "x");
+		e.u32(i);
+		e.named(TAG_TYPE_INT, "y");
+		e.u32(64);
+		e.named(TAG_TYPE_INT, "z");
+		e.u32(i);
+		e.named(TAG_TYPE_LIST, "Items");
+		e.u8(TAG_TYPE_COMPOUND);
+		e.u32(8);
+		for(int j = 0; j < 8; ++j) {
+			encode_item(e, j);
+		}
+		e.u8(TAG_TYPE_END);
+	}
+	e.u8(TAG_TYPE_END);
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+// A 1.18+ chunk: paletted block states packed into long arrays.
+std::vector<unsigned char> make_modern_chunk() {
+	Encoder e;
+	e.named(TAG_TYPE_COMPOUND, "");
+	e.named(TAG_TYPE_INT, "DataVersion");
+	e.u32(3465);
+	e.named(TAG_TYPE_INT, "xPos");
+	e.u32(12);
+	e.named(TAG_TYPE_INT, "yPos");
+	e.u32(-4);
+	e.named(TAG_TYPE_INT, "zPos");
+	e.u32(-7);
+	e.named(TAG_TYPE_STRING, "Status");
+	e.string("minecraft:full");
+	e.named(TAG_TYPE_LIST, "sections");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(24);
+	for(int y = 0; y < 24; ++y) {
+		e.named(TAG_TYPE_BYTE, "Y");
+		e.u8(y - 4);
+		e.named(TAG_TYPE_COMPOUND, "block_states");
+		e.named(TAG_TYPE_LIST, "palette");
+		e.u8(TAG_TYPE_COMPOUND);
+		e.u32(12);
+		for(int i = 0; i < 12; ++i) {
+			e.named(TAG_TYPE_STRING, "Name");
+			e.string("minecraft:block_" + std::to_string(i));
+			if(i % 3 == 0) {
+				e.named(TAG_TYPE_COMPOUND, "Properties");
+				e.named(TAG_TYPE_STRING, "axis");
+				e.string("y");
+				e.u8(TAG_TYPE_END);
+			}
+			e.u8(TAG_TYPE_END);
+		}
+		// 4 bits per block, 16 per long.
+		e.named(TAG_TYPE_LONG_ARRAY, "data");
+		e.u32(256);
+		for(uint64_t i = 0; i < 256; ++i) {
+			e.u64(i * 0x9e3779b97f4a7c15ULL);
+		}
+		e.u8(TAG_TYPE_END);
+		e.named(TAG_TYPE_COMPOUND, "biomes");
+		e.named(TAG_TYPE_LIST, "palette");
+		e.u8(TAG_TYPE_STRING);
+		e.u32(2);
+		e.string("minecraft:plains");
+		e.string("minecraft:river");
+		e.named(TAG_TYPE_LONG_ARRAY, "data");
+		e.u32(1);
+		e.u64(0x5555555555555555ULL);
+		e.u8(TAG_TYPE_END);
+		encode_byte_array(e, "BlockLight", 2048, 0);
+		encode_byte_array(e, "SkyLight", 2048, 0xff);
+		e.u8(TAG_TYPE_END);
+	}
+	e.named(TAG_TYPE_COMPOUND, "Heightmaps");
+	static const char *heightmaps[] = {"MOTION_BLOCKING", "MOTION_BLOCKING_NO_LEAVES", "OCEAN_FLOOR", "WORLD_SURFACE"};
+	for(const char *name : heightmaps) {
+		e.named(TAG_TYPE_LONG_ARRAY, name);
+		e.u32(37);
+		for(uint64_t i = 0; i < 37; ++i) {
+			e.u64(i * 0x0123456789abcdefULL);
+		}
+	}
+	e.u8(TAG_TYPE_END);
+	e.named(TAG_TYPE_LIST, "block_entities");
+	e.u8(TAG_TYPE_END);
+	e.u32(0);
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+// Compounds inside lists inside compounds, far deeper than real data goes.
+std::vector<unsigned char> make_deep_nesting() {
+	const int depth = 256;
+	Encoder e;
+	e.named(TAG_TYPE_COMPOUND, "");
+	for(int i = 0; i < depth; ++i) {
+		e.named(TAG_TYPE_LIST, "a");
+		e.u8(TAG_TYPE_COMPOUND);
+		e.u32(1);
+		e.named(TAG_TYPE_INT, "depth");
+		e.u32(i);
+	}
+	for(int i = 0; i < depth; ++i) {
+		e.u8(TAG_TYPE_END);
+	}
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+// A single 4 MiB int array.
+std::vector<unsigned char> make_huge_array() {
+	const uint32_t size = 1 << 20;
+	Encoder e;
+	e.data.reserve(size * 4 + 16);
+	e.named(TAG_TYPE_COMPOUND, "");
+	e.named(TAG_TYPE_INT_ARRAY, "values");
+	e.u32(size);
+	for(uint32_t i = 0; i < size; ++i) {
+		e.u32(i * 2654435761U);
+	}
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+const std::vector<unsigned char> &corpus_document(Corpus corpus) {
+	static const std::vector<unsigned char> documents[CORPUS_COUNT] = {
+		make_level_dat(),
+		make_player(),
+		make_old_chunk(),
+		make_modern_chunk(),
+		make_deep_nesting(),
+		make_huge_array()
+	};
+	return documents[corpus];
+}
+
+// Every event but the ends of compounds and lists is one tag.
+size_t count_tags(const std::vector<unsigned char> &doc) {
+	MemoryInputStream s(&doc[0], doc.size());
+	EventReader reader(s);
+	size_t tags = 0;
+	for(;;) {
+		EventReader::Event event = reader.next();
+		if(event == EventReader::EVENT_END_OF_DOCUMENT) {
+			return tags;
+		}
+		if(event != EventReader::EVENT_END_COMPOUND && event != EventReader::EVENT_END_LIST) {
+			++tags;
+		}
+	}
+}
+
+/* The high-water mark for the whole process, so it only says much about one
+ * benchmark when it is run alone with --benchmark_filter.
+ */
+long peak_rss_kib() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+class NullBuffer : public std::streambuf {
+protected:
+	virtual int_type overflow(int_type c) { return traits_type::not_eof(c); }
+	virtual std::streamsize xsputn(const char *, std::streamsize n) { return n; }
+};
+
+/* Reports throughput in bytes and tags, and allocations per document; body
+ * runs one document through whatever is being measured.
+ */
+template<typename F>
+void run_corpus(benchmark::State &state, Corpus corpus, F body) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	size_t tags = count_tags(doc);
+	size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+	for(auto _ : state) {
+		body(doc);
+	}
+	size_t allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+	state.SetBytesProcessed(state.iterations() * doc.size());
+	state.counters["tags"] = benchmark::Counter(static_cast<double>(tags * state.iterations()), benchmark::Counter::kIsRate);
+	state.counters["allocs/doc"] = benchmark::Counter(static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+	state.counters["peak_rss_kib"] = static_cast<double>(peak_rss_kib());
+}
+
+void BM_Corpus_ReadNbt_MemoryInputStream(benchmark::State &state, Corpus corpus) {
+	run_corpus(state, corpus, [](const std::vector<unsigned char> &doc) {
+		MemoryInputStream s(&doc[0], doc.size());
+		benchmark::DoNotOptimize(read_nbt(s));
+	});
+}
+
+void BM_Corpus_ReadNbt_IStreamInputStream(benchmark::State &state, Corpus corpus) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	std::string doc_string(doc.begin(), doc.end());
+	run_corpus(state, corpus, [&doc_string](const std::vector<unsigned char> &) {
+		std::istringstream is(doc_string);
+		IStreamInputStream s(is);
+		benchmark::DoNotOptimize(read_nbt(s));
+	});
+}
+
+// Bytes processed is the size of the binary document, not of the text.
+void BM_Corpus_PrettyPrint(benchmark::State &state, Corpus corpus) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = read_nbt(in);
+	NullBuffer buffer;
+	std::ostream os(&buffer);
+	run_corpus(state, corpus, [&](const std::vector<unsigned char> &) {
+		nbt::utility::pretty_print(os, root);
+	});
+}
+
+void BM_Corpus_WriteSnbt(benchmark::State &state, Corpus corpus) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = read_nbt(in);
+	NullBuffer buffer;
+	std::ostream os(&buffer);
+	run_corpus(state, corpus, [&](const std::vector<unsigned char> &) {
+		nbt::utility::write_snbt(os, root);
+	});
+}
+
+void BM_Corpus_WriteJson(benchmark::State &state, Corpus corpus) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = read_nbt(in);
+	NullBuffer buffer;
+	std::ostream os(&buffer);
+	run_corpus(state, corpus, [&](const std::vector<unsigned char> &) {
+		nbt::utility::write_json(os, root);
+	});
+}
+
+// Copying an already-read tree, against BM_Corpus_ReadNbt_MemoryInputStream.
+void BM_Corpus_Clone(benchmark::State &state, Corpus corpus) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = read_nbt(in);
+	run_corpus(state, corpus, [&](const std::vector<unsigned char> &) {
+		benchmark::DoNotOptimize(nbt::clone(root));
+	});
+}
+
+void BM_Corpus_Clone_SharedArena(benchmark::State &state, Corpus corpus) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = read_nbt(in);
+	nbt::Arena arena;
+	run_corpus(state, corpus, [&](const std::vector<unsigned char> &) {
+		{
+			nbt::RootTag copy = nbt::clone(root, &arena, nbt::CLONE_SHARED);
+			benchmark::DoNotOptimize(copy);
+		}
+		arena.reset();
+	});
+}
+
+/* Saving a tree back over the bytes it was read from: rewriting it whole,
+ * against patch_nbt() (which, with nothing changed, is the cost of the
+ * comparison alone).
+ */
+void BM_Corpus_Save_WriteNbt(benchmark::State &state, Corpus corpus) {
+	const std::vector<unsigned char> &doc = corpus_document(corpus);
+	MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = read_nbt(in);
+	run_corpus(state, corpus, [&](const std::vector<unsigned char> &) {
+		MemoryOutputStream out;
+		write_nbt(out, root);
+		benchmark::DoNotOptimize(out.data());
+	});
+}
+
+void BM_Corpus_Save_PatchNbt(benchmark::State &state, Corpus corpus) {
+	std::vector<unsigned char> doc = corpus_document(corpus);
+	MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = read_nbt(in);
+	std::vector<ByteRange> changed;
+	run_corpus(state, corpus, [&](const std::vector<unsigned char> &) {
+		changed.clear();
+		benchmark::DoNotOptimize(patch_nbt(&doc[0], doc.size(), root, changed));
+	});
+}
+
+#define NBT_CORPUS_BENCHMARK(function) \
+	BENCHMARK_CAPTURE(function, level_dat, CORPUS_LEVEL_DAT); \
+	BENCHMARK_CAPTURE(function, player, CORPUS_PLAYER); \
+	BENCHMARK_CAPTURE(function, old_chunk, CORPUS_OLD_CHUNK); \
+	BENCHMARK_CAPTURE(function, modern_chunk, CORPUS_MODERN_CHUNK); \
+	BENCHMARK_CAPTURE(function, deep_nesting, CORPUS_DEEP_NESTING); \
+	BENCHMARK_CAPTURE(function, huge_array, CORPUS_HUGE_ARRAY)
+
+NBT_CORPUS_BENCHMARK(BM_Corpus_ReadNbt_MemoryInputStream);
+NBT_CORPUS_BENCHMARK(BM_Corpus_ReadNbt_IStreamInputStream);
+NBT_CORPUS_BENCHMARK(BM_Corpus_PrettyPrint);
+NBT_CORPUS_BENCHMARK(BM_Corpus_WriteSnbt);
+NBT_CORPUS_BENCHMARK(BM_Corpus_WriteJson);
+NBT_CORPUS_BENCHMARK(BM_Corpus_Clone);
+NBT_CORPUS_BENCHMARK(BM_Corpus_Clone_SharedArena);
+NBT_CORPUS_BENCHMARK(BM_Corpus_Save_WriteNbt);
+NBT_CORPUS_BENCHMARK(BM_Corpus_Save_PatchNbt);
+
+/* A stream of many small documents laid end to end (as they'd come off a
+ * network connection), read with a fresh read_nbt() each time and with one
+ * Reader.
+ */
+const size_t READ_MANY_DOCUMENTS = 256;
+
+const std::vector<unsigned char> &read_many_buffer() {
+	static std::vector<unsigned char> buffer;
+	if(buffer.empty()) {
+		const std::vector<unsigned char> &doc = corpus_document(CORPUS_PLAYER);
+		for(size_t i = 0; i < READ_MANY_DOCUMENTS; ++i) {
+			buffer.insert(buffer.end(), doc.begin(), doc.end());
+		}
+	}
+	return buffer;
+}
+
+template<typename F>
+void run_read_many(benchmark::State &state, F body) {
+	const std::vector<unsigned char> &buffer = read_many_buffer();
+	size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+	for(auto _ : state) {
+		body(buffer);
+	}
+	size_t allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+	state.SetBytesProcessed(state.iterations() * buffer.size());
+	state.SetItemsProcessed(state.iterations() * READ_MANY_DOCUMENTS);
+	state.counters["allocs/doc"] = benchmark::Counter(static_cast<double>(allocations) / READ_MANY_DOCUMENTS,
+		benchmark::Counter::kAvgIterations);
+}
+
+void BM_ReadMany_ReadNbt(benchmark::State &state) {
+	run_read_many(state, [](const std::vector<unsigned char> &buffer) {
+		MemoryInputStream s(&buffer[0], buffer.size());
+		while(s.position() < buffer.size()) {
+			benchmark::DoNotOptimize(read_nbt(s));
+		}
+	});
+}
+BENCHMARK(BM_ReadMany_ReadNbt);
+
+void BM_ReadMany_Reader(benchmark::State &state) {
+	Reader reader;
+	run_read_many(state, [&reader](const std::vector<unsigned char> &buffer) {
+		reader.read_many(&buffer[0], buffer.size(), [](nbt::RootTag &root) {
+			benchmark::DoNotOptimize(root);
+		});
+	});
+}
+BENCHMARK(BM_ReadMany_Reader);
+
+void BM_ReadMany_Reader_Arena(benchmark::State &state) {
+	Reader reader(ReadOptions(), true);
+	run_read_many(state, [&reader](const std::vector<unsigned char> &buffer) {
+		reader.read_many(&buffer[0], buffer.size(), [](nbt::RootTag &root) {
+			benchmark::DoNotOptimize(root);
+		});
+	});
+}
+BENCHMARK(BM_ReadMany_Reader_Arena);
+
+/* A region file of modern chunks, zlib-compressed as Minecraft writes
+ * them, in a directory of its own that goes when the suite does. Found
+ * the slow way (reading every chunk) and with a ChunkIndex.
+ */
+const size_t REGION_CHUNKS = 64;
+
+class RegionFixture {
+public:
+	RegionFixture() {
+		char directory[] = "/tmp/nbt_bench_XXXXXX";
+		if(!mkdtemp(directory)) {
+			std::abort();
+		}
+		m_directory = directory;
+		paths.push_back(m_directory + "/r.0.0.mca");
+		index_path = m_directory + "/index";
+
+		const std::vector<unsigned char> &doc = corpus_document(CORPUS_MODERN_CHUNK);
+		std::vector<unsigned char> compressed(compressBound(doc.size()));
+		uLongf compressed_size = compressed.size();
+		compress(&compressed[0], &compressed_size, &doc[0], doc.size());
+		compressed.resize(compressed_size);
+
+		std::vector<unsigned char> file(RegionFile::HEADER_SIZE);
+		for(size_t i = 0; i < REGION_CHUNKS; ++i) {
+			size_t index = i * (RegionFile::CHUNK_COUNT / REGION_CHUNKS);
+			size_t sector = file.size() / RegionFile::SECTOR_SIZE;
+			size_t sectors = (compressed.size() + 5 + RegionFile::SECTOR_SIZE - 1) / RegionFile::SECTOR_SIZE;
+			store(&file[index * 4], static_cast<uint32_t>(sector << 8 | sectors));
+			store(&file[RegionFile::SECTOR_SIZE + index * 4], static_cast<uint32_t>(1000 + i));
+			file.resize(file.size() + sectors * RegionFile::SECTOR_SIZE);
+			unsigned char *chunk = &file[sector * RegionFile::SECTOR_SIZE];
+			store(chunk, static_cast<uint32_t>(compressed.size() + 1));
+			chunk[4] = RegionFile::CHUNK_ZLIB;
+			std::copy(compressed.begin(), compressed.end(), chunk + 5);
+		}
+		std::ofstream out(paths[0].c_str(), std::ios::binary);
+		out.write(reinterpret_cast<const char *>(&file[0]), file.size());
+		out.close();
+
+		options.fields.push_back("DataVersion");
+		options.keys.push_back("sections.block_states.palette.Name");
+		update_chunk_index(index_path, paths, options);
+	}
+
+	~RegionFixture() {
+		std::remove(paths[0].c_str());
+		std::remove(index_path.c_str());
+		rmdir(m_directory.c_str());
+	}
+
+	std::vector<std::string> paths;
+	std::string index_path;
+	ChunkIndexOptions options;
+
+private:
+	static void store(unsigned char *data, uint32_t value) {
+		data[0] = value >> 24;
+		data[1] = value >> 16;
+		data[2] = value >> 8;
+		data[3] = value;
+	}
+
+	std::string m_directory;
+};
+
+const RegionFixture &region_fixture() {
+	static RegionFixture fixture;
+	return fixture;
+}
+
+void BM_Region_Query_LoadRegions(benchmark::State &state) {
+	const RegionFixture &fixture = region_fixture();
+	Projection projection(fixture.options.fields);
+	LoadOptions options;
+	options.projection = &projection;
+	for(auto _ : state) {
+		std::atomic<size_t> found(0);
+		load_regions(fixture.paths, [&found](const std::string &, size_t, nbt::RootTag &chunk) {
+			const nbt::CompoundMap &values = static_cast<const nbt::CompoundTag &>(*chunk.tag).values;
+			auto version = values.find("DataVersion");
+			if(version != values.end() && static_cast<const nbt::IntTag &>(*version->second).value >= 3000) {
+				++found;
+			}
+		}, options);
+		benchmark::DoNotOptimize(found.load());
+	}
+	state.SetItemsProcessed(state.iterations() * REGION_CHUNKS);
+}
+BENCHMARK(BM_Region_Query_LoadRegions)->UseRealTime();
+
+void BM_Region_Query_ChunkIndex(benchmark::State &state) {
+	const RegionFixture &fixture = region_fixture();
+	for(auto _ : state) {
+		ChunkIndex index(fixture.index_path);
+		benchmark::DoNotOptimize(index.chunks_where("DataVersion", 3000, INT64_MAX));
+	}
+	state.SetItemsProcessed(state.iterations() * REGION_CHUNKS);
+}
+BENCHMARK(BM_Region_Query_ChunkIndex);
+
+// Nothing has changed, so this is the cost of checking the timestamps.
+void BM_Region_UpdateIndex_Unchanged(benchmark::State &state) {
+	const RegionFixture &fixture = region_fixture();
+	for(auto _ : state) {
+		benchmark::DoNotOptimize(update_chunk_index(fixture.index_path, fixture.paths, fixture.options));
+	}
+	state.SetItemsProcessed(state.iterations() * REGION_CHUNKS);
+}
+BENCHMARK(BM_Region_UpdateIndex_Unchanged)->UseRealTime();
+
+// A row per chunk section, with the first block in its palette and its chunk.
+void BM_Region_Export(benchmark::State &state) {
+	const RegionFixture &fixture = region_fixture();
+	ExportOptions options;
+	options.rows = "sections";
+	options.columns.push_back(ExportColumn("Y", COLUMN_INT8));
+	options.columns.push_back(ExportColumn("block_states.palette.Name", COLUMN_STRING));
+	ExportColumn x("xPos", COLUMN_INT32);
+	x.document = true;
+	options.columns.push_back(x);
+	ExportColumn z("zPos", COLUMN_INT32);
+	z.document = true;
+	options.columns.push_back(z);
+	for(auto _ : state) {
+		std::atomic<size_t> rows(0);
+		export_regions(fixture.paths, options, [&rows](ColumnBatch &batch) {
+			rows += batch.row_count;
+		});
+		benchmark::DoNotOptimize(rows.load());
+	}
+	state.SetItemsProcessed(state.iterations() * REGION_CHUNKS);
+}
+BENCHMARK(BM_Region_Export)->UseRealTime();
+
+}
@@ -0,0 +1,550 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <zlib.h>
+
+#include "nbt.h"
+#include "encoder.h"
+
+
+// The parts of document() a program might actually want.
+struct BenchEntity {
+	std::string id;
+	std::vector<double> pos;
+	std::vector<float> rotation;
+	int16_t air;
+	bool on_ground;
+	int64_t uuid_most;
+	int64_t uuid_least;
+};
+NBT_SCHEMA(BenchEntity,
+	NBT_FIELD(id, "id")
+	NBT_FIELD(pos, "Pos")
+	NBT_FIELD(rotation, "Rotation")
+	NBT_FIELD(air, "Air")
+	NBT_FIELD(on_ground, "OnGround")
+	NBT_FIELD(uuid_most, "UUIDMost")
+	NBT_FIELD(uuid_least, "UUIDLeast"))
+
+struct BenchDocument {
+	std::vector<BenchEntity> entities;
+	std::vector<int8_t> blocks;
+};
+NBT_SCHEMA(BenchDocument,
+	NBT_FIELD(entities, "Entities")
+	NBT_FIELD(blocks, "Blocks"))
+
+
+namespace {
+
+/* The shape of document() is loosely modelled on a player/entity file: lots of
+ * small named scalars, short lists of doubles, and nested compounds.
+ */
+void encode_entity(Encoder &e) {
+	using namespace nbt::io;
+	e.named(TAG_TYPE_STRING, "id");
+	e.string("minecraft:zombie");
+	e.named(TAG_TYPE_LIST, "Pos");
+	e.u8(TAG_TYPE_DOUBLE);
+	e.u32(3);
+	for(int i = 0; i < 3; ++i) {
+		e.u64(0x4059000000000000ULL);
+	}
+	e.named(TAG_TYPE_LIST, "Motion");
+	e.u8(TAG_TYPE_DOUBLE);
+	e.u32(3);
+	for(int i = 0; i < 3; ++i) {
+		e.u64(0);
+	}
+	e.named(TAG_TYPE_LIST, "Rotation");
+	e.u8(TAG_TYPE_FLOAT);
+	e.u32(2);
+	e.u32(0);
+	e.u32(0);
+	e.named(TAG_TYPE_SHORT, "Air");
+	e.u16(300);
+	e.named(TAG_TYPE_SHORT, "Fire");
+	e.u16(0xffff);
+	e.named(TAG_TYPE_BYTE, "OnGround");
+	e.u8(1);
+	e.named(TAG_TYPE_INT, "PortalCooldown");
+	e.u32(0);
+	e.named(TAG_TYPE_LONG, "UUIDMost");
+	e.u64(0x0123456789abcdefULL);
+	e.named(TAG_TYPE_LONG, "UUIDLeast");
+	e.u64(0xfedcba9876543210ULL);
+	e.named(TAG_TYPE_FLOAT, "FallDistance");
+	e.u32(0);
+	e.u8(TAG_TYPE_END);
+}
+
+std::vector<unsigned char> make_document(int entity_count) {
+	using namespace nbt::io;
+	Encoder e;
+	e.named(TAG_TYPE_COMPOUND, "");
+	e.named(TAG_TYPE_LIST, "Entities");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(entity_count);
+	for(int i = 0; i < entity_count; ++i) {
+		encode_entity(e);
+	}
+	e.named(TAG_TYPE_BYTE_ARRAY, "Blocks");
+	e.u32(4096);
+	e.data.insert(e.data.end(), 4096, 1);
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+/* Mostly big numeric payloads, like the bulk of a chunk. */
+std::vector<unsigned char> make_array_document(int section_count) {
+	using namespace nbt::io;
+	Encoder e;
+	e.named(TAG_TYPE_COMPOUND, "");
+	e.named(TAG_TYPE_LIST, "Sections");
+	e.u8(TAG_TYPE_COMPOUND);
+	e.u32(section_count);
+	for(int i = 0; i < section_count; ++i) {
+		e.named(TAG_TYPE_INT_ARRAY, "Ints");
+		e.u32(1024);
+		for(uint32_t j = 0; j < 1024; ++j) {
+			e.u32(j * 2654435761U);
+		}
+		e.named(TAG_TYPE_LIST, "Longs");
+		e.u8(TAG_TYPE_LONG);
+		e.u32(256);
+		for(uint64_t j = 0; j < 256; ++j) {
+			e.u64(j * 0x9e3779b97f4a7c15ULL);
+		}
+		e.named(TAG_TYPE_LIST, "Doubles");
+		e.u8(TAG_TYPE_DOUBLE);
+		e.u32(256);
+		for(int j = 0; j < 256; ++j) {
+			e.u64(0x3ff0000000000000ULL + j);
+		}
+		e.u8(TAG_TYPE_END);
+	}
+	e.u8(TAG_TYPE_END);
+	return e.data;
+}
+
+const std::vector<unsigned char> &array_document() {
+	static const std::vector<unsigned char> doc = make_array_document(64);
+	return doc;
+}
+
+const std::vector<unsigned char> &document() {
+	static const std::vector<unsigned char> doc = make_document(1000);
+	return doc;
+}
+
+// Gzipped the way level.dat is.
+std::vector<unsigned char> gzip(const std::vector<unsigned char> &doc) {
+	std::vector<unsigned char> out(compressBound(doc.size()) + 32);
+	z_stream z = z_stream();
+	deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+	z.next_in = const_cast<unsigned char *>(&doc[0]);
+	z.avail_in = doc.size();
+	z.next_out = &out[0];
+	z.avail_out = out.size();
+	deflate(&z, Z_FINISH);
+	out.resize(z.total_out);
+	deflateEnd(&z);
+	return out;
+}
+
+const std::vector<unsigned char> &gzip_document() {
+	static const std::vector<unsigned char> compressed = gzip(document());
+	return compressed;
+}
+
+/* What a hostile client might send as an item: a long array whose length
+ * claims four billion elements, followed by a few bytes of them.
+ */
+const std::vector<unsigned char> &lying_document() {
+	static const std::vector<unsigned char> doc = [] {
+		Encoder e;
+		e.named(nbt::io::TAG_TYPE_COMPOUND, "");
+		e.named(nbt::io::TAG_TYPE_STRING, "id");
+		e.string("minecraft:diamond_sword");
+		e.named(nbt::io::TAG_TYPE_LONG_ARRAY, "tag");
+		e.u32(0xffffffff);
+		for(int i = 0; i < 64; ++i) {
+			e.u64(i);
+		}
+		return e.data;
+	}();
+	return doc;
+}
+
+
+void BM_ReadNbt_MemoryInputStream(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_MemoryInputStream);
+
+void BM_ReadNbt_MemoryInputStream_Borrowed(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::io::ReadOptions options;
+	options.borrow_buffers = true;
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s, options));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_MemoryInputStream_Borrowed);
+
+void BM_ReadNbt_MemoryInputStream_Arena(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::Arena arena;
+	nbt::io::ReadOptions options;
+	options.arena = &arena;
+	for(auto _ : state) {
+		{
+			nbt::io::MemoryInputStream s(&doc[0], doc.size());
+			benchmark::DoNotOptimize(nbt::io::read_nbt(s, options));
+		}
+		arena.reset();
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_MemoryInputStream_Arena);
+
+void BM_ReadNbt_MemoryInputStream_ArenaAndNames(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::Arena arena;
+	nbt::NameTable names;
+	nbt::io::ReadOptions options;
+	options.arena = &arena;
+	options.names = &names;
+	for(auto _ : state) {
+		{
+			nbt::io::MemoryInputStream s(&doc[0], doc.size());
+			benchmark::DoNotOptimize(nbt::io::read_nbt(s, options));
+		}
+		arena.reset();
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_MemoryInputStream_ArenaAndNames);
+
+void BM_ReadNbt_MemoryInputStream_Stats(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::io::ReadStats stats;
+	nbt::io::ReadOptions options;
+	options.stats = &stats;
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s, options));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_MemoryInputStream_Stats);
+
+void BM_ReadNbt_Arrays(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = array_document();
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_Arrays);
+
+// Metadata-style scan: one field per entity.
+void BM_ReadNbt_Projected(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::io::Projection projection(std::vector<std::string>{"Entities.id"});
+	nbt::io::ReadOptions options;
+	options.projection = &projection;
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s, options));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_Projected);
+
+// The same fields as BM_ReadNbtInto, read into a tree and looked up by hand.
+void BM_ReadNbt_AndLookUp(benchmark::State &state) {
+	using namespace nbt;
+	const std::vector<unsigned char> &doc = document();
+	for(auto _ : state) {
+		io::MemoryInputStream s(&doc[0], doc.size());
+		RootTag root = io::read_nbt(s);
+		const CompoundMap &values = static_cast<CompoundTag &>(*root.tag).values;
+		BenchDocument out;
+		const ListTag<CompoundTag> &entities = static_cast<const ListTag<CompoundTag> &>(*values.find("Entities")->second);
+		for(const TagPtr<CompoundTag> &entity : entities.values) {
+			const CompoundMap &fields = entity->values;
+			BenchEntity e;
+			const Utf8String &id = static_cast<const StringTag &>(*fields.find("id")->second).value;
+			e.id.assign(reinterpret_cast<const char *>(id.data.data()), id.data.size());
+			const ListTag<DoubleTag> &pos = static_cast<const ListTag<DoubleTag> &>(*fields.find("Pos")->second);
+			e.pos.assign(pos.values.begin(), pos.values.end());
+			const ListTag<FloatTag> &rotation = static_cast<const ListTag<FloatTag> &>(*fields.find("Rotation")->second);
+			e.rotation.assign(rotation.values.begin(), rotation.values.end());
+			e.air = static_cast<const ShortTag &>(*fields.find("Air")->second).value;
+			e.on_ground = static_cast<const ByteTag &>(*fields.find("OnGround")->second).value != 0;
+			e.uuid_most = static_cast<const LongTag &>(*fields.find("UUIDMost")->second).value;
+			e.uuid_least = static_cast<const LongTag &>(*fields.find("UUIDLeast")->second).value;
+			out.entities.push_back(std::move(e));
+		}
+		const Array<unsigned char> &blocks = static_cast<const ByteArrayTag &>(*values.find("Blocks")->second).value;
+		out.blocks.assign(blocks.begin(), blocks.end());
+		benchmark::DoNotOptimize(out);
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_AndLookUp);
+
+void BM_ReadNbtInto(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		BenchDocument out;
+		nbt::io::read_nbt_into(s, out);
+		benchmark::DoNotOptimize(out);
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbtInto);
+
+// The same fields again, as columns.
+nbt::io::ExportOptions entity_export_options() {
+	using namespace nbt::io;
+	ExportOptions options;
+	options.rows = "Entities";
+	options.columns.push_back(ExportColumn("id", COLUMN_STRING));
+	ExportColumn pos("Pos", COLUMN_FLOAT64);
+	pos.list = true;
+	options.columns.push_back(pos);
+	ExportColumn rotation("Rotation", COLUMN_FLOAT32);
+	rotation.list = true;
+	options.columns.push_back(rotation);
+	options.columns.push_back(ExportColumn("Air", COLUMN_INT16));
+	options.columns.push_back(ExportColumn("OnGround", COLUMN_INT8));
+	options.columns.push_back(ExportColumn("UUIDMost", COLUMN_INT64));
+	options.columns.push_back(ExportColumn("UUIDLeast", COLUMN_INT64));
+	return options;
+}
+
+void BM_ColumnarExport_ReadNbt(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::io::ColumnarExporter exporter(entity_export_options());
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		exporter.add(nbt::io::read_nbt(s));
+		benchmark::DoNotOptimize(exporter.take_batch());
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ColumnarExport_ReadNbt);
+
+void BM_ColumnarExport_Events(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::io::ColumnarExporter exporter(entity_export_options());
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		exporter.add(s);
+		benchmark::DoNotOptimize(exporter.take_batch());
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ColumnarExport_Events);
+
+// document() arriving a TCP segment at a time.
+void BM_IncrementalReader(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	const size_t packet_size = 1460;
+	nbt::io::IncrementalReader reader;
+	for(auto _ : state) {
+		for(size_t offset = 0; offset < doc.size(); offset += packet_size) {
+			size_t size = std::min(packet_size, doc.size() - offset);
+			if(reader.feed(&doc[offset], size) == nbt::io::IncrementalReader::DONE) {
+				benchmark::DoNotOptimize(reader.take());
+			}
+		}
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_IncrementalReader);
+
+// Walking every event without building a tree.
+void BM_EventReader(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		nbt::io::EventReader reader(s);
+		size_t events = 0;
+		while(reader.next() != nbt::io::EventReader::EVENT_END_OF_DOCUMENT) {
+			++events;
+		}
+		benchmark::DoNotOptimize(events);
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_EventReader);
+
+// Walking the whole document without decoding any of it.
+void BM_SkipTag(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		unsigned char header[3];
+		s.read_buffered(header, sizeof(header));
+		nbt::io::skip_tag(s, header[0]);
+		benchmark::DoNotOptimize(s.position());
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_SkipTag);
+
+// The unbuffered path: every primitive is its own std::istream::read.
+void BM_ReadNbt_IStreamInputStream(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	std::string doc_string(doc.begin(), doc.end());
+	for(auto _ : state) {
+		std::istringstream is(doc_string);
+		nbt::io::IStreamInputStream s(is);
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_IStreamInputStream);
+
+void BM_ReadNbt_BufferedIStreamInputStream(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	std::string doc_string(doc.begin(), doc.end());
+	for(auto _ : state) {
+		std::istringstream is(doc_string);
+		nbt::io::BufferedIStreamInputStream s(is);
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_BufferedIStreamInputStream);
+
+// Bytes processed counts the decompressed size, to compare with the above.
+void BM_ReadNbt_GzipInputStream(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	const std::vector<unsigned char> &compressed = gzip_document();
+	for(auto _ : state) {
+		nbt::io::GzipInputStream s(&compressed[0], compressed.size());
+		benchmark::DoNotOptimize(nbt::io::read_nbt(s));
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_ReadNbt_GzipInputStream);
+
+/* How long lying_document() takes to be turned away. From memory, the
+ * length is checked against what's left; from gzip, which can't tell, the
+ * array grows only as far as its bytes go.
+ */
+void BM_ReadNbt_LyingLength_MemoryInputStream(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = lying_document();
+	for(auto _ : state) {
+		nbt::io::MemoryInputStream s(&doc[0], doc.size());
+		try {
+			nbt::io::read_nbt(s);
+		} catch(const nbt::io::PrematureEof &) {
+		}
+	}
+}
+BENCHMARK(BM_ReadNbt_LyingLength_MemoryInputStream);
+
+void BM_ReadNbt_LyingLength_GzipInputStream(benchmark::State &state) {
+	static const std::vector<unsigned char> compressed = gzip(lying_document());
+	for(auto _ : state) {
+		nbt::io::GzipInputStream s(&compressed[0], compressed.size());
+		try {
+			nbt::io::read_nbt(s);
+		} catch(const nbt::io::PrematureEof &) {
+		}
+	}
+}
+BENCHMARK(BM_ReadNbt_LyingLength_GzipInputStream);
+
+void BM_WriteNbt_MemoryOutputStream(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::io::MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = nbt::io::read_nbt(in);
+	for(auto _ : state) {
+		nbt::io::MemoryOutputStream s;
+		nbt::io::write_nbt(s, root);
+		benchmark::DoNotOptimize(s.data());
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_WriteNbt_MemoryOutputStream);
+
+// Edit one field and write the document back out.
+void BM_LazyEditAndWrite(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	const unsigned char name[] = {'N', 'a', 'm', 'e'};
+	for(auto _ : state) {
+		nbt::LazyRootTag root = nbt::io::read_lazy_nbt(&doc[0], doc.size());
+		root.tag->set(nbt::Utf8String(name, sizeof(name)), nbt::TagPtr<nbt::Tag>(new nbt::IntTag(1)));
+		nbt::io::MemoryOutputStream s;
+		nbt::io::write_nbt(s, root);
+		benchmark::DoNotOptimize(s.data());
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_LazyEditAndWrite);
+
+void BM_WriteNbt_Arrays(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = array_document();
+	nbt::io::MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = nbt::io::read_nbt(in);
+	for(auto _ : state) {
+		nbt::io::MemoryOutputStream s;
+		nbt::io::write_nbt(s, root);
+		benchmark::DoNotOptimize(s.data());
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_WriteNbt_Arrays);
+
+void BM_WriteNbt_OStreamOutputStream(benchmark::State &state) {
+	const std::vector<unsigned char> &doc = document();
+	nbt::io::MemoryInputStream in(&doc[0], doc.size());
+	nbt::RootTag root = nbt::io::read_nbt(in);
+	for(auto _ : state) {
+		std::ostringstream os;
+		nbt::io::OStreamOutputStream s(os);
+		nbt::io::write_nbt(s, root);
+		benchmark::DoNotOptimize(os);
+	}
+	state.SetBytesProcessed(state.iterations() * doc.size());
+}
+BENCHMARK(BM_WriteNbt_OStreamOutputStream);
+
+void BM_CompoundMap_Find(benchmark::State &state) {
+	std::vector<std::string> keys;
+	nbt::CompoundMap map;
+	for(int i = 0; i < 64; ++i) {
+		keys.push_back("minecraft:some_longer_block_entity_name_" + std::to_string(i));
+		const unsigned char *data = reinterpret_cast<const unsigned char *>(keys.back().data());
+		map[nbt::Utf8String(data, keys.back().size())] = nbt::TagPtr<nbt::Tag>(new nbt::IntTag(i));
+	}
+	for(auto _ : state) {
+		for(const std::string &key : keys) {
+			benchmark::DoNotOptimize(map.find(key.data(), key.size()));
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_CompoundMap_Find);
+
+}
+
+BENCHMARK_MAIN();
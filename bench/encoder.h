@@ -0,0 +1,30 @@
+#ifndef NBT_BENCH_ENCODER_H
+#define NBT_BENCH_ENCODER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "nbt.h"
+
+
+/* A tiny NBT encoder, only good enough to build benchmark input. */
+class Encoder {
+public:
+	std::vector<unsigned char> data;
+
+	void u8(unsigned char v) { data.push_back(v); }
+	void u16(uint16_t v) { u8(v >> 8); u8(v & 0xff); }
+	void u32(uint32_t v) { u16(v >> 16); u16(v & 0xffff); }
+	void u64(uint64_t v) { u32(v >> 32); u32(v & 0xffffffff); }
+	void string(const std::string &s) {
+		u16(s.size());
+		data.insert(data.end(), s.begin(), s.end());
+	}
+	void named(nbt::io::TagTypeId type, const std::string &name) {
+		u8(type);
+		string(name);
+	}
+};
+
+#endif
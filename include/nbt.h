@@ -1,10 +1,23 @@
 #ifndef NBT_H
 #define NBT_H
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
 #include <istream>
+#include <ostream>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 
@@ -17,13 +30,233 @@ namespace nbt {
 	 * Thus, we represent the data that way.
 	 */
 
+	/* A contiguous run of T's, which either owns its storage or borrows it from
+	 * somewhere else, such as the buffer a document was parsed from. A
+	 * borrowed Array is only valid as long as whatever it borrows from is.
+	 *
+	 * Copying a borrowed Array gives another borrowed Array; anything that
+	 * needs to write to one (mutable_data(), resize(), ...) first copies the
+	 * contents into storage of its own.
+	 *
+	 * Owned Arrays of up to INLINE_CAPACITY elements are kept inside the
+	 * Array itself, so short strings, which are most of them, need no
+	 * allocation at all. T must be trivially copyable.
+	 */
+	template<typename T>
+	class Array {
+	public:
+		typedef T value_type;
+		typedef const T *const_iterator;
+
+		// One byte of the inline storage is kept for the mode.
+		static const size_t INLINE_CAPACITY = (3 * sizeof(void *) - 1) / sizeof(T);
+
+		Array() : m_data(inline_data()), m_size(0) {
+			set_mode(MODE_INLINE);
+		}
+		Array(const T *p_data, size_t p_size) : Array() {
+			std::copy(p_data, p_data + p_size, assign_uninitialized(p_size));
+		}
+		Array(const std::vector<T> &storage) : Array(storage.data(), storage.size()) {}
+		Array(const Array &other) : Array() {
+			if(other.borrowed()) {
+				m_data = other.m_data;
+				m_size = other.m_size;
+				set_mode(MODE_BORROWED);
+			} else {
+				std::copy(other.begin(), other.end(), assign_uninitialized(other.m_size));
+			}
+		}
+		Array(Array &&other) : Array() {
+			take(other);
+		}
+		~Array() {
+			release();
+		}
+
+		static Array borrow(const T *p_data, size_t p_size) {
+			Array array;
+			array.m_data = p_data;
+			array.m_size = p_size;
+			array.set_mode(MODE_BORROWED);
+			return array;
+		}
+
+		Array &operator = (const Array &other) {
+			if(this != &other) {
+				Array copy(other);
+				release();
+				take(copy);
+			}
+			return *this;
+		}
+		Array &operator = (Array &&other) {
+			if(this != &other) {
+				release();
+				take(other);
+			}
+			return *this;
+		}
+
+		void swap(Array &other) {
+			Array held(std::move(other));
+			other = std::move(*this);
+			*this = std::move(held);
+		}
+
+		const T *data() const { return m_data; }
+		size_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+		bool borrowed() const { return mode() == MODE_BORROWED; }
+		const T *begin() const { return m_data; }
+		const T *end() const { return m_data + m_size; }
+		const T &operator [] (size_t idx) const { return m_data[idx]; }
+
+		T *mutable_data() {
+			own();
+			return const_cast<T *>(m_data);
+		}
+		// New elements are zeroed.
+		void resize(size_t size) {
+			own();
+			if(size > capacity()) {
+				reallocate(std::max(size, 2 * capacity()));
+			}
+			if(size > m_size) {
+				std::fill(const_cast<T *>(m_data) + m_size, const_cast<T *>(m_data) + size, T());
+			}
+			m_size = size;
+		}
+		void assign(const T *p_data, size_t p_size) {
+			Array(p_data, p_size).swap(*this);
+		}
+		/* Makes this an owned Array of `size` elements, which are left for
+		 * the caller to fill in through the pointer returned.
+		 */
+		T *assign_uninitialized(size_t size) {
+			release();
+			if(size > INLINE_CAPACITY) {
+				m_data = static_cast<T *>(::operator new(size * sizeof(T)));
+				set_capacity(size);
+				set_mode(MODE_HEAP);
+			}
+			m_size = size;
+			return const_cast<T *>(m_data);
+		}
+
+		bool operator == (const Array &other) const {
+			// Interned names (see NameTable) are equal exactly when they're
+			// the same pointer, so that much is worth a check first.
+			return m_size == other.m_size && (m_data == other.m_data || std::equal(begin(), end(), other.begin()));
+		}
+		bool operator != (const Array &other) const {
+			return !(*this == other);
+		}
+
+	private:
+		enum Mode {
+			MODE_INLINE,
+			MODE_HEAP,
+			MODE_BORROWED,
+		};
+
+		T *inline_data() { return reinterpret_cast<T *>(m_storage); }
+		Mode mode() const { return static_cast<Mode>(m_storage[sizeof(m_storage) - 1]); }
+		void set_mode(Mode mode) { m_storage[sizeof(m_storage) - 1] = static_cast<unsigned char>(mode); }
+
+		// Heap storage keeps its capacity where the inline elements would be.
+		size_t capacity() const {
+			switch(mode()) {
+				case MODE_INLINE:
+					return INLINE_CAPACITY;
+				case MODE_HEAP: {
+					size_t capacity;
+					std::memcpy(&capacity, m_storage, sizeof(capacity));
+					return capacity;
+				}
+				default:
+					return 0;
+			}
+		}
+		void set_capacity(size_t capacity) {
+			std::memcpy(m_storage, &capacity, sizeof(capacity));
+		}
+
+		// Leaves this empty and inline.
+		void release() {
+			if(mode() == MODE_HEAP) {
+				::operator delete(const_cast<T *>(m_data));
+			}
+			m_data = inline_data();
+			m_size = 0;
+			set_mode(MODE_INLINE);
+		}
+
+		// Moves other's contents into this, which must be empty and inline.
+		void take(Array &other) {
+			switch(other.mode()) {
+				case MODE_INLINE:
+					std::copy(other.m_data, other.m_data + other.m_size, inline_data());
+					break;
+				case MODE_HEAP:
+					m_data = other.m_data;
+					set_capacity(other.capacity());
+					set_mode(MODE_HEAP);
+					break;
+				case MODE_BORROWED:
+					m_data = other.m_data;
+					set_mode(MODE_BORROWED);
+					break;
+			}
+			m_size = other.m_size;
+			other.m_data = other.inline_data();
+			other.m_size = 0;
+			other.set_mode(MODE_INLINE);
+		}
+
+		void own() {
+			if(borrowed()) {
+				const T *borrowed_data = m_data;
+				size_t size = m_size;
+				release();
+				std::copy(borrowed_data, borrowed_data + size, assign_uninitialized(size));
+			}
+		}
+
+		void reallocate(size_t capacity) {
+			T *data = static_cast<T *>(::operator new(capacity * sizeof(T)));
+			std::copy(m_data, m_data + m_size, data);
+			size_t size = m_size;
+			release();
+			m_data = data;
+			m_size = size;
+			set_capacity(capacity);
+			set_mode(MODE_HEAP);
+		}
+
+		static_assert(std::is_trivially_copyable<T>::value, "Array only holds trivially copyable types.");
+		static_assert(INLINE_CAPACITY > 0, "Array elements are too big to store inline.");
+
+		const T *m_data;
+		size_t m_size;
+		alignas(alignof(size_t) > alignof(T) ? alignof(size_t) : alignof(T))
+			unsigned char m_storage[3 * sizeof(void *)];
+	};
+
 	class Utf8String {
 	public:
-		std::vector<unsigned char> data;
+		Array<unsigned char> data;
 
 		Utf8String() : data() { }
-		Utf8String(unsigned char *p_data, size_t p_length) :
-			data(p_data, p_data + p_length) {}
+		Utf8String(const unsigned char *p_data, size_t p_length) :
+			data(p_data, p_length) {}
+
+		/* A string that points at p_data rather than copying it; see Array. */
+		static Utf8String borrow(const unsigned char *p_data, size_t p_length) {
+			Utf8String string;
+			string.data = Array<unsigned char>::borrow(p_data, p_length);
+			return string;
+		}
 
 		bool operator == (const Utf8String &other) const {
 			return data == other.data;
@@ -36,21 +269,221 @@ namespace nbt {
 	class Utf8StringHash {
 	public:
 		size_t operator() (const nbt::Utf8String &s) const;
+		// The same hash, for bytes that aren't in a Utf8String.
+		size_t operator() (const unsigned char *data, size_t size) const;
+	};
+
+	namespace io {
+		typedef unsigned char TagTypeId;
+		const TagTypeId TAG_TYPE_END = 0;
+		const TagTypeId TAG_TYPE_BYTE = 1;
+		const TagTypeId TAG_TYPE_SHORT = 2;
+		const TagTypeId TAG_TYPE_INT = 3;
+		const TagTypeId TAG_TYPE_LONG = 4;
+		const TagTypeId TAG_TYPE_FLOAT = 5;
+		const TagTypeId TAG_TYPE_DOUBLE = 6;
+		const TagTypeId TAG_TYPE_BYTE_ARRAY = 7;
+		const TagTypeId TAG_TYPE_STRING = 8;
+		const TagTypeId TAG_TYPE_LIST = 9;
+		const TagTypeId TAG_TYPE_COMPOUND = 10;
+		const TagTypeId TAG_TYPE_INT_ARRAY = 11;
+		const TagTypeId TAG_TYPE_LONG_ARRAY = 12;
+	}
+
+	class Tag;
+
+	/* A monotonic region allocator: allocations are carved one after another
+	 * out of large blocks, and are only ever freed all at once. Trees read
+	 * with ReadOptions::arena get their nodes, strings and arrays from here,
+	 * which saves a malloc/free pair for almost every one of them.
+	 *
+	 * The arena must outlive anything allocated from it. In particular,
+	 * destroy (or reset()) a tree before resetting or destroying its arena.
+	 */
+	class Arena {
+	public:
+		static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+		explicit Arena(size_t block_size = DEFAULT_BLOCK_SIZE);
+		~Arena();
+
+		void *allocate(size_t size, size_t alignment);
+
+		template<typename T, typename... Args>
+		T *create(Args&&... args) {
+			T *obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			mark(obj);
+			return obj;
+		}
+
+		/* Frees everything allocated so far. The largest block is kept
+		 * around, so an arena reused for documents of similar sizes
+		 * settles down to not allocating at all.
+		 */
+		void reset();
+
+		size_t bytes_allocated() const { return m_bytes_allocated; }
+
+	private:
+		Arena(const Arena &);
+		Arena &operator = (const Arena &);
+
+		static void mark(Tag *tag);
+		static void mark(void *) {}
+
+		struct Block {
+			unsigned char *data;
+			size_t size;
+		};
+
+		size_t m_block_size;
+		std::vector<Block> m_blocks;
+		unsigned char *m_position;
+		unsigned char *m_end;
+		size_t m_bytes_allocated;
 	};
 
+	/* A standard allocator that draws from an Arena, or from the heap if it
+	 * doesn't have one. Containers in the tree use it, so default-constructed
+	 * tags behave just like they would with std::allocator.
+	 */
+	template<typename T>
+	class ArenaAllocator {
+	public:
+		typedef T value_type;
+
+		ArenaAllocator() : m_arena(nullptr) {}
+		ArenaAllocator(Arena *arena) : m_arena(arena) {}
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.arena()) {}
+
+		T *allocate(size_t n) {
+			if(m_arena) {
+				return static_cast<T *>(m_arena->allocate(n * sizeof(T), alignof(T)));
+			}
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		}
+		void deallocate(T *p, size_t) {
+			if(!m_arena) {
+				::operator delete(p);
+			}
+		}
+
+		Arena *arena() const { return m_arena; }
+
+		template<typename U>
+		bool operator == (const ArenaAllocator<U> &other) const {
+			return m_arena == other.arena();
+		}
+		template<typename U>
+		bool operator != (const ArenaAllocator<U> &other) const {
+			return m_arena != other.arena();
+		}
+
+	private:
+		Arena *m_arena;
+	};
+
+	/* Keeps one copy of each distinct tag name, so that a tree (or many of
+	 * them) can share them. Names come back borrowed from the table, which
+	 * must outlive anything that uses them. Not thread-safe.
+	 *
+	 * Once it holds max_names names, the table stops taking new ones, to
+	 * stay bounded on input with endless distinct names.
+	 */
+	class NameTable {
+	public:
+		static const size_t DEFAULT_MAX_NAMES = 64 * 1024;
+
+		explicit NameTable(size_t max_names = DEFAULT_MAX_NAMES) : m_max_names(max_names) {}
+		NameTable(const NameTable &) = delete;
+		NameTable &operator = (const NameTable &) = delete;
+
+		/* Sets `name` to the table's copy of the string, adding it if it
+		 * isn't there yet. Returns false, leaving `name` alone, if it has
+		 * to be added and the table is full.
+		 */
+		bool intern(const unsigned char *data, size_t size, Utf8String &name);
+
+		size_t size() const { return m_names.size(); }
+
+	private:
+		Arena m_storage;
+		std::unordered_set<Utf8String, Utf8StringHash> m_names;
+		size_t m_max_names;
+	};
+
+	/* Every tag knows its own TagTypeId, so code that needs to tell tags
+	 * apart can switch on type() (or use visit(), below) instead of trying
+	 * dynamic_casts one after another.
+	 */
 	class Tag {
 	public:
+		// Copies are never in the arena the original was, if any.
+		Tag(const Tag &other) : m_in_arena(false), m_type(other.m_type) {}
+		Tag &operator = (const Tag &) { return *this; }
 		virtual ~Tag() {};
+
+		io::TagTypeId type() const { return m_type; }
+		bool in_arena() const { return m_in_arena; }
+
+	protected:
+		explicit Tag(io::TagTypeId type) : m_in_arena(false), m_type(type) {}
+
+	private:
+		friend class Arena;
+		bool m_in_arena;
+		io::TagTypeId m_type;
+	};
+
+	inline void Arena::mark(Tag *tag) {
+		tag->m_in_arena = true;
+	}
+
+	/* Deletes heap-allocated tags; arena-allocated ones are only destroyed,
+	 * and their memory goes back when the arena does.
+	 */
+	struct TagDeleter {
+		void operator() (Tag *tag) const {
+			if(tag->in_arena()) {
+				tag->~Tag();
+			} else {
+				delete tag;
+			}
+		}
 	};
 
+	template<typename T>
+	using TagPtr = std::unique_ptr<T, TagDeleter>;
+
+	/* TagTypeOf<T>::value is the TagTypeId of tag class T. */
+	template<typename T>
+	struct TagTypeOf;
+
+	template<typename T>
+	struct BasicTagTypeOf;
+
+	#define NBT_BASIC_TAG_TYPE(value_type, type_id) \
+		template<> \
+		struct BasicTagTypeOf<value_type> { \
+			static const io::TagTypeId value = type_id; \
+		};
+	NBT_BASIC_TAG_TYPE(int8_t, io::TAG_TYPE_BYTE)
+	NBT_BASIC_TAG_TYPE(int16_t, io::TAG_TYPE_SHORT)
+	NBT_BASIC_TAG_TYPE(int32_t, io::TAG_TYPE_INT)
+	NBT_BASIC_TAG_TYPE(int64_t, io::TAG_TYPE_LONG)
+	NBT_BASIC_TAG_TYPE(float, io::TAG_TYPE_FLOAT)
+	NBT_BASIC_TAG_TYPE(double, io::TAG_TYPE_DOUBLE)
+	#undef NBT_BASIC_TAG_TYPE
+
 	template<typename T>
 	class BasicTag : public Tag {
 	public:
 		typedef T value_type;
 		T value;
 
-		BasicTag(T p_value) : value(p_value) {}
-		BasicTag() : value() {}
+		BasicTag(T p_value) : Tag(BasicTagTypeOf<T>::value), value(p_value) {}
+		BasicTag() : Tag(BasicTagTypeOf<T>::value), value() {}
 	};
 	typedef BasicTag<int8_t> ByteTag;
 	typedef BasicTag<int16_t> ShortTag;
@@ -59,17 +492,48 @@ namespace nbt {
 	typedef BasicTag<float> FloatTag;
 	typedef BasicTag<double> DoubleTag;
 
+	/* This, along with StringTag, holds its data in an Array; a tree read into
+	 * an arena borrows the arena's memory for it.
+	 */
 	class ByteArrayTag : public Tag {
 	public:
-		std::vector<unsigned char> value;
+		Array<unsigned char> value;
+
+		ByteArrayTag() : Tag(io::TAG_TYPE_BYTE_ARRAY), value() {}
 	};
 
 	class StringTag : public Tag {
 	public:
 		Utf8String value;
+
+		StringTag() : Tag(io::TAG_TYPE_STRING), value() {}
+	};
+
+	class ListTagBase : public Tag {
+	public:
+		/* The type of the list's elements. This is what tells apart the
+		 * various ListTag<T>s.
+		 */
+		io::TagTypeId element_type() const { return m_element_type; }
+
+	protected:
+		explicit ListTagBase(io::TagTypeId element_type) :
+			Tag(io::TAG_TYPE_LIST), m_element_type(element_type) {}
+
+	private:
+		io::TagTypeId m_element_type;
 	};
 
-	class ListTagBase : public Tag {};
+	/* The element type of a ListTag<T>. ListTag<Tag> is the list of lists.
+	 */
+	template<typename T>
+	struct ListElementTypeOf {
+		static const io::TagTypeId value = TagTypeOf<T>::value;
+	};
+	template<>
+	struct ListElementTypeOf<Tag> {
+		static const io::TagTypeId value = io::TAG_TYPE_LIST;
+	};
 
 	template<typename T>
 	class ListTag : public ListTagBase {
@@ -81,41 +545,286 @@ namespace nbt {
 		 * of lists", and could legally contain a list of doubles followed by a
 		 * list of strings.)
 		 */
-		std::vector<std::unique_ptr<T>> values;
+		typedef std::vector<TagPtr<T>, ArenaAllocator<TagPtr<T>>> container_type;
+		container_type values;
+
+		ListTag() : ListTagBase(ListElementTypeOf<T>::value), values() {}
+		explicit ListTag(Arena *arena) :
+			ListTagBase(ListElementTypeOf<T>::value), values(ArenaAllocator<TagPtr<T>>(arena)) {}
+		/* For code generic over T, such as the reader and clone(). Only
+		 * ListTag<Tag> takes the element type as given, as it's used for
+		 * empty lists of TAG_End as well as lists of lists; for any other T
+		 * it must be T's own.
+		 */
+		ListTag(Arena *arena, io::TagTypeId element_type) :
+			ListTagBase(element_type), values(ArenaAllocator<TagPtr<T>>(arena))
+		{
+			assert((std::is_same<T, Tag>::value || element_type == ListElementTypeOf<T>::value));
+		}
+	};
+
+	/* Lists of numbers are stored packed, as a plain vector of values, rather
+	 * than as a vector of individually allocated tags.
+	 */
+	template<typename T>
+	class ListTag<BasicTag<T>> : public ListTagBase {
+	public:
+		typedef T value_type;
+		typedef std::vector<T, ArenaAllocator<T>> container_type;
+		container_type values;
+
+		ListTag() : ListTagBase(BasicTagTypeOf<T>::value), values() {}
+		explicit ListTag(Arena *arena) :
+			ListTagBase(BasicTagTypeOf<T>::value), values(ArenaAllocator<T>(arena)) {}
+	};
+
+	/* A compound's children, in the order they were added, in one flat
+	 * array. Most compounds are small enough that scanning it beats hashing;
+	 * past INDEX_THRESHOLD entries, a hash index is kept alongside.
+	 *
+	 * Much like std::unordered_map, but keys are not const: don't change a
+	 * key through an iterator. Inserting or erasing invalidates iterators.
+	 */
+	class CompoundMap {
+	public:
+		typedef Utf8String key_type;
+		typedef TagPtr<Tag> mapped_type;
+		typedef std::pair<Utf8String, TagPtr<Tag>> value_type;
+		typedef ArenaAllocator<value_type> allocator_type;
+		typedef std::vector<value_type, allocator_type> storage_type;
+		typedef storage_type::iterator iterator;
+		typedef storage_type::const_iterator const_iterator;
+
+		static const size_t INDEX_THRESHOLD = 16;
+
+		explicit CompoundMap(Arena *arena = nullptr) :
+			m_entries(allocator_type(arena)), m_index(ArenaAllocator<uint32_t>(arena)) {}
+
+		iterator begin() { return m_entries.begin(); }
+		iterator end() { return m_entries.end(); }
+		const_iterator begin() const { return m_entries.begin(); }
+		const_iterator end() const { return m_entries.end(); }
+		size_t size() const { return m_entries.size(); }
+		bool empty() const { return m_entries.empty(); }
+		void reserve(size_t size) { m_entries.reserve(size); }
+
+		iterator find(const Utf8String &key) {
+			return m_entries.begin() + find_index(key);
+		}
+		const_iterator find(const Utf8String &key) const {
+			return m_entries.begin() + find_index(key);
+		}
+		size_t count(const Utf8String &key) const {
+			return find_index(key) == m_entries.size() ? 0 : 1;
+		}
+
+		/* Looking up by plain bytes or C strings, without building a
+		 * Utf8String first.
+		 */
+		iterator find(const char *key, size_t size) {
+			return find(Utf8String::borrow(reinterpret_cast<const unsigned char *>(key), size));
+		}
+		const_iterator find(const char *key, size_t size) const {
+			return find(Utf8String::borrow(reinterpret_cast<const unsigned char *>(key), size));
+		}
+		iterator find(const char *key) {
+			return find(key, std::strlen(key));
+		}
+		const_iterator find(const char *key) const {
+			return find(key, std::strlen(key));
+		}
+		size_t count(const char *key) const {
+			return find(key) == end() ? 0 : 1;
+		}
+
+		/* Does nothing, as with std::unordered_map, if the key is there
+		 * already.
+		 */
+		std::pair<iterator, bool> insert(value_type &&value);
+		// Adds a null tag if the key isn't there.
+		TagPtr<Tag> &operator [] (const Utf8String &key);
+		size_t erase(const Utf8String &key);
+		iterator erase(const_iterator position);
+		void clear();
+
+	private:
+		// m_entries.size() if there's no such key.
+		size_t find_index(const Utf8String &key) const;
+		void add_to_index(size_t entry);
+		void rebuild_index();
+
+		storage_type m_entries;
+		/* Open addressing: each slot is an index into m_entries, plus one,
+		 * or 0 if it's free. Empty while there are few enough entries.
+		 */
+		std::vector<uint32_t, ArenaAllocator<uint32_t>> m_index;
 	};
 
 	class CompoundTag : public Tag {
 	public:
-		std::unordered_map<Utf8String, std::unique_ptr<Tag>, Utf8StringHash> values;
+		typedef CompoundMap container_type;
+		container_type values;
+
+		CompoundTag() : Tag(io::TAG_TYPE_COMPOUND), values() {}
+		explicit CompoundTag(Arena *arena) :
+			Tag(io::TAG_TYPE_COMPOUND), values(arena) {}
 	};
 
 	class IntArrayTag : public Tag {
 	public:
-		std::vector<int32_t> values;
+		typedef std::vector<int32_t, ArenaAllocator<int32_t>> container_type;
+		container_type values;
+
+		IntArrayTag() : Tag(io::TAG_TYPE_INT_ARRAY), values() {}
+		explicit IntArrayTag(Arena *arena) :
+			Tag(io::TAG_TYPE_INT_ARRAY), values(ArenaAllocator<int32_t>(arena)) {}
+	};
+
+	class LongArrayTag : public Tag {
+	public:
+		typedef std::vector<int64_t, ArenaAllocator<int64_t>> container_type;
+		container_type values;
+
+		LongArrayTag() : Tag(io::TAG_TYPE_LONG_ARRAY), values() {}
+		explicit LongArrayTag(Arena *arena) :
+			Tag(io::TAG_TYPE_LONG_ARRAY), values(ArenaAllocator<int64_t>(arena)) {}
+	};
+
+	template<typename T>
+	struct TagTypeOf<BasicTag<T>> {
+		static const io::TagTypeId value = BasicTagTypeOf<T>::value;
+	};
+	#define NBT_TAG_TYPE(cls, type_id) \
+		template<> \
+		struct TagTypeOf<cls> { \
+			static const io::TagTypeId value = type_id; \
+		};
+	NBT_TAG_TYPE(ByteArrayTag, io::TAG_TYPE_BYTE_ARRAY)
+	NBT_TAG_TYPE(StringTag, io::TAG_TYPE_STRING)
+	NBT_TAG_TYPE(ListTagBase, io::TAG_TYPE_LIST)
+	NBT_TAG_TYPE(CompoundTag, io::TAG_TYPE_COMPOUND)
+	NBT_TAG_TYPE(IntArrayTag, io::TAG_TYPE_INT_ARRAY)
+	NBT_TAG_TYPE(LongArrayTag, io::TAG_TYPE_LONG_ARRAY)
+	#undef NBT_TAG_TYPE
+	template<typename T>
+	struct TagTypeOf<ListTag<T>> {
+		static const io::TagTypeId value = io::TAG_TYPE_LIST;
 	};
 
+	namespace detail {
+		template<typename From, typename To>
+		struct CopyConst {
+			typedef To type;
+		};
+		template<typename From, typename To>
+		struct CopyConst<const From, To> {
+			typedef const To type;
+		};
+
+		template<typename TagT, typename Visitor>
+		auto visit_list(TagT &tag, Visitor &visitor)
+			-> decltype(visitor(std::declval<typename CopyConst<TagT, ByteTag>::type &>()))
+		{
+			#define NBT_VISIT_LIST(type_id, cls) \
+				case type_id: \
+					return visitor(static_cast<typename CopyConst<TagT, ListTag<cls>>::type &>(tag));
+			switch(tag.element_type()) {
+				NBT_VISIT_LIST(io::TAG_TYPE_BYTE, ByteTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_SHORT, ShortTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_INT, IntTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_LONG, LongTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_FLOAT, FloatTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_DOUBLE, DoubleTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_BYTE_ARRAY, ByteArrayTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_STRING, StringTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_END, Tag)
+				NBT_VISIT_LIST(io::TAG_TYPE_LIST, Tag)
+				NBT_VISIT_LIST(io::TAG_TYPE_COMPOUND, CompoundTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_INT_ARRAY, IntArrayTag)
+				NBT_VISIT_LIST(io::TAG_TYPE_LONG_ARRAY, LongArrayTag)
+				default:
+					throw std::logic_error("visit was passed a list with an unknown element type.");
+			}
+			#undef NBT_VISIT_LIST
+		}
+
+		template<typename TagT, typename Visitor>
+		auto visit(TagT &tag, Visitor &visitor)
+			-> decltype(visitor(std::declval<typename CopyConst<TagT, ByteTag>::type &>()))
+		{
+			#define NBT_VISIT(type_id, cls) \
+				case type_id: \
+					return visitor(static_cast<typename CopyConst<TagT, cls>::type &>(tag));
+			switch(tag.type()) {
+				NBT_VISIT(io::TAG_TYPE_BYTE, ByteTag)
+				NBT_VISIT(io::TAG_TYPE_SHORT, ShortTag)
+				NBT_VISIT(io::TAG_TYPE_INT, IntTag)
+				NBT_VISIT(io::TAG_TYPE_LONG, LongTag)
+				NBT_VISIT(io::TAG_TYPE_FLOAT, FloatTag)
+				NBT_VISIT(io::TAG_TYPE_DOUBLE, DoubleTag)
+				NBT_VISIT(io::TAG_TYPE_BYTE_ARRAY, ByteArrayTag)
+				NBT_VISIT(io::TAG_TYPE_STRING, StringTag)
+				NBT_VISIT(io::TAG_TYPE_COMPOUND, CompoundTag)
+				NBT_VISIT(io::TAG_TYPE_INT_ARRAY, IntArrayTag)
+				NBT_VISIT(io::TAG_TYPE_LONG_ARRAY, LongArrayTag)
+				case io::TAG_TYPE_LIST:
+					return visit_list(static_cast<typename CopyConst<TagT, ListTagBase>::type &>(tag), visitor);
+				default:
+					throw std::logic_error("visit was passed a tag with an unknown type.");
+			}
+			#undef NBT_VISIT
+		}
+	}
+
+	/* Calls visitor(concrete_tag), where concrete_tag is `tag` cast to its
+	 * actual class: ByteTag, ..., ListTag<DoubleTag>, CompoundTag, and so
+	 * on. Lists of lists (and empty lists of TAG_End) come through as
+	 * ListTag<Tag>. The dispatch is a switch on type(), so it's cheap.
+	 *
+	 * The visitor's operator() for every type must return the same type,
+	 * which is what visit returns.
+	 */
+	template<typename Visitor>
+	auto visit(const Tag &tag, Visitor &&visitor)
+		-> decltype(visitor(std::declval<const ByteTag &>()))
+	{
+		return detail::visit(tag, visitor);
+	}
+
+	template<typename Visitor>
+	auto visit(Tag &tag, Visitor &&visitor)
+		-> decltype(visitor(std::declval<ByteTag &>()))
+	{
+		return detail::visit(tag, visitor);
+	}
+
 	class RootTag {
 	public:
 		Utf8String name;
-		std::unique_ptr<Tag> tag;
+		TagPtr<Tag> tag;
 	};
 
+	/* How clone() treats the bytes of names, strings and byte arrays. */
+	enum CloneMode {
+		// Copies them, so the copy stands on its own.
+		CLONE_DEEP,
+		/* Borrows them from the original (see Array), so a copy allocates
+		 * only for its nodes and numbers; those short enough to be stored
+		 * inline are copied, as that costs nothing. Each borrowed one is
+		 * copied the first time the copy changes it. Until then, the
+		 * original must not change, erase or destroy the names, strings
+		 * or byte arrays the copy shares (nor the tree holding them), and
+		 * must outlive the copy; adding to it is fine.
+		 */
+		CLONE_SHARED,
+	};
 
-	namespace io {
+	/* Copies a tree, into `arena` if there is one, without recursing. */
+	TagPtr<Tag> clone(const Tag &tag, Arena *arena = nullptr, CloneMode mode = CLONE_DEEP);
+	RootTag clone(const RootTag &root, Arena *arena = nullptr, CloneMode mode = CLONE_DEEP);
 
-		typedef unsigned char TagTypeId;
-		const TagTypeId TAG_TYPE_END = 0;
-		const TagTypeId TAG_TYPE_BYTE = 1;
-		const TagTypeId TAG_TYPE_SHORT = 2;
-		const TagTypeId TAG_TYPE_INT = 3;
-		const TagTypeId TAG_TYPE_LONG = 4;
-		const TagTypeId TAG_TYPE_FLOAT = 5;
-		const TagTypeId TAG_TYPE_DOUBLE = 6;
-		const TagTypeId TAG_TYPE_BYTE_ARRAY = 7;
-		const TagTypeId TAG_TYPE_STRING = 8;
-		const TagTypeId TAG_TYPE_LIST = 9;
-		const TagTypeId TAG_TYPE_COMPOUND = 10;
-		const TagTypeId TAG_TYPE_INT_ARRAY = 11;
+
+	namespace io {
 
 		class IoError : public std::exception {
 		public:
@@ -136,50 +845,1589 @@ namespace nbt {
 			}
 		};
 
+		namespace detail {
+			class StatsInputStream;
+		}
+
 		class InputStream {
 		public:
-			virtual void read(unsigned char *data, size_t size) = 0;
+			// What position() returns for streams that don't keep track.
+			static const uint64_t UNKNOWN_POSITION = UINT64_MAX;
+
+			InputStream() : m_buffer_position(nullptr), m_buffer_end(nullptr), m_buffer_lendable(false) {}
 			virtual ~InputStream() {};
+
+			virtual void read(unsigned char *data, size_t size) = 0;
+
+			/* Consumes `size` bytes without handing them over, throwing
+			 * PrematureEof if there aren't that many. This one reads them
+			 * into scratch space and drops them; streams that can seek, or
+			 * have it all in memory, do better.
+			 */
+			virtual void skip(size_t size);
+
+			/* How many bytes have been read or skipped since the stream was
+			 * made, or UNKNOWN_POSITION.
+			 */
+			virtual uint64_t position() const { return UNKNOWN_POSITION; }
+
+			/* How many bytes are left, for streams that know for certain,
+			 * or UNKNOWN_POSITION. Lengths read from a stream that knows
+			 * are checked against it before anything is allocated for them.
+			 */
+			virtual uint64_t remaining() const { return UNKNOWN_POSITION; }
+
+			/* The reader's way in: if the stream has the bytes sitting in its
+			 * buffer, this is a plain copy with no virtual call; otherwise it
+			 * falls back to read().
+			 */
+			void read_buffered(unsigned char *data, size_t size) {
+				if(static_cast<size_t>(m_buffer_end - m_buffer_position) >= size) {
+					std::copy(m_buffer_position, m_buffer_position + size, data);
+					m_buffer_position += size;
+				} else {
+					read(data, size);
+				}
+			}
+
+			// The same for skip().
+			void skip_buffered(size_t size) {
+				if(static_cast<size_t>(m_buffer_end - m_buffer_position) >= size) {
+					m_buffer_position += size;
+				} else {
+					skip(size);
+				}
+			}
+
+			/* If the next `size` bytes are sitting in a buffer that stays put
+			 * for as long as the stream does (see m_buffer_lendable), consumes
+			 * them and returns a pointer to them. Otherwise, returns null and
+			 * consumes nothing.
+			 */
+			const unsigned char *lend(size_t size) {
+				if(m_buffer_lendable && static_cast<size_t>(m_buffer_end - m_buffer_position) >= size) {
+					const unsigned char *lent = m_buffer_position;
+					m_buffer_position += size;
+					return lent;
+				}
+				return nullptr;
+			}
+
+		protected:
+			/* Streams that hold their data in a contiguous buffer point these
+			 * at the unread part of it. read() implementations must consume
+			 * from here before going back to their underlying source. Streams
+			 * that don't buffer can leave them null.
+			 */
+			const unsigned char *m_buffer_position;
+			const unsigned char *m_buffer_end;
+			/* Set by streams whose buffer is never refilled or moved, so that
+			 * pointers into it can be handed out by lend().
+			 */
+			bool m_buffer_lendable;
+
+			friend class detail::StatsInputStream;
 		};
 
 		class IStreamInputStream : public InputStream {
 		public:
-			IStreamInputStream(std::istream &stream) : m_istream(stream) {}
+			IStreamInputStream(std::istream &stream) : m_istream(stream), m_position(0) {}
 			virtual void read(unsigned char *data, size_t size) {
 				if(!m_istream.read(reinterpret_cast<char *>(data), size)) {
-					if(m_istream.fail()) {
+					if(m_istream.bad()) {
 						throw IoError();
 					} else {
 						throw PrematureEof();
 					}
 				}
+				m_position += size;
 			}
+			// Seeks over big skips, if the istream can seek.
+			virtual void skip(size_t size);
+			virtual uint64_t position() const { return m_position; }
 		private:
 			std::istream &m_istream;
+			uint64_t m_position;
+		};
+
+		/* Like IStreamInputStream, but reads from the istream in large blocks.
+		 * Note that this reads ahead: once you're done with it, the istream
+		 * may be positioned up to buffer_size bytes past the end of the NBT
+		 * data.
+		 */
+		class BufferedIStreamInputStream : public InputStream {
+		public:
+			static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+			BufferedIStreamInputStream(std::istream &stream, size_t buffer_size = DEFAULT_BUFFER_SIZE) :
+				m_istream(stream), m_buffer(buffer_size), m_istream_position(0) {}
+			virtual void read(unsigned char *data, size_t size);
+			virtual void skip(size_t size);
+			virtual uint64_t position() const {
+				return m_istream_position - (m_buffer_end - m_buffer_position);
+			}
+		private:
+			std::istream &m_istream;
+			std::vector<unsigned char> m_buffer;
+			// How much we've taken from the istream, buffered or not.
+			uint64_t m_istream_position;
+		};
+
+		enum CompressionFormat {
+			COMPRESSION_ZLIB,
+			COMPRESSION_GZIP,
+			// Either of the above, going by the header.
+			COMPRESSION_DETECT,
+		};
+
+		/* Decompresses as it's read, a window at a time, so the whole
+		 * inflated blob never has to be held in memory. The compressed data
+		 * comes either from memory (which must outlive the stream) or from a
+		 * std::istream; in the latter case, the istream may be read past the
+		 * end of the compressed data.
+		 */
+		class InflateInputStream : public InputStream {
+		public:
+			static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+			InflateInputStream(const unsigned char *data, size_t size,
+				CompressionFormat format = COMPRESSION_DETECT, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+			InflateInputStream(std::istream &stream,
+				CompressionFormat format = COMPRESSION_DETECT, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+			virtual ~InflateInputStream();
+			virtual void read(unsigned char *data, size_t size);
+			// In the inflated data.
+			virtual uint64_t position() const;
+
+			/* Starts over on new compressed data in memory, keeping the
+			 * window and zlib's state rather than allocating them again.
+			 */
+			void reset(const unsigned char *data, size_t size, CompressionFormat format = COMPRESSION_DETECT);
+		private:
+			struct State;
+
+			void init(CompressionFormat format);
+			bool refill_input();
+			size_t inflate_into(unsigned char *data, size_t size);
+
+			std::unique_ptr<State> m_state;
+			std::istream *m_istream;
+			const unsigned char *m_source_position;
+			const unsigned char *m_source_end;
+			std::vector<unsigned char> m_window;
+			bool m_finished;
+		};
+
+		// level.dat and playerdata.
+		class GzipInputStream : public InflateInputStream {
+		public:
+			GzipInputStream(const unsigned char *data, size_t size, size_t buffer_size = DEFAULT_BUFFER_SIZE) :
+				InflateInputStream(data, size, COMPRESSION_GZIP, buffer_size) {}
+			GzipInputStream(std::istream &stream, size_t buffer_size = DEFAULT_BUFFER_SIZE) :
+				InflateInputStream(stream, COMPRESSION_GZIP, buffer_size) {}
+		};
+
+		// Region file chunks.
+		class ZlibInputStream : public InflateInputStream {
+		public:
+			ZlibInputStream(const unsigned char *data, size_t size, size_t buffer_size = DEFAULT_BUFFER_SIZE) :
+				InflateInputStream(data, size, COMPRESSION_ZLIB, buffer_size) {}
+			ZlibInputStream(std::istream &stream, size_t buffer_size = DEFAULT_BUFFER_SIZE) :
+				InflateInputStream(stream, COMPRESSION_ZLIB, buffer_size) {}
 		};
 
 		class MemoryInputStream : public InputStream {
 		public:
-			MemoryInputStream(const unsigned char * const data, size_t size) :
-				m_data(data), m_size(size), m_position(0) {}
+			/* The data must outlive the stream, and, if read with
+			 * ReadOptions::borrow_buffers, the tree that is read from it.
+			 * It's fine for it to be mmap'd.
+			 */
+			MemoryInputStream(const unsigned char * const data, size_t size) : m_begin(data) {
+				m_buffer_position = data;
+				m_buffer_end = data + size;
+				m_buffer_lendable = true;
+			}
 			virtual void read(unsigned char *data, size_t size) {
-				if(m_size - m_position < size) {
+				// read_buffered already handles every read that can succeed.
+				if(static_cast<size_t>(m_buffer_end - m_buffer_position) < size) {
 					throw PrematureEof();
 				}
-				std::copy(m_data + m_position, m_data + m_position + size, data);
-				m_position += size;
+				std::copy(m_buffer_position, m_buffer_position + size, data);
+				m_buffer_position += size;
+			}
+			virtual void skip(size_t size) {
+				if(static_cast<size_t>(m_buffer_end - m_buffer_position) < size) {
+					throw PrematureEof();
+				}
+				m_buffer_position += size;
 			}
+			virtual uint64_t position() const { return m_buffer_position - m_begin; }
+			virtual uint64_t remaining() const { return m_buffer_end - m_buffer_position; }
 		private:
-			const unsigned char * const m_data;
-			size_t m_size;
-			size_t m_position;
+			const unsigned char *m_begin;
+		};
+
+		/* The parts of a tree to read, as paths of names from the root,
+		 * like "Level.xPos". A path picks out the whole subtree under it.
+		 * Lists are looked through, so "Level.Entities.id" reads just the id
+		 * of each entity (and an empty compound for entities without one).
+		 */
+		class Projection {
+		public:
+			// What child() returns for these cases.
+			static const size_t EVERYTHING = SIZE_MAX;
+			static const size_t NOTHING = SIZE_MAX - 1;
+
+			Projection() : m_nodes(1) {}
+			Projection(const std::vector<std::string> &paths) : m_nodes(1) {
+				for(const std::string &path : paths) {
+					add(path);
+				}
+			}
+
+			// Dot-separated.
+			void add(const std::string &path);
+			void add(const std::vector<std::string> &path);
+
+			/* Where a name leads from a node (0 is the root): to another
+			 * node, EVERYTHING under it, or NOTHING at all.
+			 */
+			size_t child(size_t node, const Utf8String &name) const;
+
+		private:
+			struct Node {
+				Node() : whole(false) {}
+				std::vector<std::pair<Utf8String, size_t>> children;
+				bool whole;
+			};
+			std::vector<Node> m_nodes;
+		};
+
+		/* What reads did, for telling a document that's slow to read from
+		 * a slow stream, and for finding the pathological ones. Reads given
+		 * one in ReadOptions::stats add to it, so one can cover many reads,
+		 * though only from one thread at a time.
+		 */
+		class ReadStats {
+		public:
+			ReadStats() { reset(); }
+
+			// Zeroes the counts, and leaves on_document as it is.
+			void reset();
+			// Adds another's counts to these.
+			void add(const ReadStats &other);
+
+			/* The time spent in read_nbt but not in the stream's read(),
+			 * which is where I/O and decompression happen.
+			 */
+			uint64_t decode_nanoseconds() const {
+				return total_nanoseconds - stream_nanoseconds;
+			}
+
+			uint64_t documents;
+			// Reads that threw.
+			uint64_t failures;
+			/* Tags read, by TagTypeId. Elements of lists of numbers count
+			 * as tags; those of arrays don't.
+			 */
+			uint64_t tags[TAG_TYPE_LONG_ARRAY + 1];
+			uint64_t bytes_read;
+			// The deepest nesting of compounds and lists.
+			size_t max_depth;
+			/* Tags, and strings and arrays too long to be kept inline,
+			 * allocated from the heap or the arena. Compounds' and lists'
+			 * own storage isn't counted.
+			 */
+			uint64_t allocations;
+			uint64_t stream_nanoseconds;
+			uint64_t total_nanoseconds;
+
+			/* If set, called at the end of every read (failed or not) with
+			 * the stats for that document alone.
+			 */
+			std::function<void(const ReadStats &document)> on_document;
+		};
+
+		/* Bounds for documents from somewhere that can't be trusted, like
+		 * items sent by clients. Each is checked as soon as what it bounds
+		 * is known, before anything is allocated for it, and a document
+		 * that goes past one fails with IoError. 0 means no limit.
+		 *
+		 * Even without limits, a length can't make a read allocate much
+		 * more than the bytes that actually follow it: lengths are
+		 * checked against what's left of a stream that knows (see
+		 * InputStream::remaining), and from one that doesn't, arrays and
+		 * lists grow only as their bytes turn up.
+		 */
+		class ReadLimits {
+		public:
+			ReadLimits() : max_depth(0), max_bytes(0), max_length(0) {}
+
+			// Of compounds and lists; 1 for a root compound of numbers.
+			size_t max_depth;
+
+			/* Of the whole document, as read from the stream. Only for
+			 * streams that know their position() (all of this library's do).
+			 */
+			uint64_t max_bytes;
+
+			/* Of arrays and lists, in elements. (A string is never more
+			 * than 65535 bytes anyway.)
+			 */
+			size_t max_length;
+		};
+
+		class ReadOptions {
+		public:
+			ReadOptions() : borrow_buffers(false), arena(nullptr), names(nullptr), projection(nullptr), stats(nullptr) {}
+
+			/* If set, tag names, StringTags and ByteArrayTags in the tree
+			 * point straight into the stream's buffer wherever the stream
+			 * allows it (MemoryInputStream does), instead of being copied
+			 * out. Such a tree is only valid for as long as that buffer is.
+			 */
+			bool borrow_buffers;
+
+			/* If set, the whole tree (nodes, containers, strings and arrays)
+			 * is allocated from this arena, which must outlive it.
+			 */
+			Arena *arena;
+
+			/* If set, the names of compounds' children are interned in it,
+			 * and are then only valid for as long as it is.
+			 */
+			NameTable *names;
+
+			/* If set, only the parts of the tree it picks out are read;
+			 * everything else is skipped over without being decoded.
+			 */
+			const Projection *projection;
+
+			/* If set, what each read does is counted and timed in it. Reads
+			 * without it don't pay for any of that.
+			 */
+			ReadStats *stats;
+
+			ReadLimits limits;
 		};
 
 		RootTag read_nbt(InputStream &s);
+		RootTag read_nbt(InputStream &s, const ReadOptions &options);
+
+		/* Skips the payload of a tag of the given type (its type and name
+		 * having been read already), walking through compounds and lists
+		 * without decoding anything in them.
+		 */
+		void skip_tag(InputStream &s, TagTypeId tag_type);
+
+		/* Reads document after document, keeping what read_nbt() would
+		 * throw away after each one (the state stack, scratch buffers and,
+		 * if asked for, an arena) for the next.
+		 *
+		 * With use_arena, each tree is allocated from the Reader's own arena
+		 * (in place of options.arena) and every read starts by resetting it,
+		 * so the tree from one read must be gone before the next.
+		 */
+		class Reader {
+		public:
+			explicit Reader(const ReadOptions &options = ReadOptions(), bool use_arena = false);
+			~Reader();
+
+			RootTag read(InputStream &s);
+
+			/* Reads the documents in a buffer of them laid end to end, in
+			 * one pass, handing each to the callback; the tree is destroyed
+			 * once it returns. Returns how many there were.
+			 */
+			size_t read_many(const unsigned char *data, size_t size, const std::function<void(RootTag &root)> &callback);
+
+		private:
+			Reader(const Reader &);
+			Reader &operator = (const Reader &);
+
+			struct State;
+			std::unique_ptr<State> m_state;
+		};
+
+		/* Reads documents from bytes as they arrive (say, off a non-blocking
+		 * socket), never waiting for more. feed() parses as far as the bytes
+		 * fed so far allow and returns NEED_MORE, keeping whatever it is
+		 * part way through for the next call; nothing it has read is read
+		 * again. When a document is complete it returns DONE, and take()
+		 * hands it over.
+		 *
+		 * Bytes fed past the end of a document are kept for the next one,
+		 * which the next feed() starts on (with no new bytes at all, if it
+		 * comes to that). An untaken document is dropped at that point.
+		 *
+		 * ReadOptions::borrow_buffers and ::stats aren't used. Parts of the
+		 * tree a projection skips are skipped whole, so one that isn't all
+		 * there yet is looked through again on the next feed(). Anything
+		 * feed() throws besides leaves the reader as if it were new.
+		 */
+		class IncrementalReader {
+		public:
+			enum Status {
+				NEED_MORE,
+				DONE
+			};
+
+			explicit IncrementalReader(const ReadOptions &options = ReadOptions());
+			~IncrementalReader();
+
+			Status feed(const unsigned char *data, size_t size);
+			RootTag take();
+
+			// How many of the bytes fed so far haven't been parsed yet.
+			size_t buffered() const;
+
+			// Drops the document in progress and everything buffered.
+			void reset();
+
+		private:
+			IncrementalReader(const IncrementalReader &);
+			IncrementalReader &operator = (const IncrementalReader &);
+
+			struct State;
+			std::unique_ptr<State> m_state;
+		};
+
+
+		/* Reads NBT a token at a time, without ever building a tree. Memory
+		 * use only grows with nesting depth (and string length); arrays are
+		 * either pulled out a piece at a time or skipped.
+		 *
+		 * Names and strings are valid until the next call to next() or
+		 * skip(). A tag's name is empty inside lists.
+		 */
+		class EventReader {
+		public:
+			enum Event {
+				EVENT_BEGIN_COMPOUND,
+				EVENT_END_COMPOUND,
+				// element_type() and length() say what's in it.
+				EVENT_BEGIN_LIST,
+				EVENT_END_LIST,
+				// A byte, short, int or long: see int_value().
+				EVENT_INT,
+				// A float or double: see float_value().
+				EVENT_FLOAT,
+				EVENT_STRING,
+				/* A byte, int or long array, with its payload still to be
+				 * read with read_array(). Whatever isn't read by the next
+				 * call to next() is skipped.
+				 */
+				EVENT_ARRAY,
+				EVENT_END_OF_DOCUMENT,
+			};
+
+			EventReader(InputStream &s);
+
+			Event next();
+
+			/* After EVENT_BEGIN_COMPOUND or EVENT_BEGIN_LIST, skips the
+			 * rest of it, up to and including its end event, without
+			 * decoding any of it. After EVENT_ARRAY, skips what's left of
+			 * the payload. Otherwise, does nothing.
+			 */
+			void skip();
+
+			// What the last event was about.
+			Event event() const { return m_event; }
+			TagTypeId type() const { return m_type; }
+			const Utf8String &name() const { return m_name; }
+			/* How many compounds and lists the last event is inside of,
+			 * counting the one it begins but not the one it ends.
+			 */
+			size_t depth() const { return m_stack.size(); }
+
+			int64_t int_value() const { return m_int_value; }
+			double float_value() const { return m_float_value; }
+			const Utf8String &string_value() const { return m_string_value; }
+			TagTypeId element_type() const { return m_element_type; }
+			// Of the list or array, in elements.
+			size_t length() const { return m_length; }
+
+			/* Reads up to `count` more of the current array's elements into
+			 * `data` and returns how many were read: 0 once it's all been
+			 * read. Throws std::logic_error if the array isn't of that
+			 * type.
+			 */
+			size_t read_array(unsigned char *data, size_t count);
+			size_t read_array(int32_t *data, size_t count);
+			size_t read_array(int64_t *data, size_t count);
+
+		private:
+			struct Frame {
+				TagTypeId type;
+				TagTypeId element_type;
+				size_t remaining;
+			};
+
+			Event begin_value(TagTypeId type);
+			Utf8String read_string(std::vector<unsigned char> &buffer);
+			void check_array(TagTypeId type);
+
+			InputStream &m_stream;
+			std::vector<Frame> m_stack;
+			bool m_started;
+			Event m_event;
+			TagTypeId m_type;
+			Utf8String m_name;
+			std::vector<unsigned char> m_name_buffer;
+			int64_t m_int_value;
+			double m_float_value;
+			Utf8String m_string_value;
+			std::vector<unsigned char> m_string_buffer;
+			TagTypeId m_element_type;
+			size_t m_length;
+			// Elements of the current array not yet read.
+			size_t m_array_remaining;
+		};
+
+		/* The push side of EventReader: read_nbt_events calls these as it
+		 * goes. Returning false from begin_compound() or begin_list() skips
+		 * its contents, and its end isn't reported.
+		 */
+		class EventHandler {
+		public:
+			virtual ~EventHandler() {}
+			virtual bool begin_compound(const Utf8String &) { return true; }
+			virtual void end_compound() {}
+			virtual bool begin_list(const Utf8String &, TagTypeId, size_t) { return true; }
+			virtual void end_list() {}
+			virtual void int_value(const Utf8String &, TagTypeId, int64_t) {}
+			virtual void float_value(const Utf8String &, TagTypeId, double) {}
+			virtual void string_value(const Utf8String &, const Utf8String &) {}
+			/* The payload can be read with reader.read_array(); whatever
+			 * isn't is skipped.
+			 */
+			virtual void array(const Utf8String &, TagTypeId, EventReader &) {}
+		};
+
+		void read_nbt_events(InputStream &s, EventHandler &handler);
+
+
+		namespace detail {
+			/* Reinterprets the bits of an unsigned value as the signed value
+			 * of the same width. Every host we build for is two's
+			 * complement, so this is a copy rather than a test of the sign
+			 * bit.
+			 */
+			template<size_t size, typename RT, typename IT>
+			RT twos_complement_decode(IT v) {
+				static_assert(sizeof(IT) == size, "Two's complement decode needs the raw type to be exactly the encoded width.");
+				typename std::make_signed<IT>::type n;
+				std::memcpy(&n, &v, sizeof(n));
+				return static_cast<RT>(n);
+			}
+
+			/* Loads `size` bytes as a big-endian integer. When that's
+			 * exactly a native 16, 32 or 64 bit integer it's a load and a
+			 * single byte swap; the compiler won't find that by itself in
+			 * the loop.
+			 */
+			template<typename T, size_t size, bool native = (sizeof(T) == size && (size == 2 || size == 4 || size == 8))>
+			struct BigEndianLoad {
+				static T load(const unsigned char *data) {
+					T n = 0;
+					for(size_t i = 0; i < size; ++i) {
+						n = (n << 8) | static_cast<T>(data[i]);
+					}
+					return n;
+				}
+			};
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+			inline uint16_t big_endian_to_host(uint16_t v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				return __builtin_bswap16(v);
+#else
+				return v;
+#endif
+			}
+
+			inline uint32_t big_endian_to_host(uint32_t v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				return __builtin_bswap32(v);
+#else
+				return v;
+#endif
+			}
+
+			inline uint64_t big_endian_to_host(uint64_t v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				return __builtin_bswap64(v);
+#else
+				return v;
+#endif
+			}
+
+			template<typename T, size_t size>
+			struct BigEndianLoad<T, size, true> {
+				static T load(const unsigned char *data) {
+					typedef typename std::conditional<size == 2, uint16_t,
+						typename std::conditional<size == 4, uint32_t, uint64_t>::type>::type Word;
+					Word n;
+					std::memcpy(&n, data, size);
+					return static_cast<T>(big_endian_to_host(n));
+				}
+			};
+#endif
+
+			template<typename T, size_t size>
+			T load_big_endian_unsigned_int(const unsigned char *data) {
+				return BigEndianLoad<T, size>::load(data);
+			}
+
+			template<typename T, size_t size>
+			T read_big_endian_unsigned_int(InputStream &s) {
+				unsigned char data[size];
+				s.read_buffered(data, size);
+				return load_big_endian_unsigned_int<T, size>(data);
+			}
+
+			template<typename T, size_t size>
+			T read_big_endian_int(InputStream &s) {
+				typedef typename std::make_unsigned<T>::type RawType;
+				return twos_complement_decode<size, T, RawType>(read_big_endian_unsigned_int<RawType, size>(s));
+			}
+
+			/* Reads `count` packed big-endian values of `raw_type_size`
+			 * bytes each into `data`, in native byte order.
+			 */
+			void read_packed_payload(InputStream &s, void *data, size_t count, size_t raw_type_size);
+
+			// The fewest bytes a payload of the type can take.
+			size_t min_payload_size(TagTypeId tag_type);
+
+			/* How many of `count` elements of `element_size` bytes to make
+			 * room for up front, given that each takes at least `min_size`
+			 * bytes of the stream: all of them, if the stream knows it has
+			 * that many bytes left, or as many as fit in a megabyte if it
+			 * can't tell. Throws PrematureEof if it knows it hasn't.
+			 */
+			size_t plausible_count(InputStream &s, size_t count, size_t min_size, size_t element_size);
+
+			/* Reads `count` packed values into `values`, resizing it to fit: at
+			 * once if the stream vouches for them, and otherwise a step at
+			 * a time as the bytes turn up.
+			 */
+			template<typename Container>
+			void read_packed_vector(InputStream &s, Container &values, size_t count, size_t raw_type_size) {
+				size_t step = plausible_count(s, count, raw_type_size, raw_type_size);
+				size_t done = 0;
+				values.clear();
+				while(done < count) {
+					size_t size = std::min(count - done, std::max(step, done));
+					values.resize(done + size);
+					read_packed_payload(s, &values[done], size, raw_type_size);
+					done += size;
+				}
+			}
+
+			void throw_schema_type_mismatch(const char *field, TagTypeId tag_type);
+		}
+
+		/* Decoders for documents of a known shape, reading straight into
+		 * plain structs in one pass, without building a tree. A struct's
+		 * shape is declared once, at global scope:
+		 *
+		 *     struct Item { std::string id; int8_t count; int8_t slot; };
+		 *     NBT_SCHEMA(Item,
+		 *         NBT_FIELD(id, "id")
+		 *         NBT_FIELD(count, "Count")
+		 *         NBT_FIELD(slot, "Slot"))
+		 *
+		 * and read_nbt_into(s, item) then reads a document whose root
+		 * compound has that shape. Keys the schema doesn't mention are
+		 * skipped, and fields the document doesn't have keep whatever
+		 * values they had. A tag of the wrong type for its field is an
+		 * IoError.
+		 *
+		 * A field can be an integer (read from any integer tag no wider
+		 * than it), a bool (from a byte), a float (from a float), a double
+		 * (from a float or a double), a std::string, a struct with a schema
+		 * of its own, or a std::vector of any of those (from a list, or for
+		 * int8_t, int32_t and int64_t from the matching array too). Keys
+		 * longer than 256 bytes are never matched.
+		 */
+		template<typename T>
+		struct Schema;
+
+		#define NBT_SCHEMA(type, ...) \
+			namespace nbt { namespace io { \
+				template<> \
+				struct Schema<type> { \
+					static bool decode_field( \
+						InputStream &nbt_stream, TagTypeId nbt_tag_type, \
+						const unsigned char *nbt_name, size_t nbt_name_length, type &nbt_object) { \
+						__VA_ARGS__ \
+						return false; \
+					} \
+				}; \
+			} }
+
+		#define NBT_FIELD(member, key) \
+			if(nbt_name_length == sizeof(key) - 1 && std::memcmp(nbt_name, key, sizeof(key) - 1) == 0) { \
+				::nbt::io::detail::decode_value(nbt_stream, nbt_tag_type, nbt_object.member, key); \
+				return true; \
+			}
+
+		namespace detail {
+			const size_t SCHEMA_MAX_NAME_LENGTH = 256;
+
+			/* The tags a vector of T can be read from in one go: a list of
+			 * them, and for some, an array.
+			 */
+			template<typename T>
+			struct PackedTypesOf {
+				static const TagTypeId list_type = TAG_TYPE_END;
+				static const TagTypeId array_type = TAG_TYPE_END;
+			};
+			#define NBT_PACKED_TYPES(value_type, list_type_id, array_type_id) \
+				template<> \
+				struct PackedTypesOf<value_type> { \
+					static const TagTypeId list_type = list_type_id; \
+					static const TagTypeId array_type = array_type_id; \
+				};
+			NBT_PACKED_TYPES(int8_t, TAG_TYPE_BYTE, TAG_TYPE_BYTE_ARRAY)
+			NBT_PACKED_TYPES(int16_t, TAG_TYPE_SHORT, TAG_TYPE_END)
+			NBT_PACKED_TYPES(int32_t, TAG_TYPE_INT, TAG_TYPE_INT_ARRAY)
+			NBT_PACKED_TYPES(int64_t, TAG_TYPE_LONG, TAG_TYPE_LONG_ARRAY)
+			NBT_PACKED_TYPES(float, TAG_TYPE_FLOAT, TAG_TYPE_END)
+			NBT_PACKED_TYPES(double, TAG_TYPE_DOUBLE, TAG_TYPE_END)
+			#undef NBT_PACKED_TYPES
+
+			// All declared up front, since they call each other.
+			template<typename T>
+			typename std::enable_if<std::is_integral<T>::value>::type
+			decode_value(InputStream &s, TagTypeId tag_type, T &out, const char *field);
+			inline void decode_value(InputStream &s, TagTypeId tag_type, bool &out, const char *field);
+			inline void decode_value(InputStream &s, TagTypeId tag_type, float &out, const char *field);
+			inline void decode_value(InputStream &s, TagTypeId tag_type, double &out, const char *field);
+			inline void decode_value(InputStream &s, TagTypeId tag_type, std::string &out, const char *field);
+			template<typename T>
+			void decode_value(InputStream &s, TagTypeId tag_type, std::vector<T> &out, const char *field);
+			template<typename T>
+			typename std::enable_if<!std::is_arithmetic<T>::value>::type
+			decode_value(InputStream &s, TagTypeId tag_type, T &out, const char *field);
+
+			template<typename T>
+			typename std::enable_if<std::is_integral<T>::value>::type
+			decode_value(InputStream &s, TagTypeId tag_type, T &out, const char *field) {
+				int64_t value = 0;
+				if(tag_type == TAG_TYPE_BYTE) {
+					value = read_big_endian_int<int8_t, 1>(s);
+				} else if(tag_type == TAG_TYPE_SHORT && sizeof(T) >= 2) {
+					value = read_big_endian_int<int16_t, 2>(s);
+				} else if(tag_type == TAG_TYPE_INT && sizeof(T) >= 4) {
+					value = read_big_endian_int<int32_t, 4>(s);
+				} else if(tag_type == TAG_TYPE_LONG && sizeof(T) >= 8) {
+					value = read_big_endian_int<int64_t, 8>(s);
+				} else {
+					throw_schema_type_mismatch(field, tag_type);
+				}
+				out = static_cast<T>(value);
+			}
+
+			inline void decode_value(InputStream &s, TagTypeId tag_type, bool &out, const char *field) {
+				if(tag_type != TAG_TYPE_BYTE) {
+					throw_schema_type_mismatch(field, tag_type);
+				}
+				out = read_big_endian_unsigned_int<uint8_t, 1>(s) != 0;
+			}
+
+			inline void decode_value(InputStream &s, TagTypeId tag_type, float &out, const char *field) {
+				if(tag_type != TAG_TYPE_FLOAT) {
+					throw_schema_type_mismatch(field, tag_type);
+				}
+				read_packed_payload(s, &out, 1, sizeof(out));
+			}
+
+			inline void decode_value(InputStream &s, TagTypeId tag_type, double &out, const char *field) {
+				if(tag_type == TAG_TYPE_FLOAT) {
+					float f;
+					read_packed_payload(s, &f, 1, sizeof(f));
+					out = f;
+				} else if(tag_type == TAG_TYPE_DOUBLE) {
+					read_packed_payload(s, &out, 1, sizeof(out));
+				} else {
+					throw_schema_type_mismatch(field, tag_type);
+				}
+			}
+
+			inline void decode_value(InputStream &s, TagTypeId tag_type, std::string &out, const char *field) {
+				if(tag_type != TAG_TYPE_STRING) {
+					throw_schema_type_mismatch(field, tag_type);
+				}
+				size_t length = read_big_endian_unsigned_int<uint16_t, 2>(s);
+				out.resize(length);
+				if(length) {
+					s.read_buffered(reinterpret_cast<unsigned char *>(&out[0]), length);
+				}
+			}
+
+			/* Only vectors of the types PackedTypesOf names can be read in
+			 * one go; for the others this is never called, but must still
+			 * compile.
+			 */
+			template<typename T>
+			void read_packed_vector(InputStream &s, std::vector<T> &out, size_t length, std::true_type) {
+				read_packed_vector(s, out, length, sizeof(T));
+			}
+			template<typename T>
+			void read_packed_vector(InputStream &, std::vector<T> &, size_t, std::false_type) {}
+
+			template<typename T>
+			void decode_value(InputStream &s, TagTypeId tag_type, std::vector<T> &out, const char *field) {
+				typedef PackedTypesOf<T> Packed;
+				typedef std::integral_constant<bool, Packed::list_type != TAG_TYPE_END> IsPacked;
+				if(tag_type == TAG_TYPE_LIST) {
+					TagTypeId element_type = read_big_endian_unsigned_int<unsigned char, 1>(s);
+					size_t length = read_big_endian_unsigned_int<uint32_t, 4>(s);
+					if(IsPacked::value && element_type == Packed::list_type) {
+						read_packed_vector(s, out, length, IsPacked());
+						return;
+					}
+					out.clear();
+					out.reserve(plausible_count(s, length, min_payload_size(element_type), sizeof(T)));
+					for(size_t i = 0; i < length; ++i) {
+						// Not decoded in place, which a std::vector<bool> can't do.
+						T value = T();
+						decode_value(s, element_type, value, field);
+						out.push_back(std::move(value));
+					}
+				} else if(IsPacked::value && tag_type == Packed::array_type && Packed::array_type != TAG_TYPE_END) {
+					size_t length = read_big_endian_unsigned_int<uint32_t, 4>(s);
+					read_packed_vector(s, out, length, IsPacked());
+				} else {
+					throw_schema_type_mismatch(field, tag_type);
+				}
+			}
+
+			/* Reads a compound's payload into a struct with a schema. */
+			template<typename T>
+			void decode_compound(InputStream &s, T &out) {
+				unsigned char name_buffer[SCHEMA_MAX_NAME_LENGTH];
+				for(;;) {
+					TagTypeId tag_type = read_big_endian_unsigned_int<unsigned char, 1>(s);
+					if(tag_type == TAG_TYPE_END) {
+						return;
+					}
+					size_t name_length = read_big_endian_unsigned_int<uint16_t, 2>(s);
+					const unsigned char *name = s.lend(name_length);
+					if(!name) {
+						if(name_length > SCHEMA_MAX_NAME_LENGTH) {
+							s.skip_buffered(name_length);
+							skip_tag(s, tag_type);
+							continue;
+						}
+						s.read_buffered(name_buffer, name_length);
+						name = name_buffer;
+					}
+					if(!Schema<T>::decode_field(s, tag_type, name, name_length, out)) {
+						skip_tag(s, tag_type);
+					}
+				}
+			}
+
+			template<typename T>
+			typename std::enable_if<!std::is_arithmetic<T>::value>::type
+			decode_value(InputStream &s, TagTypeId tag_type, T &out, const char *field) {
+				if(tag_type != TAG_TYPE_COMPOUND) {
+					throw_schema_type_mismatch(field, tag_type);
+				}
+				decode_compound(s, out);
+			}
+		}
+
+		/* Reads a document whose root is a compound into a struct with a
+		 * schema (see Schema). Throws IoError if the root isn't a compound.
+		 */
+		template<typename T>
+		void read_nbt_into(InputStream &s, T &out) {
+			if(detail::read_big_endian_unsigned_int<unsigned char, 1>(s) != TAG_TYPE_COMPOUND) {
+				throw IoError("The root of an NBT document read into a struct must be a compound.");
+			}
+			s.skip_buffered(detail::read_big_endian_unsigned_int<uint16_t, 2>(s));
+			detail::decode_compound(s, out);
+		}
+
+
+		/* An Anvil region file (.mca): a 32x32 grid of chunks, each stored
+		 * as a compressed NBT blob. The file is mmap'd, so only the pages
+		 * of the chunks actually read are ever loaded.
+		 */
+		class RegionFile {
+		public:
+			static const size_t CHUNKS_PER_SIDE = 32;
+			static const size_t CHUNK_COUNT = CHUNKS_PER_SIDE * CHUNKS_PER_SIDE;
+			static const size_t SECTOR_SIZE = 4096;
+			// The location table, then the timestamp table.
+			static const size_t HEADER_SIZE = 2 * SECTOR_SIZE;
+
+			enum ChunkCompression {
+				CHUNK_GZIP = 1,
+				CHUNK_ZLIB = 2,
+				CHUNK_UNCOMPRESSED = 3,
+				CHUNK_LZ4 = 4,
+			};
+
+			/* Where a chunk lives in the file, in sectors. A sector_count
+			 * of 0 means the chunk isn't there.
+			 */
+			struct ChunkLocation {
+				uint32_t sector_offset;
+				uint8_t sector_count;
+			};
+
+			/* A chunk's payload, still compressed, pointing into the
+			 * mapping. The compression is kept raw, as chunks may use
+			 * schemes from outside the enum above. `data` is null if the
+			 * chunk isn't there.
+			 */
+			struct ChunkData {
+				unsigned char compression;
+				const unsigned char *data;
+				size_t size;
+			};
+
+			/* Throws IoError if the file can't be opened or mapped, or is
+			 * too short to hold the header. An empty file is a region with
+			 * no chunks.
+			 */
+			explicit RegionFile(const std::string &path);
+			~RegionFile();
+			RegionFile(const RegionFile &) = delete;
+			RegionFile &operator = (const RegionFile &) = delete;
+
+			/* The index of a chunk, from its coordinates in the region or
+			 * in the world.
+			 */
+			static size_t chunk_index(int x, int z) {
+				return (x & (CHUNKS_PER_SIDE - 1)) + (z & (CHUNKS_PER_SIDE - 1)) * CHUNKS_PER_SIDE;
+			}
+
+			ChunkLocation location(size_t index) const;
+			bool has_chunk(size_t index) const { return location(index).sector_count != 0; }
+			// Seconds since the epoch that the chunk was last saved.
+			uint32_t timestamp(size_t index) const;
+
+			/* Valid for as long as the RegionFile is. Throws IoError if the
+			 * header points outside the file.
+			 */
+			ChunkData chunk_data(size_t index) const;
+
+			/* Decompresses and reads a chunk in one go. Throws
+			 * std::out_of_range if the chunk isn't there, and IoError if
+			 * it's compressed with something other than gzip or zlib, or
+			 * not at all. */
+			RootTag read_chunk(size_t index) const;
+			RootTag read_chunk(size_t index, const ReadOptions &options) const;
+
+			const unsigned char *data() const { return m_data; }
+			size_t size() const { return m_size; }
+		private:
+			const unsigned char *m_data;
+			size_t m_size;
+		};
+
+		class LoadOptions {
+		public:
+			LoadOptions() : thread_count(0), use_arenas(true), projection(nullptr), stats(nullptr) {}
+
+			// 0 means one per hardware thread.
+			size_t thread_count;
+
+			/* If set, each thread reads chunks into an Arena of its own,
+			 * which is reset once the callback returns; the tree passed
+			 * to the callback is then only valid until that point.
+			 */
+			bool use_arenas;
+
+			/* If set, called when a chunk fails to load, and the load
+			 * carries on; if not, the load stops and load_regions rethrows
+			 * the error. The chunk index is RegionFile::CHUNK_COUNT when
+			 * the region file itself couldn't be opened. Called from the
+			 * loading threads, as the chunk callback is.
+			 */
+			std::function<void(const std::string &region_path, size_t chunk_index, std::exception_ptr error)> on_error;
+
+			/* If set, called for every chunk in a region before it's read,
+			 * from the loading threads; chunks it returns false for are
+			 * left alone.
+			 */
+			std::function<bool(const std::string &region_path, size_t chunk_index, const RegionFile &region)> filter;
+
+			// If set, only these parts of each chunk are read.
+			const Projection *projection;
+
+			/* If set, every chunk read is counted in it, as with
+			 * ReadOptions::stats. Each thread keeps its own counts, which
+			 * are added to this once the load is over; its on_document is
+			 * called from the loading threads.
+			 */
+			ReadStats *stats;
+		};
+
+		typedef std::function<void(const std::string &region_path, size_t chunk_index, RootTag &chunk)> ChunkCallback;
+
+		/* Reads every chunk of every region file, spread over a pool of
+		 * threads that steal work from each other a batch of chunks at a
+		 * time. `callback` is called from those threads (one of which is
+		 * the calling thread), concurrently, so it must be thread-safe. A
+		 * thread doesn't read its next chunk until the callback returns,
+		 * which keeps at most one chunk per thread in memory however far
+		 * behind the callback falls.
+		 */
+		void load_regions(const std::vector<std::string> &region_paths, const ChunkCallback &callback);
+		void load_regions(const std::vector<std::string> &region_paths, const ChunkCallback &callback,
+			const LoadOptions &options);
+
+		/* What a chunk index records about each chunk. */
+		class ChunkIndexOptions {
+		public:
+			/* Paths (as for Projection) to integers whose values are kept,
+			 * like "InhabitedTime". Through a list, the first one found is.
+			 */
+			std::vector<std::string> fields;
+
+			/* Paths whose presence is kept, and which strings turn up
+			 * there (in a string, or a list of them), like
+			 * "block_entities.id".
+			 */
+			std::vector<std::string> keys;
+
+			// How the chunks are read. The projection and filter are the index's own.
+			LoadOptions load;
+		};
+
+		/* Indexes every chunk of the region files, which must be named
+		 * r.<x>.<z>.mca, as Minecraft names them, for the chunks'
+		 * coordinates, and writes the index to index_path. If there's an
+		 * index there already, with the same fields and keys, chunks whose
+		 * timestamps in their region haven't changed are taken from it
+		 * rather than read again. The new index is written alongside
+		 * and renamed over the old one, so a ChunkIndex that has the old
+		 * one open carries on seeing it.
+		 *
+		 * Returns the number of chunks read. Throws std::invalid_argument
+		 * for a region file name without coordinates, and IoError if the
+		 * index can't be written.
+		 */
+		size_t update_chunk_index(const std::string &index_path, const std::vector<std::string> &region_paths,
+			const ChunkIndexOptions &options);
+
+		/* An index written by update_chunk_index, mmap'd, so that opening
+		 * one reads only its header and names, and querying one reads
+		 * only what the query needs. Chunks are numbered from 0 in order of
+		 * their x, then z, coordinate.
+		 */
+		class ChunkIndex {
+		public:
+			// What find_chunk and field/key lookups return for nothing.
+			static const size_t NOT_FOUND = SIZE_MAX;
+
+			struct Chunk {
+				int32_t x;
+				int32_t z;
+				// From the region file, as RegionFile::timestamp.
+				uint32_t timestamp;
+			};
+
+			/* Throws IoError if the file can't be opened or mapped, or
+			 * isn't an index.
+			 */
+			explicit ChunkIndex(const std::string &path);
+			~ChunkIndex();
+			ChunkIndex(const ChunkIndex &) = delete;
+			ChunkIndex &operator = (const ChunkIndex &) = delete;
+
+			const std::vector<std::string> &fields() const { return m_fields; }
+			const std::vector<std::string> &keys() const { return m_keys; }
+			size_t field(const std::string &path) const;
+			size_t key(const std::string &path) const;
+
+			size_t chunk_count() const { return m_chunk_count; }
+			Chunk chunk(size_t index) const;
+			size_t find_chunk(int32_t x, int32_t z) const;
+
+			// False if the chunk doesn't have the field.
+			bool value(size_t field, size_t chunk, int64_t &out) const;
+			bool has_key(size_t key, size_t chunk) const;
+
+			/* Chunks, in order, with min <= field <= max, with the key at
+			 * all, and with a given string at the key. Unknown fields and
+			 * keys throw std::invalid_argument.
+			 */
+			std::vector<size_t> chunks_where(const std::string &field, int64_t min, int64_t max) const;
+			std::vector<size_t> chunks_with(const std::string &key) const;
+			std::vector<size_t> chunks_with(const std::string &key, const std::string &value) const;
+
+			// The strings found at a key in any chunk, sorted.
+			std::vector<std::string> values(const std::string &key) const;
+
+		private:
+			// The range of terms for a key.
+			std::pair<size_t, size_t> key_terms(size_t key) const;
+			std::string term_value(size_t term) const;
+			std::vector<size_t> set_bits(const unsigned char *bitmap) const;
+
+			const unsigned char *m_data;
+			size_t m_size;
+			size_t m_chunk_count;
+			size_t m_term_count;
+			size_t m_bitmap_size;
+			const unsigned char *m_chunks;
+			const unsigned char *m_values;
+			const unsigned char *m_terms;
+			const unsigned char *m_bitmaps;
+			const unsigned char *m_strings;
+			size_t m_strings_size;
+			std::vector<std::string> m_fields;
+			std::vector<std::string> m_keys;
+		};
+
+		/* The types of exported columns, named for the Arrow types their
+		 * values are laid out as.
+		 */
+		enum ColumnType {
+			COLUMN_INT8,
+			COLUMN_INT16,
+			COLUMN_INT32,
+			COLUMN_INT64,
+			COLUMN_FLOAT32,
+			COLUMN_FLOAT64,
+			COLUMN_STRING,
+		};
+
+		/* A value to export from each row. Bytes, shorts, ints and longs go
+		 * into integer columns they fit in, and into float columns; floats
+		 * and doubles into float columns; strings into string columns.
+		 * Anything else, or nothing at all, is a null.
+		 */
+		class ExportColumn {
+		public:
+			ExportColumn(const std::string &p_path, ColumnType p_type) :
+				path(p_path), type(p_type), list(false), document(false) {}
+
+			/* As for Projection, from the row. Lists of compounds and of
+			 * lists are looked through, at the end too, and the first value
+			 * found that fits is taken.
+			 */
+			std::string path;
+			ColumnType type;
+
+			/* If set, each row holds a list of numbers, from a list or an
+			 * array tag, in place of a single one; there are no lists of
+			 * strings.
+			 */
+			bool list;
+
+			/* If set, the path is from the document's root rather than the
+			 * row, and the value repeats down each of the document's rows;
+			 * for things like the chunk's coordinates.
+			 */
+			bool document;
+		};
+
+		class ExportOptions {
+		public:
+			ExportOptions() : batch_rows(65536) {}
+
+			/* The path (as for ExportColumn) to each document's rows: the
+			 * compounds there, or in the lists there. Empty makes the
+			 * root the one row.
+			 */
+			std::string rows;
+			std::vector<ExportColumn> columns;
+
+			/* For export_regions, how many rows a thread gathers before
+			 * handing them over as a batch. Chunks aren't split across
+			 * batches, so batches can come out a chunk's worth bigger.
+			 */
+			size_t batch_rows;
+
+			// For export_regions. The projection is the export's own.
+			LoadOptions load;
+		};
+
+		/* One column of a batch, in Arrow's layout for an array of its
+		 * type, so the buffers can be handed to Arrow (or a Parquet writer)
+		 * as they are. Values are in native byte order, which Arrow takes
+		 * to be little-endian.
+		 */
+		class Column {
+		public:
+			std::string path;
+			ColumnType type;
+			bool list;
+			bool document;
+			size_t null_count;
+
+			// A bit per row, least significant first, set where there's a value.
+			std::vector<uint8_t> validity;
+
+			/* For strings and lists, row i's bytes or elements are
+			 * values[offsets[i]] up to values[offsets[i + 1]]. Empty
+			 * otherwise.
+			 */
+			std::vector<int32_t> offsets;
+
+			/* A value (or for lists, the elements) per row, nulls
+			 * included, packed; for strings, their bytes, as NBT has them.
+			 */
+			std::vector<unsigned char> values;
+
+			bool is_valid(size_t row) const { return (validity[row / 8] >> (row % 8)) & 1; }
+			template<typename T>
+			const T *data() const { return reinterpret_cast<const T *>(values.data()); }
+		};
+
+		class ColumnBatch {
+		public:
+			ColumnBatch() : row_count(0) {}
+
+			size_t row_count;
+			// In the order of ExportOptions::columns.
+			std::vector<Column> columns;
+		};
+
+		/* Flattens documents into columns, a row at a time, from trees or
+		 * straight from the bytes. Either way, a document that fails part
+		 * way through adds nothing.
+		 */
+		class ColumnarExporter {
+		public:
+			/* Throws std::invalid_argument for a list column of strings.
+			 */
+			explicit ColumnarExporter(const ExportOptions &options);
+			~ColumnarExporter();
+
+			void add(const Tag &document);
+			// Adds nothing for a root without a tag.
+			void add(const RootTag &document);
+
+			/* Reads a document with EventReader, without building a tree.
+			 * What no path leads into is skipped undecoded.
+			 */
+			void add(InputStream &s);
+
+			// Rows added since the last batch was taken.
+			size_t row_count() const;
+			ColumnBatch take_batch();
+
+		private:
+			ColumnarExporter(const ColumnarExporter &);
+			ColumnarExporter &operator = (const ColumnarExporter &);
+
+			struct State;
+			std::unique_ptr<State> m_state;
+		};
+
+		typedef std::function<void(ColumnBatch &batch)> BatchCallback;
+
+		/* Exports every chunk of every region file, read as load_regions
+		 * reads them, with each loading thread gathering rows into batches
+		 * of its own. `callback` is called from those threads as each
+		 * batch fills, concurrently, so it must be thread-safe; what's left
+		 * in each is handed over from the calling thread at the end. Rows
+		 * come in no particular order, so document columns are the way to
+		 * tell which chunk one is from.
+		 *
+		 * Throws std::invalid_argument if options.batch_rows is 0.
+		 */
+		void export_regions(const std::vector<std::string> &region_paths, const ExportOptions &options,
+			const BatchCallback &callback);
+
+
+		/* The write side mirrors InputStream: write() is the virtual slow
+		 * path, and write_buffered() copies straight into the stream's buffer
+		 * when it has room.
+		 */
+		class OutputStream {
+		public:
+			OutputStream() : m_buffer_position(nullptr), m_buffer_end(nullptr), m_wants_size_hint(false) {}
+			virtual ~OutputStream() {};
+
+			virtual void write(const unsigned char *data, size_t size) = 0;
+
+			/* Pushes out anything buffered. */
+			virtual void flush() {}
+
+			/* A hint that `size` more bytes are about to be written. Only
+			 * called by write_nbt if m_wants_size_hint is set, since working
+			 * out the size takes a pass over the tree.
+			 */
+			virtual void reserve(size_t) {}
+
+			bool wants_size_hint() const { return m_wants_size_hint; }
+
+			void write_buffered(const unsigned char *data, size_t size) {
+				if(static_cast<size_t>(m_buffer_end - m_buffer_position) >= size) {
+					m_buffer_position = std::copy(data, data + size, m_buffer_position);
+				} else {
+					write(data, size);
+				}
+			}
+
+			/* If the stream's buffer has room for `size` more bytes, marks
+			 * them as written and returns a pointer to them, for the caller
+			 * to fill in. Otherwise, returns null and writes nothing.
+			 */
+			unsigned char *claim(size_t size) {
+				if(static_cast<size_t>(m_buffer_end - m_buffer_position) >= size) {
+					unsigned char *claimed = m_buffer_position;
+					m_buffer_position += size;
+					return claimed;
+				}
+				return nullptr;
+			}
+
+		protected:
+			/* The unwritten part of the stream's buffer, if it has one. */
+			unsigned char *m_buffer_position;
+			unsigned char *m_buffer_end;
+			bool m_wants_size_hint;
+		};
+
+		/* Writes to a std::ostream through a buffer of its own. Call flush()
+		 * when done; the destructor does too, but can't report errors.
+		 */
+		class OStreamOutputStream : public OutputStream {
+		public:
+			static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+			OStreamOutputStream(std::ostream &stream, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+			virtual ~OStreamOutputStream();
+			virtual void write(const unsigned char *data, size_t size);
+			virtual void flush();
+		private:
+			std::ostream &m_ostream;
+			std::vector<unsigned char> m_buffer;
+		};
+
+		/* Writes into a growable in-memory buffer. */
+		class MemoryOutputStream : public OutputStream {
+		public:
+			MemoryOutputStream() : m_buffer() {
+				m_wants_size_hint = true;
+			}
+
+			const unsigned char *data() const { return m_buffer.data(); }
+			size_t size() const {
+				return m_buffer.empty() ? 0 : m_buffer_position - m_buffer.data();
+			}
+
+			/* Hands over everything written so far, and starts over. */
+			std::vector<unsigned char> take();
+
+			virtual void write(const unsigned char *data, size_t size);
+			virtual void reserve(size_t size);
+		private:
+			void grow(size_t extra);
+
+			std::vector<unsigned char> m_buffer;
+		};
+
+		/* The number of bytes write_nbt will write for `root_tag`. */
+		size_t encoded_size(const RootTag &root_tag);
+
+		void write_nbt(OutputStream &s, const RootTag &root_tag);
+
+		struct ByteRange {
+			size_t offset;
+			size_t size;
+		};
+
+		/* Brings `data`, an encoded document of `size` bytes, up to date
+		 * with `root_tag` by overwriting only the bytes that differ. That
+		 * takes the two having the same shape, so that nothing has to move:
+		 * the same keys in every compound, the same types, and the same
+		 * lengths for every string, list and array. The ranges overwritten
+		 * are added to `changed`, in order, for writing out just those.
+		 *
+		 * Returns false, having changed nothing, if the shapes differ; the
+		 * document then has to be written anew with write_nbt. Throws IoError
+		 * or PrematureEof if `data` is malformed. Compounds are matched by
+		 * key, so reordered children still count as the same shape, and
+		 * keep their order in `data`.
+		 */
+		bool patch_nbt(unsigned char *data, size_t size, const RootTag &root_tag, std::vector<ByteRange> &changed);
+	}
+
+	/* A compound that's only been scanned, not decoded: it knows where each
+	 * of its children is in the source buffer, and decodes one the first
+	 * time it's asked for. When written, children that were never touched
+	 * are copied out of the source byte for byte.
+	 *
+	 * The source buffer must outlive the LazyCompoundTag and anything got
+	 * from it, as decoded children borrow their strings and byte arrays
+	 * from it (see ReadOptions::borrow_buffers).
+	 */
+	class LazyCompoundTag {
+	public:
+		/* Scans the compound payload (what follows its name) at the start of
+		 * `data`. Throws IoError or PrematureEof if it's malformed.
+		 */
+		LazyCompoundTag(const unsigned char *data, size_t size);
+		LazyCompoundTag() : m_scanned_size(0) {}
+		~LazyCompoundTag();
+		LazyCompoundTag(const LazyCompoundTag &) = delete;
+		LazyCompoundTag &operator = (const LazyCompoundTag &) = delete;
+
+		// Children are kept in the order they came in.
+		size_t size() const { return m_entries.size(); }
+		const Utf8String &name_at(size_t index) const { return m_entries[index].name; }
+		io::TagTypeId type_at(size_t index) const { return m_entries[index].type; }
+		bool contains(const Utf8String &name) const { return find(name) != nullptr; }
+
+		/* Decodes the child, if that hasn't happened yet. Null if there's no
+		 * such child. A child that has been opened with lazy() is decoded
+		 * from that, by way of decode().
+		 */
+		Tag *get(const Utf8String &name);
+
+		/* Opens a compound child lazily in turn. Null if there's no such
+		 * child or it isn't a compound; throws std::logic_error if it's
+		 * already been decoded with get().
+		 */
+		LazyCompoundTag *lazy(const Utf8String &name);
+
+		// Adds or replaces a child.
+		void set(const Utf8String &name, TagPtr<Tag> &&tag);
+		bool erase(const Utf8String &name);
+
+		// Decodes everything that's left, into an ordinary tree.
+		TagPtr<CompoundTag> decode();
+
+		// Just the payload, as for a compound.
+		void write(io::OutputStream &s) const;
+
+		// How many bytes of the source the scanned payload took up.
+		size_t scanned_size() const { return m_scanned_size; }
+
+	private:
+		struct Entry {
+			Utf8String name;
+			io::TagTypeId type;
+			// The whole of the tag in the source, from its type byte, or
+			// null once it no longer matches it.
+			const unsigned char *source;
+			size_t source_size;
+			const unsigned char *payload;
+			size_t payload_size;
+			TagPtr<Tag> tag;
+			std::unique_ptr<LazyCompoundTag> lazy;
+		};
+
+		Entry *find(const Utf8String &name);
+		const Entry *find(const Utf8String &name) const;
+
+		std::vector<Entry> m_entries;
+		size_t m_scanned_size;
+	};
+
+	class LazyRootTag {
+	public:
+		Utf8String name;
+		std::unique_ptr<LazyCompoundTag> tag;
+	};
+
+	namespace io {
+		/* Scans a document held in memory, keeping its root lazy. Throws
+		 * IoError if the root isn't a compound.
+		 */
+		LazyRootTag read_lazy_nbt(const unsigned char *data, size_t size);
+
+		void write_nbt(OutputStream &s, const LazyRootTag &root_tag);
 	}
 
 	namespace utility {
+		/* Prints a tree as indented text, a tag to a line, for people to
+		 * read.
+		 */
 		void pretty_print(std::ostream &os, const RootTag &root_tag);
+
+		/* Writes a tree as SNBT, the text form that Minecraft's commands
+		 * take, on a single line: {Name:"Steve",Pos:[0.5d,64d,0.5d]}. The
+		 * root's name isn't part of it.
+		 */
+		void write_snbt(std::ostream &os, const RootTag &root_tag);
+
+		/* Writes a tree as compact JSON: compounds as objects, and lists
+		 * and arrays as arrays. Numbers are plain numbers, so most JSON
+		 * readers lose precision on longs past 2^53, and floats that
+		 * aren't finite are null.
+		 */
+		void write_json(std::ostream &os, const RootTag &root_tag);
+
+		/* One way two trees differ, at a path of compound keys and list
+		 * indices such as "Level.Sections[2].Y". The root's path is "".
+		 */
+		struct TreeDifference {
+			enum Kind {
+				// A key only the second tree has.
+				ADDED,
+				// A key only the first tree has.
+				REMOVED,
+				/* A tag whose type or value differs; for lists, also their
+				 * element type or length. Nothing within it is reported.
+				 */
+				CHANGED,
+			};
+			Kind kind;
+			std::string path;
+		};
+
+		/* How `after` differs from `before`, without recursing. Compounds,
+		 * and lists of compounds, lists, strings and arrays, are compared
+		 * child by child; numeric lists and arrays as a whole. Floats are
+		 * compared bit for bit. A compound's added and removed keys come
+		 * before any differences within its children. Root names aren't
+		 * compared.
+		 */
+		std::vector<TreeDifference> diff(const Tag &before, const Tag &after);
+		std::vector<TreeDifference> diff(const RootTag &before, const RootTag &after);
+
+		/* The name of a tag type, such as "TAG_Compound". */
+		const char *tag_type_name(io::TagTypeId type);
+
+		const size_t SECTION_BLOCK_COUNT = 4096;
+
+		/* How palette indices are packed into the longs of a chunk section's
+		 * block states. Since Minecraft 1.16, an index never straddles two
+		 * longs, and the leftover high bits of each long are padding; before
+		 * that, indices were packed back to back.
+		 */
+		enum PackedIndexLayout {
+			PACKED_INDICES_ALIGNED,
+			PACKED_INDICES_SPANNING,
+		};
+
+		/* The number of bits per block state index for a palette of the
+		 * given size: enough to index it, but never less than 4, unless the
+		 * palette has at most one entry, in which case it's 0.
+		 */
+		unsigned block_state_bits(size_t palette_size);
+
+		/* Unpacks `count` indices of `bits` bits each (at most 16) from the
+		 * `size` longs at `data`. Throws std::runtime_error if `size` isn't
+		 * the right number of longs for that.
+		 */
+		void unpack_indices(
+			const int64_t *data, size_t size, unsigned bits, PackedIndexLayout layout,
+			uint16_t *out, size_t count);
+
+		/* Unpacks a section's BlockStates into one palette index per block,
+		 * in the section's YZX order. With a single-entry palette, the
+		 * BlockStates can be empty, as 1.18+ writes them, and every index
+		 * is 0.
+		 */
+		void unpack_block_states(
+			const LongArrayTag &block_states, size_t palette_size, PackedIndexLayout layout,
+			uint16_t (&out)[SECTION_BLOCK_COUNT]);
 	}
 }
 
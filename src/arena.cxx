@@ -0,0 +1,73 @@
+#include <cstdlib>
+
+#include "nbt.h"
+
+
+namespace nbt {
+
+const size_t Arena::DEFAULT_BLOCK_SIZE;
+
+Arena::Arena(size_t block_size) :
+	m_block_size(block_size),
+	m_blocks(),
+	m_position(nullptr),
+	m_end(nullptr),
+	m_bytes_allocated(0)
+{}
+
+Arena::~Arena() {
+	for(const Block &block : m_blocks) {
+		std::free(block.data);
+	}
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+	uintptr_t position = reinterpret_cast<uintptr_t>(m_position);
+	size_t padding = (alignment - (position % alignment)) % alignment;
+	if(m_position == nullptr || static_cast<size_t>(m_end - m_position) < size + padding) {
+		// Oversized requests get a block to themselves, rather than wasting
+		// the rest of the current one.
+		size_t block_size = std::max(m_block_size, size + alignment);
+		Block block;
+		block.data = static_cast<unsigned char *>(std::malloc(block_size));
+		if(block.data == nullptr) {
+			throw std::bad_alloc();
+		}
+		block.size = block_size;
+		m_blocks.push_back(block);
+		m_position = block.data;
+		m_end = block.data + block_size;
+		position = reinterpret_cast<uintptr_t>(m_position);
+		padding = (alignment - (position % alignment)) % alignment;
+	}
+
+	void *allocation = m_position + padding;
+	m_position += padding + size;
+	m_bytes_allocated += size;
+	return allocation;
+}
+
+void Arena::reset() {
+	if(m_blocks.empty()) {
+		return;
+	}
+	std::vector<Block>::iterator largest = m_blocks.begin();
+	for(std::vector<Block>::iterator it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+		if(it->size > largest->size) {
+			largest = it;
+		}
+	}
+	Block kept = *largest;
+	for(const Block &block : m_blocks) {
+		if(block.data != kept.data) {
+			std::free(block.data);
+		}
+	}
+	m_blocks.clear();
+	m_blocks.push_back(kept);
+	m_position = kept.data;
+	m_end = kept.data + kept.size;
+	m_bytes_allocated = 0;
+}
+
+}
@@ -0,0 +1,178 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "nbt.h"
+
+#if defined(__SSE2__) && !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  #define NBT_UNPACK_SSE2
+  #include <emmintrin.h>
+#endif
+
+
+namespace nbt {
+namespace utility {
+namespace {
+
+	/* The aligned layout, with the width known at compile time so that the
+	 * inner loop has a fixed trip count and can be unrolled/vectorised.
+	 */
+	template<unsigned bits>
+	void unpack_aligned(const int64_t *data, uint16_t *out, size_t count) {
+		const unsigned per_long = 64 / bits;
+		const uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+		size_t full_longs = count / per_long;
+		for(size_t word = 0; word < full_longs; ++word) {
+			uint64_t v = static_cast<uint64_t>(data[word]);
+			for(unsigned k = 0; k < per_long; ++k) {
+				out[word * per_long + k] = static_cast<uint16_t>((v >> (k * bits)) & mask);
+			}
+		}
+		size_t idx = full_longs * per_long;
+		if(idx < count) {
+			uint64_t v = static_cast<uint64_t>(data[full_longs]);
+			for(; idx < count; ++idx) {
+				out[idx] = static_cast<uint16_t>(v & mask);
+				v >>= bits;
+			}
+		}
+	}
+
+	void unpack_spanning(const int64_t *data, unsigned bits, uint16_t *out, size_t count) {
+		const uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+		for(size_t idx = 0; idx < count; ++idx) {
+			size_t bit = idx * bits;
+			size_t word = bit / 64;
+			unsigned offset = bit % 64;
+			uint64_t v = static_cast<uint64_t>(data[word]) >> offset;
+			if(offset + bits > 64) {
+				v |= static_cast<uint64_t>(data[word + 1]) << (64 - offset);
+			}
+			out[idx] = static_cast<uint16_t>(v & mask);
+		}
+	}
+
+#ifdef NBT_UNPACK_SSE2
+	/* On a little-endian host, 4 bit indices are just the nibbles of the
+	 * array's bytes, low nibble first, and 8 bit ones are the bytes.
+	 */
+	size_t unpack_nibbles_sse2(const int64_t *data, uint16_t *out, size_t count) {
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+		const __m128i low_nibbles = _mm_set1_epi8(0x0f);
+		const __m128i zero = _mm_setzero_si128();
+		size_t idx = 0;
+		for(; idx + 32 <= count; idx += 32) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + idx / 2));
+			__m128i lo = _mm_and_si128(v, low_nibbles);
+			__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low_nibbles);
+			__m128i first = _mm_unpacklo_epi8(lo, hi);
+			__m128i second = _mm_unpackhi_epi8(lo, hi);
+			__m128i *dest = reinterpret_cast<__m128i *>(out + idx);
+			_mm_storeu_si128(dest, _mm_unpacklo_epi8(first, zero));
+			_mm_storeu_si128(dest + 1, _mm_unpackhi_epi8(first, zero));
+			_mm_storeu_si128(dest + 2, _mm_unpacklo_epi8(second, zero));
+			_mm_storeu_si128(dest + 3, _mm_unpackhi_epi8(second, zero));
+		}
+		return idx;
+	}
+
+	size_t unpack_bytes_sse2(const int64_t *data, uint16_t *out, size_t count) {
+		const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+		const __m128i zero = _mm_setzero_si128();
+		size_t idx = 0;
+		for(; idx + 16 <= count; idx += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + idx));
+			__m128i *dest = reinterpret_cast<__m128i *>(out + idx);
+			_mm_storeu_si128(dest, _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128(dest + 1, _mm_unpackhi_epi8(v, zero));
+		}
+		return idx;
+	}
+#endif
+
+	typedef void (*UnpackFunction)(const int64_t *, uint16_t *, size_t);
+
+	const UnpackFunction UNPACK_ALIGNED[] = {
+		nullptr,
+		unpack_aligned<1>, unpack_aligned<2>, unpack_aligned<3>, unpack_aligned<4>,
+		unpack_aligned<5>, unpack_aligned<6>, unpack_aligned<7>, unpack_aligned<8>,
+		unpack_aligned<9>, unpack_aligned<10>, unpack_aligned<11>, unpack_aligned<12>,
+		unpack_aligned<13>, unpack_aligned<14>, unpack_aligned<15>, unpack_aligned<16>,
+	};
+
+	size_t expected_size(unsigned bits, PackedIndexLayout layout, size_t count) {
+		if(layout == PACKED_INDICES_ALIGNED) {
+			size_t per_long = 64 / bits;
+			return (count + per_long - 1) / per_long;
+		} else {
+			return (count * bits + 63) / 64;
+		}
+	}
+}
+
+unsigned block_state_bits(size_t palette_size) {
+	if(palette_size <= 1) {
+		return 0;
+	}
+	unsigned bits = 0;
+	while(bits < 64 && (static_cast<uint64_t>(1) << bits) < palette_size) {
+		++bits;
+	}
+	return bits < 4 ? 4 : bits;
+}
+
+void unpack_indices(
+	const int64_t *data, size_t size, unsigned bits, PackedIndexLayout layout,
+	uint16_t *out, size_t count)
+{
+	if(bits > 16) {
+		throw std::runtime_error("Packed indices wider than 16 bits aren't supported.");
+	}
+	if(bits == 0) {
+		// A single-entry palette doesn't need any data.
+		std::fill(out, out + count, 0);
+		return;
+	}
+	if(size != expected_size(bits, layout, count)) {
+		throw std::runtime_error("Packed index array has the wrong length.");
+	}
+
+	// When the width divides 64, both layouts are the same.
+	if(64 % bits == 0) {
+		layout = PACKED_INDICES_ALIGNED;
+	}
+	if(layout == PACKED_INDICES_SPANNING) {
+		unpack_spanning(data, bits, out, count);
+		return;
+	}
+
+	size_t done = 0;
+#ifdef NBT_UNPACK_SSE2
+	if(bits == 4) {
+		done = unpack_nibbles_sse2(data, out, count);
+	} else if(bits == 8) {
+		done = unpack_bytes_sse2(data, out, count);
+	}
+#endif
+	size_t per_long = 64 / bits;
+	// The vector paths always stop on a long boundary.
+	UNPACK_ALIGNED[bits](data + done / per_long, out + done, count - done);
+}
+
+void unpack_block_states(
+	const LongArrayTag &block_states, size_t palette_size, PackedIndexLayout layout,
+	uint16_t (&out)[SECTION_BLOCK_COUNT])
+{
+	unsigned bits = block_state_bits(palette_size);
+	/* Since 1.18 a section with a single-entry palette (all air, say) has
+	 * no data at all; before that, its indices were still packed at 4 bits.
+	 */
+	if(bits == 0 && !block_states.values.empty()) {
+		bits = 4;
+	}
+	unpack_indices(
+		block_states.values.data(), block_states.values.size(), bits, layout,
+		out, SECTION_BLOCK_COUNT);
+}
+
+}
+}
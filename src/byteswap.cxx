@@ -0,0 +1,169 @@
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "byteswap.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define NBT_BYTESWAP_X86
+  #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #define NBT_BYTESWAP_NEON
+  #include <arm_neon.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  #define NBT_BIG_ENDIAN_HOST
+#endif
+
+
+namespace nbt {
+namespace detail {
+namespace {
+
+	inline uint16_t swap16(uint16_t v) {
+		return static_cast<uint16_t>((v >> 8) | (v << 8));
+	}
+
+	inline uint32_t swap32(uint32_t v) {
+	#ifdef __GNUC__
+		return __builtin_bswap32(v);
+	#else
+		return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+	#endif
+	}
+
+	inline uint64_t swap64(uint64_t v) {
+	#ifdef __GNUC__
+		return __builtin_bswap64(v);
+	#else
+		return (static_cast<uint64_t>(swap32(static_cast<uint32_t>(v))) << 32) | swap32(static_cast<uint32_t>(v >> 32));
+	#endif
+	}
+
+	template<typename T, T (*swap)(T)>
+	void swap_scalar(unsigned char *data, size_t count) {
+		for(size_t idx = 0; idx < count; ++idx) {
+			T v;
+			std::memcpy(&v, data + idx * sizeof(T), sizeof(T));
+			v = swap(v);
+			std::memcpy(data + idx * sizeof(T), &v, sizeof(T));
+		}
+	}
+
+	void byteswap_scalar(unsigned char *data, size_t count, size_t width) {
+		switch(width) {
+			case 2:
+				swap_scalar<uint16_t, swap16>(data, count);
+				break;
+			case 4:
+				swap_scalar<uint32_t, swap32>(data, count);
+				break;
+			case 8:
+				swap_scalar<uint64_t, swap64>(data, count);
+				break;
+		}
+	}
+
+#ifdef NBT_BYTESWAP_X86
+	/* pshufb masks that reverse each 2, 4 or 8 byte group of a 16 byte lane. */
+	const unsigned char SHUFFLE_MASKS[3][16] = {
+		{1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+		{3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+		{7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8},
+	};
+
+	const unsigned char *shuffle_mask_for(size_t width) {
+		return SHUFFLE_MASKS[width == 2 ? 0 : (width == 4 ? 1 : 2)];
+	}
+
+	__attribute__((target("ssse3")))
+	void byteswap_ssse3(unsigned char *data, size_t count, size_t width) {
+		const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle_mask_for(width)));
+		size_t size = count * width;
+		size_t idx = 0;
+		for(; idx + 16 <= size; idx += 16) {
+			__m128i *p = reinterpret_cast<__m128i *>(data + idx);
+			_mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+		}
+		byteswap_scalar(data + idx, (size - idx) / width, width);
+	}
+
+	__attribute__((target("avx2")))
+	void byteswap_avx2(unsigned char *data, size_t count, size_t width) {
+		// vpshufb shuffles within each 128-bit lane, so the same 16 byte mask
+		// goes in both halves.
+		const __m128i half_mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(shuffle_mask_for(width)));
+		const __m256i mask = _mm256_broadcastsi128_si256(half_mask);
+		size_t size = count * width;
+		size_t idx = 0;
+		for(; idx + 32 <= size; idx += 32) {
+			__m256i *p = reinterpret_cast<__m256i *>(data + idx);
+			_mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), mask));
+		}
+		byteswap_scalar(data + idx, (size - idx) / width, width);
+	}
+
+	typedef void (*ByteswapFunction)(unsigned char *, size_t, size_t);
+
+	ByteswapFunction select_byteswap() {
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			return byteswap_avx2;
+		}
+		if(__builtin_cpu_supports("ssse3")) {
+			return byteswap_ssse3;
+		}
+		return byteswap_scalar;
+	}
+#endif
+
+#ifdef NBT_BYTESWAP_NEON
+	void byteswap_neon(unsigned char *data, size_t count, size_t width) {
+		size_t size = count * width;
+		size_t idx = 0;
+		for(; idx + 16 <= size; idx += 16) {
+			uint8x16_t v = vld1q_u8(data + idx);
+			switch(width) {
+				case 2:
+					v = vrev16q_u8(v);
+					break;
+				case 4:
+					v = vrev32q_u8(v);
+					break;
+				case 8:
+					v = vrev64q_u8(v);
+					break;
+			}
+			vst1q_u8(data + idx, v);
+		}
+		byteswap_scalar(data + idx, (size - idx) / width, width);
+	}
+#endif
+
+}
+
+#ifdef NBT_BIG_ENDIAN_HOST
+void byteswap_big_endian(unsigned char *, size_t, size_t) {
+}
+#else
+void byteswap_big_endian(unsigned char *data, size_t count, size_t width) {
+	if(width != 1 && width != 2 && width != 4 && width != 8) {
+		throw std::logic_error("byteswap_big_endian called with an unsupported width.");
+	}
+	if(width == 1 || count == 0) {
+		return;
+	}
+#if defined(NBT_BYTESWAP_X86)
+	static const ByteswapFunction byteswap = select_byteswap();
+	byteswap(data, count, width);
+#elif defined(NBT_BYTESWAP_NEON)
+	byteswap_neon(data, count, width);
+#else
+	byteswap_scalar(data, count, width);
+#endif
+}
+#endif
+
+}
+}
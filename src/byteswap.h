@@ -0,0 +1,23 @@
+#ifndef NBT_BYTESWAP_H
+#define NBT_BYTESWAP_H
+
+#include <cstddef>
+
+
+namespace nbt {
+namespace detail {
+
+	/* Converts `count` values of `width` bytes each (1, 2, 4 or 8) between
+	 * big-endian and host order, in place. Since that's just a byte swap (or
+	 * nothing, on big-endian hosts), it works both ways.
+	 *
+	 * This is the bulk path for arrays and packed lists: SSSE3/AVX2 on x86
+	 * (picked at runtime) and NEON on ARM, with a scalar loop for everything
+	 * else and for the tail.
+	 */
+	void byteswap_big_endian(unsigned char *data, size_t count, size_t width);
+
+}
+}
+
+#endif
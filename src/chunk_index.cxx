@@ -0,0 +1,740 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nbt.h"
+#include "path.h"
+
+
+namespace nbt {
+namespace io {
+
+namespace {
+	/* An index file is laid out as:
+	 *
+	 *   the header: "NBTINDEX", then the version, the numbers of chunks,
+	 *     fields, keys and terms (distinct pairs of a key and a string found
+	 *     there), and the size of the string pool, as uint32s;
+	 *   the names of the fields, then of the keys, as (offset, size) pairs
+	 *     of uint32s into the string pool;
+	 *   the chunks, sorted: x, z and timestamp as uint32s, and padding;
+	 *   each field's values in turn, an int64 per chunk;
+	 *   the terms, sorted by key then string: the key, the string's offset
+	 *     and size, and padding, as uint32s;
+	 *   a bitmap of chunks, in uint64 words, for each field (the chunks
+	 *     that have it), then for each key, then for each term;
+	 *   the string pool.
+	 *
+	 * Everything is little-endian, and each section starts 8-byte aligned.
+	 */
+	const char MAGIC[8] = {'N', 'B', 'T', 'I', 'N', 'D', 'E', 'X'};
+	const uint32_t VERSION = 1;
+	const size_t HEADER_SIZE = 32;
+	const size_t NAME_SIZE = 8;
+	const size_t CHUNK_SIZE = 16;
+	const size_t TERM_SIZE = 16;
+
+	template<typename T>
+	T load_little_endian(const unsigned char *data) {
+		typedef typename std::make_unsigned<T>::type Unsigned;
+		Unsigned value = 0;
+		for(size_t i = 0; i < sizeof(T); ++i) {
+			value |= static_cast<Unsigned>(data[i]) << (8 * i);
+		}
+		return static_cast<T>(value);
+	}
+
+	template<typename T>
+	void append_little_endian(std::vector<unsigned char> &out, T value) {
+		typedef typename std::make_unsigned<T>::type Unsigned;
+		Unsigned bits = static_cast<Unsigned>(value);
+		for(size_t i = 0; i < sizeof(T); ++i) {
+			out.push_back(static_cast<unsigned char>(bits >> (8 * i)));
+		}
+	}
+
+	size_t bitmap_size(size_t chunk_count) {
+		return (chunk_count + 63) / 64 * 8;
+	}
+
+	bool test_bit(const unsigned char *bitmap, size_t bit) {
+		return (bitmap[bit / 8] >> (bit % 8)) & 1;
+	}
+
+	IoError system_error(const std::string &what, const std::string &path) {
+		return IoError(what + " " + path + ": " + std::strerror(errno));
+	}
+
+	// Closes a file descriptor on the way out, however that is.
+	class FileDescriptor {
+	public:
+		explicit FileDescriptor(int fd) : m_fd(fd) {}
+		~FileDescriptor() {
+			if(m_fd >= 0) {
+				close(m_fd);
+			}
+		}
+		int get() const { return m_fd; }
+		int release() {
+			int fd = m_fd;
+			m_fd = -1;
+			return fd;
+		}
+	private:
+		int m_fd;
+	};
+
+	struct RegionCoordinates {
+		int32_t x;
+		int32_t z;
+	};
+
+	RegionCoordinates region_coordinates(const std::string &path) {
+		size_t slash = path.find_last_of('/');
+		std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+		int x, z;
+		int end = -1;
+		// Past this, the chunks' coordinates wouldn't fit in an int32.
+		const int limit = 1 << 26;
+		if(std::sscanf(name.c_str(), "r.%d.%d.mca%n", &x, &z, &end) != 2 ||
+			end != static_cast<int>(name.size()) || x >= limit || x < -limit || z >= limit || z < -limit)
+		{
+			throw std::invalid_argument("Region file name doesn't give its coordinates: " + path);
+		}
+		RegionCoordinates coordinates = {x, z};
+		return coordinates;
+	}
+
+	bool integer_value(const Tag &tag, int64_t &out) {
+		switch(tag.type()) {
+			case TAG_TYPE_BYTE:
+				out = static_cast<const ByteTag &>(tag).value;
+				return true;
+			case TAG_TYPE_SHORT:
+				out = static_cast<const ShortTag &>(tag).value;
+				return true;
+			case TAG_TYPE_INT:
+				out = static_cast<const IntTag &>(tag).value;
+				return true;
+			case TAG_TYPE_LONG:
+				out = static_cast<const LongTag &>(tag).value;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	std::string to_string(const Utf8String &string) {
+		return std::string(reinterpret_cast<const char *>(string.data.data()), string.data.size());
+	}
+
+	typedef std::pair<uint32_t, std::string> Term;
+
+	struct Entry {
+		int32_t x;
+		int32_t z;
+		uint32_t timestamp;
+		// Where the chunk is in the previous index if it's taken from there.
+		size_t previous;
+		std::vector<int64_t> values;
+		std::vector<unsigned char> has_value;
+		std::vector<unsigned char> has_key;
+		std::vector<Term> terms;
+	};
+
+	struct Region {
+		RegionCoordinates coordinates;
+		/* Filled in by the filter, for the chunks it lets through. Each
+		 * chunk's is only touched by the thread that reads it.
+		 */
+		std::vector<uint32_t> timestamps;
+	};
+
+	class Indexer {
+	public:
+		Indexer(const std::vector<std::string> &region_paths, const ChunkIndexOptions &options,
+			const ChunkIndex *previous) :
+			m_options(options), m_previous(previous)
+		{
+			for(const std::string &path : region_paths) {
+				Region &region = m_regions[path];
+				region.coordinates = region_coordinates(path);
+				region.timestamps.resize(RegionFile::CHUNK_COUNT);
+			}
+			for(const std::string &field : options.fields) {
+				m_field_paths.push_back(detail::split_path(field));
+				m_projection.add(field);
+			}
+			for(const std::string &key : options.keys) {
+				m_key_paths.push_back(detail::split_path(key));
+				m_projection.add(key);
+			}
+		}
+
+		size_t run() {
+			// Each region once, however many times it was passed.
+			std::vector<std::string> region_paths;
+			for(const auto &region : m_regions) {
+				region_paths.push_back(region.first);
+			}
+			LoadOptions load = m_options.load;
+			load.projection = &m_projection;
+			load.filter = [this](const std::string &path, size_t index, const RegionFile &region) {
+				return filter(path, index, region);
+			};
+			load_regions(region_paths, [this](const std::string &path, size_t index, RootTag &chunk) {
+				add(path, index, chunk);
+			}, load);
+
+			size_t read = 0;
+			for(const Entry &entry : m_entries) {
+				if(entry.previous == ChunkIndex::NOT_FOUND) {
+					++read;
+				}
+			}
+			return read;
+		}
+
+		/* Sorts the chunks, dropping any that turn up twice, and fills in
+		 * those taken from the previous index.
+		 */
+		void finish() {
+			std::sort(m_entries.begin(), m_entries.end(), [](const Entry &a, const Entry &b) {
+				return a.x < b.x || (a.x == b.x && a.z < b.z);
+			});
+			m_entries.erase(std::unique(m_entries.begin(), m_entries.end(), [](const Entry &a, const Entry &b) {
+				return a.x == b.x && a.z == b.z;
+			}), m_entries.end());
+
+			std::vector<std::vector<Term>> previous_terms;
+			for(Entry &entry : m_entries) {
+				if(entry.previous == ChunkIndex::NOT_FOUND) {
+					continue;
+				}
+				if(previous_terms.empty()) {
+					previous_terms = terms_by_chunk(*m_previous);
+				}
+				for(size_t i = 0; i < m_options.fields.size(); ++i) {
+					entry.has_value[i] = m_previous->value(i, entry.previous, entry.values[i]);
+				}
+				for(size_t i = 0; i < m_options.keys.size(); ++i) {
+					entry.has_key[i] = m_previous->has_key(i, entry.previous);
+				}
+				entry.terms = std::move(previous_terms[entry.previous]);
+			}
+		}
+
+		std::vector<unsigned char> encode() const {
+			size_t field_count = m_options.fields.size();
+			size_t key_count = m_options.keys.size();
+			size_t chunk_count = m_entries.size();
+			size_t words = bitmap_size(chunk_count) / 8;
+
+			std::map<Term, std::vector<uint64_t>> terms;
+			for(size_t i = 0; i < chunk_count; ++i) {
+				for(const Term &term : m_entries[i].terms) {
+					std::vector<uint64_t> &bitmap = terms[term];
+					bitmap.resize(words);
+					bitmap[i / 64] |= static_cast<uint64_t>(1) << (i % 64);
+				}
+			}
+
+			std::string strings;
+			std::vector<unsigned char> out(MAGIC, MAGIC + sizeof(MAGIC));
+			append_little_endian<uint32_t>(out, VERSION);
+			append_little_endian<uint32_t>(out, checked_count(chunk_count));
+			append_little_endian<uint32_t>(out, checked_count(field_count));
+			append_little_endian<uint32_t>(out, checked_count(key_count));
+			append_little_endian<uint32_t>(out, checked_count(terms.size()));
+			size_t strings_size_offset = out.size();
+			append_little_endian<uint32_t>(out, 0);
+
+			for(const std::string &name : m_options.fields) {
+				append_string(out, strings, name);
+			}
+			for(const std::string &name : m_options.keys) {
+				append_string(out, strings, name);
+			}
+			for(const Entry &entry : m_entries) {
+				append_little_endian(out, entry.x);
+				append_little_endian(out, entry.z);
+				append_little_endian(out, entry.timestamp);
+				append_little_endian<uint32_t>(out, 0);
+			}
+			for(size_t field = 0; field < field_count; ++field) {
+				for(const Entry &entry : m_entries) {
+					append_little_endian<int64_t>(out, entry.has_value[field] ? entry.values[field] : 0);
+				}
+			}
+			for(const auto &term : terms) {
+				append_little_endian(out, term.first.first);
+				append_string(out, strings, term.first.second);
+				append_little_endian<uint32_t>(out, 0);
+			}
+
+			std::vector<uint64_t> bitmap(words);
+			for(size_t field = 0; field < field_count; ++field) {
+				std::fill(bitmap.begin(), bitmap.end(), 0);
+				for(size_t i = 0; i < chunk_count; ++i) {
+					bitmap[i / 64] |= static_cast<uint64_t>(m_entries[i].has_value[field] ? 1 : 0) << (i % 64);
+				}
+				append_bitmap(out, bitmap);
+			}
+			for(size_t key = 0; key < key_count; ++key) {
+				std::fill(bitmap.begin(), bitmap.end(), 0);
+				for(size_t i = 0; i < chunk_count; ++i) {
+					bitmap[i / 64] |= static_cast<uint64_t>(m_entries[i].has_key[key] ? 1 : 0) << (i % 64);
+				}
+				append_bitmap(out, bitmap);
+			}
+			for(const auto &term : terms) {
+				append_bitmap(out, term.second);
+			}
+
+			uint32_t strings_size = checked_count(strings.size());
+			for(size_t i = 0; i < 4; ++i) {
+				out[strings_size_offset + i] = static_cast<unsigned char>(strings_size >> (8 * i));
+			}
+			out.insert(out.end(), strings.begin(), strings.end());
+			return out;
+		}
+
+	private:
+		bool filter(const std::string &path, size_t index, const RegionFile &region) {
+			uint32_t timestamp = region.timestamp(index);
+			if(!m_previous || timestamp == 0 || !reuse(path, index, timestamp)) {
+				m_regions.find(path)->second.timestamps[index] = timestamp;
+				return true;
+			}
+			return false;
+		}
+
+		bool reuse(const std::string &path, size_t index, uint32_t timestamp) {
+			Entry entry = new_entry(path, index, timestamp);
+			size_t previous = m_previous->find_chunk(entry.x, entry.z);
+			if(previous == ChunkIndex::NOT_FOUND || m_previous->chunk(previous).timestamp != timestamp) {
+				return false;
+			}
+			entry.previous = previous;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_entries.push_back(std::move(entry));
+			return true;
+		}
+
+		void add(const std::string &path, size_t index, RootTag &chunk) {
+			Entry entry = new_entry(path, index, m_regions.find(path)->second.timestamps[index]);
+			if(chunk.tag) {
+				detail::PendingTags pending;
+				for(size_t i = 0; i < m_field_paths.size(); ++i) {
+					// The first integer found is the value.
+					detail::find_path(*chunk.tag, m_field_paths[i], false, pending, [&](const Tag &tag) -> bool {
+						entry.has_value[i] = integer_value(tag, entry.values[i]);
+						return entry.has_value[i];
+					});
+				}
+				for(size_t i = 0; i < m_key_paths.size(); ++i) {
+					uint32_t key = static_cast<uint32_t>(i);
+					detail::find_path(*chunk.tag, m_key_paths[i], false, pending, [&](const Tag &tag) -> bool {
+						entry.has_key[key] = true;
+						if(tag.type() == TAG_TYPE_STRING) {
+							entry.terms.push_back(Term(key, to_string(static_cast<const StringTag &>(tag).value)));
+						} else if(tag.type() == TAG_TYPE_LIST &&
+							static_cast<const ListTagBase &>(tag).element_type() == TAG_TYPE_STRING)
+						{
+							for(const auto &element : static_cast<const ListTag<StringTag> &>(tag).values) {
+								if(element) {
+									entry.terms.push_back(Term(key, to_string(element->value)));
+								}
+							}
+						}
+						return false;
+					});
+				}
+			}
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_entries.push_back(std::move(entry));
+		}
+
+		Entry new_entry(const std::string &path, size_t index, uint32_t timestamp) const {
+			RegionCoordinates region = m_regions.find(path)->second.coordinates;
+			Entry entry;
+			entry.x = region.x * static_cast<int32_t>(RegionFile::CHUNKS_PER_SIDE) +
+				static_cast<int32_t>(index % RegionFile::CHUNKS_PER_SIDE);
+			entry.z = region.z * static_cast<int32_t>(RegionFile::CHUNKS_PER_SIDE) +
+				static_cast<int32_t>(index / RegionFile::CHUNKS_PER_SIDE);
+			entry.timestamp = timestamp;
+			entry.previous = ChunkIndex::NOT_FOUND;
+			entry.values.resize(m_options.fields.size());
+			entry.has_value.resize(m_options.fields.size());
+			entry.has_key.resize(m_options.keys.size());
+			return entry;
+		}
+
+		static std::vector<std::vector<Term>> terms_by_chunk(const ChunkIndex &index) {
+			std::vector<std::vector<Term>> terms(index.chunk_count());
+			for(size_t key = 0; key < index.keys().size(); ++key) {
+				for(const std::string &value : index.values(index.keys()[key])) {
+					for(size_t chunk : index.chunks_with(index.keys()[key], value)) {
+						terms[chunk].push_back(Term(static_cast<uint32_t>(key), value));
+					}
+				}
+			}
+			return terms;
+		}
+
+		static uint32_t checked_count(size_t count) {
+			if(count > UINT32_MAX) {
+				throw IoError("Chunk index is too big.");
+			}
+			return static_cast<uint32_t>(count);
+		}
+
+		static void append_string(std::vector<unsigned char> &out, std::string &strings, const std::string &value) {
+			append_little_endian(out, checked_count(strings.size()));
+			append_little_endian(out, checked_count(value.size()));
+			strings += value;
+		}
+
+		static void append_bitmap(std::vector<unsigned char> &out, const std::vector<uint64_t> &bitmap) {
+			for(uint64_t word : bitmap) {
+				append_little_endian(out, word);
+			}
+		}
+
+		const ChunkIndexOptions &m_options;
+		const ChunkIndex *m_previous;
+		std::map<std::string, Region> m_regions;
+		std::vector<detail::TagPath> m_field_paths;
+		std::vector<detail::TagPath> m_key_paths;
+		Projection m_projection;
+		std::mutex m_mutex;
+		std::vector<Entry> m_entries;
+	};
+
+	/* The index that's at `path` already, if there's one made the same way
+	 * as this one would be.
+	 */
+	std::unique_ptr<ChunkIndex> previous_index(const std::string &path, const ChunkIndexOptions &options) {
+		std::unique_ptr<ChunkIndex> previous;
+		try {
+			previous.reset(new ChunkIndex(path));
+		} catch(const IoError &) {
+			// Missing or unreadable, it's just rebuilt.
+			return nullptr;
+		}
+		if(previous->fields() != options.fields || previous->keys() != options.keys) {
+			return nullptr;
+		}
+		return previous;
+	}
+}
+
+const size_t ChunkIndex::NOT_FOUND;
+
+size_t update_chunk_index(const std::string &index_path, const std::vector<std::string> &region_paths,
+	const ChunkIndexOptions &options)
+{
+	std::unique_ptr<ChunkIndex> previous = previous_index(index_path, options);
+	Indexer indexer(region_paths, options, previous.get());
+	size_t read = indexer.run();
+	indexer.finish();
+	std::vector<unsigned char> encoded = indexer.encode();
+
+	// A name of its own, so that updates running at once don't share one.
+	std::vector<char> temporary_name(index_path.begin(), index_path.end());
+	const char suffix[] = ".XXXXXX";
+	temporary_name.insert(temporary_name.end(), suffix, suffix + sizeof(suffix));
+	int temporary_fd = mkstemp(temporary_name.data());
+	if(temporary_fd < 0) {
+		throw system_error("Couldn't create a temporary file for chunk index", index_path);
+	}
+	std::string temporary_path(temporary_name.data());
+	{
+		FileDescriptor fd(temporary_fd);
+		// mkstemp() leaves it readable only by its owner.
+		bool written = fchmod(fd.get(), 0644) == 0;
+		const unsigned char *data = encoded.data();
+		size_t left = encoded.size();
+		while(written && left > 0) {
+			ssize_t count = write(fd.get(), data, left);
+			if(count < 0 && errno == EINTR) {
+				continue;
+			}
+			written = count > 0;
+			if(written) {
+				data += count;
+				left -= count;
+			}
+		}
+		if(!written || close(fd.release()) != 0) {
+			IoError error = system_error("Couldn't write chunk index", temporary_path);
+			std::remove(temporary_path.c_str());
+			throw error;
+		}
+	}
+	if(std::rename(temporary_path.c_str(), index_path.c_str()) != 0) {
+		IoError error = system_error("Couldn't replace chunk index", index_path);
+		std::remove(temporary_path.c_str());
+		throw error;
+	}
+	return read;
+}
+
+ChunkIndex::ChunkIndex(const std::string &path) : m_data(nullptr), m_size(0) {
+	FileDescriptor fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	if(fd.get() < 0) {
+		throw system_error("Couldn't open chunk index", path);
+	}
+	struct stat st;
+	if(fstat(fd.get(), &st) != 0) {
+		throw system_error("Couldn't stat chunk index", path);
+	}
+	if(static_cast<size_t>(st.st_size) < HEADER_SIZE) {
+		throw IoError("Chunk index " + path + " is too short to hold its header.");
+	}
+	void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd.get(), 0);
+	if(mapped == MAP_FAILED) {
+		throw system_error("Couldn't map chunk index", path);
+	}
+	m_data = static_cast<const unsigned char *>(mapped);
+	m_size = st.st_size;
+
+	try {
+		if(std::memcmp(m_data, MAGIC, sizeof(MAGIC)) != 0 || load_little_endian<uint32_t>(m_data + 8) != VERSION) {
+			throw IoError("Chunk index " + path + " isn't a chunk index this can read.");
+		}
+		m_chunk_count = load_little_endian<uint32_t>(m_data + 12);
+		uint64_t field_count = load_little_endian<uint32_t>(m_data + 16);
+		uint64_t key_count = load_little_endian<uint32_t>(m_data + 20);
+		m_term_count = load_little_endian<uint32_t>(m_data + 24);
+		m_strings_size = load_little_endian<uint32_t>(m_data + 28);
+		m_bitmap_size = bitmap_size(m_chunk_count);
+
+		/* The sections follow one another; the counts come from the file,
+		 * so each section is checked to fit before the next, as multiplied
+		 * out they could overflow even 64 bits.
+		 */
+		uint64_t offset = HEADER_SIZE;
+		auto section = [&](uint64_t count, uint64_t item_size) -> uint64_t {
+			if(item_size != 0 && count > (m_size - offset) / item_size) {
+				throw IoError("Chunk index " + path + " is the wrong size for its header.");
+			}
+			uint64_t start = offset;
+			offset += count * item_size;
+			return start;
+		};
+		uint64_t names_offset = section(field_count + key_count, NAME_SIZE);
+		uint64_t chunks_offset = section(m_chunk_count, CHUNK_SIZE);
+		uint64_t values_offset = section(field_count * m_chunk_count, 8);
+		uint64_t terms_offset = section(m_term_count, TERM_SIZE);
+		uint64_t bitmaps_offset = section(field_count + key_count + m_term_count, m_bitmap_size);
+		uint64_t strings_offset = section(m_strings_size, 1);
+		if(offset != m_size) {
+			throw IoError("Chunk index " + path + " is the wrong size for its header.");
+		}
+		m_chunks = m_data + chunks_offset;
+		m_values = m_data + values_offset;
+		m_terms = m_data + terms_offset;
+		m_bitmaps = m_data + bitmaps_offset;
+		m_strings = m_data + strings_offset;
+
+		for(size_t i = 0; i < field_count + key_count; ++i) {
+			const unsigned char *name = m_data + names_offset + i * NAME_SIZE;
+			uint64_t offset = load_little_endian<uint32_t>(name);
+			uint64_t size = load_little_endian<uint32_t>(name + 4);
+			if(offset + size > m_strings_size) {
+				throw IoError("Chunk index " + path + " has a name outside its strings.");
+			}
+			std::string string(reinterpret_cast<const char *>(m_strings + offset), size);
+			(i < field_count ? m_fields : m_keys).push_back(std::move(string));
+		}
+	} catch(...) {
+		munmap(const_cast<unsigned char *>(m_data), m_size);
+		throw;
+	}
+}
+
+ChunkIndex::~ChunkIndex() {
+	munmap(const_cast<unsigned char *>(m_data), m_size);
+}
+
+size_t ChunkIndex::field(const std::string &path) const {
+	auto found = std::find(m_fields.begin(), m_fields.end(), path);
+	return found == m_fields.end() ? NOT_FOUND : found - m_fields.begin();
+}
+
+size_t ChunkIndex::key(const std::string &path) const {
+	auto found = std::find(m_keys.begin(), m_keys.end(), path);
+	return found == m_keys.end() ? NOT_FOUND : found - m_keys.begin();
+}
+
+ChunkIndex::Chunk ChunkIndex::chunk(size_t index) const {
+	if(index >= m_chunk_count) {
+		throw std::out_of_range("Chunk index out of range.");
+	}
+	const unsigned char *data = m_chunks + index * CHUNK_SIZE;
+	Chunk chunk = {load_little_endian<int32_t>(data), load_little_endian<int32_t>(data + 4),
+		load_little_endian<uint32_t>(data + 8)};
+	return chunk;
+}
+
+size_t ChunkIndex::find_chunk(int32_t x, int32_t z) const {
+	size_t low = 0;
+	size_t high = m_chunk_count;
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		const unsigned char *data = m_chunks + middle * CHUNK_SIZE;
+		int32_t middle_x = load_little_endian<int32_t>(data);
+		int32_t middle_z = load_little_endian<int32_t>(data + 4);
+		if(middle_x < x || (middle_x == x && middle_z < z)) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if(low < m_chunk_count) {
+		const unsigned char *data = m_chunks + low * CHUNK_SIZE;
+		if(load_little_endian<int32_t>(data) == x && load_little_endian<int32_t>(data + 4) == z) {
+			return low;
+		}
+	}
+	return NOT_FOUND;
+}
+
+bool ChunkIndex::value(size_t field, size_t chunk, int64_t &out) const {
+	if(field >= m_fields.size() || chunk >= m_chunk_count) {
+		throw std::out_of_range("Chunk index field or chunk out of range.");
+	}
+	if(!test_bit(m_bitmaps + field * m_bitmap_size, chunk)) {
+		return false;
+	}
+	out = load_little_endian<int64_t>(m_values + (field * m_chunk_count + chunk) * 8);
+	return true;
+}
+
+bool ChunkIndex::has_key(size_t key, size_t chunk) const {
+	if(key >= m_keys.size() || chunk >= m_chunk_count) {
+		throw std::out_of_range("Chunk index key or chunk out of range.");
+	}
+	return test_bit(m_bitmaps + (m_fields.size() + key) * m_bitmap_size, chunk);
+}
+
+std::vector<size_t> ChunkIndex::chunks_where(const std::string &field, int64_t min, int64_t max) const {
+	size_t index = this->field(field);
+	if(index == NOT_FOUND) {
+		throw std::invalid_argument("Chunk index has no field " + field + ".");
+	}
+	std::vector<size_t> chunks;
+	const unsigned char *present = m_bitmaps + index * m_bitmap_size;
+	const unsigned char *values = m_values + index * m_chunk_count * 8;
+	for(size_t i = 0; i < m_chunk_count; ++i) {
+		int64_t value = load_little_endian<int64_t>(values + i * 8);
+		if(value >= min && value <= max && test_bit(present, i)) {
+			chunks.push_back(i);
+		}
+	}
+	return chunks;
+}
+
+std::vector<size_t> ChunkIndex::chunks_with(const std::string &key) const {
+	size_t index = this->key(key);
+	if(index == NOT_FOUND) {
+		throw std::invalid_argument("Chunk index has no key " + key + ".");
+	}
+	return set_bits(m_bitmaps + (m_fields.size() + index) * m_bitmap_size);
+}
+
+std::vector<size_t> ChunkIndex::chunks_with(const std::string &key, const std::string &value) const {
+	size_t index = this->key(key);
+	if(index == NOT_FOUND) {
+		throw std::invalid_argument("Chunk index has no key " + key + ".");
+	}
+	std::pair<size_t, size_t> range = key_terms(index);
+	size_t low = range.first;
+	size_t high = range.second;
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(term_value(middle) < value) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if(low == range.second || term_value(low) != value) {
+		return std::vector<size_t>();
+	}
+	return set_bits(m_bitmaps + (m_fields.size() + m_keys.size() + low) * m_bitmap_size);
+}
+
+std::vector<std::string> ChunkIndex::values(const std::string &key) const {
+	size_t index = this->key(key);
+	if(index == NOT_FOUND) {
+		throw std::invalid_argument("Chunk index has no key " + key + ".");
+	}
+	std::pair<size_t, size_t> range = key_terms(index);
+	std::vector<std::string> values;
+	for(size_t term = range.first; term < range.second; ++term) {
+		values.push_back(term_value(term));
+	}
+	return values;
+}
+
+std::pair<size_t, size_t> ChunkIndex::key_terms(size_t key) const {
+	// The terms are sorted by key first, so a key's are all together.
+	size_t low = 0;
+	size_t high = m_term_count;
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(load_little_endian<uint32_t>(m_terms + middle * TERM_SIZE) < key) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	size_t end = low;
+	while(end < m_term_count && load_little_endian<uint32_t>(m_terms + end * TERM_SIZE) == key) {
+		++end;
+	}
+	return std::make_pair(low, end);
+}
+
+std::string ChunkIndex::term_value(size_t term) const {
+	const unsigned char *data = m_terms + term * TERM_SIZE;
+	uint64_t offset = load_little_endian<uint32_t>(data + 4);
+	uint64_t size = load_little_endian<uint32_t>(data + 8);
+	if(offset + size > m_strings_size) {
+		throw IoError("Chunk index has a string outside its strings.");
+	}
+	return std::string(reinterpret_cast<const char *>(m_strings + offset), size);
+}
+
+std::vector<size_t> ChunkIndex::set_bits(const unsigned char *bitmap) const {
+	std::vector<size_t> bits;
+	for(size_t word_index = 0; word_index < m_bitmap_size / 8; ++word_index) {
+		uint64_t word = load_little_endian<uint64_t>(bitmap + word_index * 8);
+		while(word) {
+			size_t bit = word_index * 64 + __builtin_ctzll(word);
+			// Padding bits past the last chunk, if the file's been tampered with.
+			if(bit < m_chunk_count) {
+				bits.push_back(bit);
+			}
+			word &= word - 1;
+		}
+	}
+	return bits;
+}
+
+}
+}
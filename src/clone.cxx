@@ -0,0 +1,172 @@
+#include <vector>
+
+#include "nbt.h"
+
+
+namespace nbt {
+
+namespace {
+
+	/* Copies a tree a level at a time: each container is copied empty,
+	 * then filled in once it comes off the stack, so deep trees don't use
+	 * up the call stack.
+	 */
+	class Cloner {
+	public:
+		Cloner(Arena *arena, CloneMode mode) : m_arena(arena), m_mode(mode) {}
+
+		TagPtr<Tag> clone(const Tag &tag) {
+			TagPtr<Tag> copy = copy_node(tag);
+			while(!m_stack.empty()) {
+				Frame frame = m_stack.back();
+				m_stack.pop_back();
+				(this->*frame.fill)(*frame.source, *frame.copy);
+			}
+			return copy;
+		}
+
+		Utf8String copy_string(const Utf8String &string) {
+			Utf8String copy;
+			copy.data = copy_bytes(string.data);
+			return copy;
+		}
+
+		// For visit(), from copy_node().
+		template<typename T>
+		TagPtr<Tag> operator() (const BasicTag<T> &tag) {
+			return new_tag<BasicTag<T>>(tag.value);
+		}
+
+		TagPtr<Tag> operator() (const ByteArrayTag &tag) {
+			TagPtr<ByteArrayTag> copy = new_tag<ByteArrayTag>();
+			copy->value = copy_bytes(tag.value);
+			return copy;
+		}
+
+		TagPtr<Tag> operator() (const StringTag &tag) {
+			TagPtr<StringTag> copy = new_tag<StringTag>();
+			copy->value = copy_string(tag.value);
+			return copy;
+		}
+
+		TagPtr<Tag> operator() (const IntArrayTag &tag) {
+			TagPtr<IntArrayTag> copy = new_tag<IntArrayTag>(m_arena);
+			copy->values.assign(tag.values.begin(), tag.values.end());
+			return copy;
+		}
+
+		TagPtr<Tag> operator() (const LongArrayTag &tag) {
+			TagPtr<LongArrayTag> copy = new_tag<LongArrayTag>(m_arena);
+			copy->values.assign(tag.values.begin(), tag.values.end());
+			return copy;
+		}
+
+		template<typename T>
+		TagPtr<Tag> operator() (const ListTag<BasicTag<T>> &tag) {
+			TagPtr<ListTag<BasicTag<T>>> copy = new_tag<ListTag<BasicTag<T>>>(m_arena);
+			copy->values.assign(tag.values.begin(), tag.values.end());
+			return copy;
+		}
+
+		template<typename T>
+		TagPtr<Tag> operator() (const ListTag<T> &tag) {
+			TagPtr<ListTag<T>> copy = new_tag<ListTag<T>>(m_arena, tag.element_type());
+			push(tag, *copy, &Cloner::fill_list<T>);
+			return copy;
+		}
+
+		TagPtr<Tag> operator() (const CompoundTag &tag) {
+			TagPtr<CompoundTag> copy = new_tag<CompoundTag>(m_arena);
+			push(tag, *copy, &Cloner::fill_compound);
+			return copy;
+		}
+
+	private:
+		typedef void (Cloner::*Fill)(const Tag &source, Tag &copy);
+
+		struct Frame {
+			const Tag *source;
+			Tag *copy;
+			Fill fill;
+		};
+
+		template<typename T, typename... Args>
+		TagPtr<T> new_tag(Args&&... args) {
+			if(m_arena) {
+				return TagPtr<T>(m_arena->create<T>(std::forward<Args>(args)...));
+			}
+			return TagPtr<T>(new T(std::forward<Args>(args)...));
+		}
+
+		void push(const Tag &source, Tag &copy, Fill fill) {
+			Frame frame = {&source, &copy, fill};
+			m_stack.push_back(frame);
+		}
+
+		TagPtr<Tag> copy_node(const Tag &tag) {
+			return visit(tag, *this);
+		}
+
+		TagPtr<Tag> copy_child(const TagPtr<Tag> &tag) {
+			return tag ? copy_node(*tag) : TagPtr<Tag>();
+		}
+
+		Array<unsigned char> copy_bytes(const Array<unsigned char> &bytes) {
+			/* Short ones may be inline in the original, inside a compound's
+			 * entries that move as it changes, so only longer ones are
+			 * borrowed; copying the others costs no allocation anyway.
+			 */
+			if(m_mode == CLONE_SHARED && bytes.size() > Array<unsigned char>::INLINE_CAPACITY) {
+				return Array<unsigned char>::borrow(bytes.data(), bytes.size());
+			}
+			// As the reader does: short ones fit inside the Array.
+			if(m_arena && bytes.size() > Array<unsigned char>::INLINE_CAPACITY) {
+				unsigned char *data = static_cast<unsigned char *>(m_arena->allocate(bytes.size(), 1));
+				std::copy(bytes.begin(), bytes.end(), data);
+				return Array<unsigned char>::borrow(data, bytes.size());
+			}
+			return Array<unsigned char>(bytes.data(), bytes.size());
+		}
+
+		template<typename T>
+		void fill_list(const Tag &source, Tag &copy) {
+			const ListTag<T> &list = static_cast<const ListTag<T> &>(source);
+			typename ListTag<T>::container_type &values = static_cast<ListTag<T> &>(copy).values;
+			values.reserve(list.values.size());
+			for(const TagPtr<T> &element : list.values) {
+				TagPtr<Tag> element_copy = element ? copy_node(*element) : TagPtr<Tag>();
+				values.push_back(TagPtr<T>(static_cast<T *>(element_copy.release())));
+			}
+		}
+
+		void fill_compound(const Tag &source, Tag &copy) {
+			const CompoundMap &values = static_cast<const CompoundTag &>(source).values;
+			CompoundMap &copy_values = static_cast<CompoundTag &>(copy).values;
+			copy_values.reserve(values.size());
+			for(const CompoundMap::value_type &entry : values) {
+				copy_values.insert(CompoundMap::value_type(copy_string(entry.first), copy_child(entry.second)));
+			}
+		}
+
+		Arena *m_arena;
+		CloneMode m_mode;
+		std::vector<Frame> m_stack;
+	};
+
+}
+
+TagPtr<Tag> clone(const Tag &tag, Arena *arena, CloneMode mode) {
+	return Cloner(arena, mode).clone(tag);
+}
+
+RootTag clone(const RootTag &root, Arena *arena, CloneMode mode) {
+	Cloner cloner(arena, mode);
+	RootTag copy;
+	copy.name = cloner.copy_string(root.name);
+	if(root.tag) {
+		copy.tag = cloner.clone(*root.tag);
+	}
+	return copy;
+}
+
+}
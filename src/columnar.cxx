@@ -0,0 +1,816 @@
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "nbt.h"
+#include "path.h"
+
+
+namespace nbt {
+namespace io {
+
+namespace {
+	typedef detail::TagPath Path;
+
+	// What Match::target is for the rows' path, rather than a column's.
+	const size_t ROWS = SIZE_MAX;
+
+	std::vector<std::string> split_names(const std::string &path) {
+		std::vector<std::string> names;
+		for(const Utf8String &name : detail::split_path(path)) {
+			names.push_back(std::string(reinterpret_cast<const char *>(name.data.data()), name.data.size()));
+		}
+		return names;
+	}
+
+	size_t value_size(ColumnType type) {
+		switch(type) {
+			case COLUMN_INT8:
+			case COLUMN_STRING:
+				return 1;
+			case COLUMN_INT16:
+				return 2;
+			case COLUMN_INT32:
+			case COLUMN_FLOAT32:
+				return 4;
+			default:
+				return 8;
+		}
+	}
+
+	template<typename T>
+	struct ColumnTypeOf;
+
+	#define NBT_COLUMN_TYPE_OF(value_type, column_type) \
+		template<> \
+		struct ColumnTypeOf<value_type> { \
+			static const ColumnType value = column_type; \
+		}
+	NBT_COLUMN_TYPE_OF(int8_t, COLUMN_INT8);
+	NBT_COLUMN_TYPE_OF(int16_t, COLUMN_INT16);
+	NBT_COLUMN_TYPE_OF(int32_t, COLUMN_INT32);
+	NBT_COLUMN_TYPE_OF(int64_t, COLUMN_INT64);
+	NBT_COLUMN_TYPE_OF(float, COLUMN_FLOAT32);
+	NBT_COLUMN_TYPE_OF(double, COLUMN_FLOAT64);
+	#undef NBT_COLUMN_TYPE_OF
+
+	template<typename T>
+	void append_value(std::vector<unsigned char> &out, T value) {
+		size_t at = out.size();
+		out.resize(at + sizeof(T));
+		std::memcpy(&out[at], &value, sizeof(T));
+	}
+
+	template<typename T>
+	bool append_if_fits(std::vector<unsigned char> &out, int64_t value) {
+		if(value < std::numeric_limits<T>::min() || value > std::numeric_limits<T>::max()) {
+			return false;
+		}
+		append_value(out, static_cast<T>(value));
+		return true;
+	}
+
+	// Appends a value in a column's type, if it goes in one.
+	bool encode_int(ColumnType type, int64_t value, std::vector<unsigned char> &out) {
+		switch(type) {
+			case COLUMN_INT8:
+				return append_if_fits<int8_t>(out, value);
+			case COLUMN_INT16:
+				return append_if_fits<int16_t>(out, value);
+			case COLUMN_INT32:
+				return append_if_fits<int32_t>(out, value);
+			case COLUMN_INT64:
+				append_value(out, value);
+				return true;
+			case COLUMN_FLOAT32:
+				append_value(out, static_cast<float>(value));
+				return true;
+			case COLUMN_FLOAT64:
+				append_value(out, static_cast<double>(value));
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	bool encode_float(ColumnType type, double value, std::vector<unsigned char> &out) {
+		switch(type) {
+			case COLUMN_FLOAT32:
+				append_value(out, static_cast<float>(value));
+				return true;
+			case COLUMN_FLOAT64:
+				append_value(out, value);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	bool encode_number(ColumnType type, int64_t value, std::vector<unsigned char> &out) {
+		return encode_int(type, value, out);
+	}
+
+	bool encode_number(ColumnType type, double value, std::vector<unsigned char> &out) {
+		return encode_float(type, value, out);
+	}
+
+	/* Appends a list's elements; all of them, or if any doesn't fit, none.
+	 * Elements already of the column's type are copied as they are.
+	 */
+	template<typename T>
+	bool encode_values(ColumnType type, const T *values, size_t count, std::vector<unsigned char> &out) {
+		if(ColumnTypeOf<T>::value == type) {
+			size_t at = out.size();
+			out.resize(at + count * sizeof(T));
+			if(count) {
+				std::memcpy(&out[at], values, count * sizeof(T));
+			}
+			return true;
+		}
+		typedef typename std::conditional<std::is_floating_point<T>::value, double, int64_t>::type Wide;
+		size_t at = out.size();
+		out.reserve(at + count * value_size(type));
+		for(size_t i = 0; i < count; ++i) {
+			if(!encode_number(type, static_cast<Wide>(values[i]), out)) {
+				out.resize(at);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template<typename T>
+	bool encode_list(ColumnType type, const ListTagBase &list, std::vector<unsigned char> &out) {
+		const auto &values = static_cast<const ListTag<BasicTag<T>> &>(list).values;
+		return encode_values(type, values.data(), values.size(), out);
+	}
+
+	/* What a row, or a document, has found for a column so far: the value
+	 * already in the column's encoding.
+	 */
+	struct Slot {
+		Slot() : present(false), failed(false) {}
+		bool present;
+		// A list being read from events had an element that didn't fit.
+		bool failed;
+		std::vector<unsigned char> bytes;
+
+		void clear() {
+			present = false;
+			failed = false;
+			bytes.clear();
+		}
+	};
+
+	/* A column being built, and how far it had got when the document in
+	 * progress started, to go back there if that fails.
+	 */
+	struct ColumnBuilder {
+		Column column;
+		size_t rows;
+		size_t mark_rows;
+		size_t mark_values;
+		size_t mark_nulls;
+
+		explicit ColumnBuilder(const ExportColumn &spec) {
+			column.path = spec.path;
+			column.type = spec.type;
+			column.list = spec.list;
+			column.document = spec.document;
+			reset();
+		}
+
+		bool variable() const {
+			return column.list || column.type == COLUMN_STRING;
+		}
+
+		void reset() {
+			column.null_count = 0;
+			column.validity.clear();
+			column.offsets.clear();
+			column.values.clear();
+			if(variable()) {
+				column.offsets.push_back(0);
+			}
+			rows = 0;
+			mark();
+		}
+
+		void mark() {
+			mark_rows = rows;
+			mark_values = column.values.size();
+			mark_nulls = column.null_count;
+		}
+
+		void rewind() {
+			rows = mark_rows;
+			column.null_count = mark_nulls;
+			column.values.resize(mark_values);
+			column.validity.resize((rows + 7) / 8);
+			if(rows % 8) {
+				column.validity.back() &= static_cast<uint8_t>((1 << (rows % 8)) - 1);
+			}
+			if(variable()) {
+				column.offsets.resize(rows + 1);
+			}
+		}
+
+		void append(const Slot &slot) {
+			if(rows % 8 == 0) {
+				column.validity.push_back(0);
+			}
+			if(slot.present) {
+				column.validity.back() |= static_cast<uint8_t>(1 << (rows % 8));
+				column.values.insert(column.values.end(), slot.bytes.begin(), slot.bytes.end());
+			} else {
+				++column.null_count;
+				if(!variable()) {
+					column.values.resize(column.values.size() + value_size(column.type));
+				}
+			}
+			if(variable()) {
+				size_t end = column.values.size() / value_size(column.type);
+				if(end > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+					throw IoError("Exported column too large for 32-bit offsets; take batches more often.");
+				}
+				column.offsets.push_back(static_cast<int32_t>(end));
+			}
+			++rows;
+		}
+	};
+
+	/* In the event reader, the paths a tag is on the way along, or at the
+	 * end of: `pos` names of the rows' path or of a column's.
+	 */
+	struct Match {
+		size_t target;
+		size_t pos;
+	};
+
+	struct Frame {
+		// The frame's matches are ColumnarExporter::State::matches from here on.
+		size_t begin;
+		bool compound;
+		// A compound that's a row.
+		bool row;
+		// A list of numbers being read into the list columns its matches are for.
+		bool collect;
+	};
+}
+
+struct ColumnarExporter::State {
+	State(const ExportOptions &options) :
+		rows(detail::split_path(options.rows)), specs(options.columns), row_count(0), document_rows(0)
+	{
+		for(size_t i = 0; i < specs.size(); ++i) {
+			if(specs[i].list && specs[i].type == COLUMN_STRING) {
+				throw std::invalid_argument("Exported list columns must be of numbers: " + specs[i].path);
+			}
+			paths.push_back(detail::split_path(specs[i].path));
+			builders.push_back(ColumnBuilder(specs[i]));
+			(specs[i].document ? document_columns : row_columns).push_back(i);
+		}
+		slots.resize(specs.size());
+	}
+
+	const Path &path(size_t target) const {
+		return target == ROWS ? rows : paths[target];
+	}
+
+	void begin_document() {
+		for(ColumnBuilder &builder : builders) {
+			builder.mark();
+		}
+		for(size_t i : document_columns) {
+			slots[i].clear();
+		}
+		document_rows = 0;
+	}
+
+	void end_document() {
+		for(size_t i : document_columns) {
+			for(size_t row = 0; row < document_rows; ++row) {
+				builders[i].append(slots[i]);
+			}
+		}
+		row_count += document_rows;
+	}
+
+	void rewind() {
+		for(ColumnBuilder &builder : builders) {
+			builder.rewind();
+		}
+	}
+
+	void begin_row() {
+		for(size_t i : row_columns) {
+			slots[i].clear();
+		}
+	}
+
+	void end_row() {
+		for(size_t i : row_columns) {
+			builders[i].append(slots[i]);
+		}
+		++document_rows;
+	}
+
+	// Takes a tag's value for a column, if the column hasn't one yet and it fits.
+	bool take_value(const Tag &tag, size_t column) {
+		Slot &slot = slots[column];
+		const ExportColumn &spec = specs[column];
+		if(slot.present) {
+			return true;
+		}
+		if(spec.list) {
+			slot.present = list_value(tag, spec.type, slot.bytes);
+		} else {
+			slot.present = scalar_value(tag, spec.type, slot.bytes);
+		}
+		return slot.present;
+	}
+
+	static bool scalar_value(const Tag &tag, ColumnType type, std::vector<unsigned char> &out) {
+		switch(tag.type()) {
+			case TAG_TYPE_BYTE:
+				return encode_int(type, static_cast<const ByteTag &>(tag).value, out);
+			case TAG_TYPE_SHORT:
+				return encode_int(type, static_cast<const ShortTag &>(tag).value, out);
+			case TAG_TYPE_INT:
+				return encode_int(type, static_cast<const IntTag &>(tag).value, out);
+			case TAG_TYPE_LONG:
+				return encode_int(type, static_cast<const LongTag &>(tag).value, out);
+			case TAG_TYPE_FLOAT:
+				return encode_float(type, static_cast<const FloatTag &>(tag).value, out);
+			case TAG_TYPE_DOUBLE:
+				return encode_float(type, static_cast<const DoubleTag &>(tag).value, out);
+			case TAG_TYPE_STRING:
+				if(type == COLUMN_STRING) {
+					const Array<unsigned char> &data = static_cast<const StringTag &>(tag).value.data;
+					out.insert(out.end(), data.begin(), data.end());
+					return true;
+				}
+				return false;
+			default:
+				return false;
+		}
+	}
+
+	static bool list_value(const Tag &tag, ColumnType type, std::vector<unsigned char> &out) {
+		switch(tag.type()) {
+			case TAG_TYPE_BYTE_ARRAY: {
+				const Array<unsigned char> &value = static_cast<const ByteArrayTag &>(tag).value;
+				return encode_values(type, reinterpret_cast<const int8_t *>(value.data()), value.size(), out);
+			}
+			case TAG_TYPE_INT_ARRAY: {
+				const auto &values = static_cast<const IntArrayTag &>(tag).values;
+				return encode_values(type, values.data(), values.size(), out);
+			}
+			case TAG_TYPE_LONG_ARRAY: {
+				const auto &values = static_cast<const LongArrayTag &>(tag).values;
+				return encode_values(type, values.data(), values.size(), out);
+			}
+			case TAG_TYPE_LIST:
+				break;
+			default:
+				return false;
+		}
+		const ListTagBase &list = static_cast<const ListTagBase &>(tag);
+		switch(list.element_type()) {
+			case TAG_TYPE_END:
+				// An empty list, as Minecraft writes them.
+				return true;
+			case TAG_TYPE_BYTE:
+				return encode_list<int8_t>(type, list, out);
+			case TAG_TYPE_SHORT:
+				return encode_list<int16_t>(type, list, out);
+			case TAG_TYPE_INT:
+				return encode_list<int32_t>(type, list, out);
+			case TAG_TYPE_LONG:
+				return encode_list<int64_t>(type, list, out);
+			case TAG_TYPE_FLOAT:
+				return encode_list<float>(type, list, out);
+			case TAG_TYPE_DOUBLE:
+				return encode_list<double>(type, list, out);
+			default:
+				return false;
+		}
+	}
+
+	void add_tree(const Tag &root) {
+		for(size_t i : document_columns) {
+			detail::find_path(root, paths[i], true, pending_values, [&](const Tag &tag) { return take_value(tag, i); });
+		}
+		detail::find_path(root, rows, true, pending_rows, [&](const Tag &row) -> bool {
+			if(row.type() == TAG_TYPE_COMPOUND) {
+				begin_row();
+				for(size_t i : row_columns) {
+					detail::find_path(row, paths[i], true, pending_values, [&](const Tag &tag) { return take_value(tag, i); });
+				}
+				end_row();
+			}
+			return false;
+		});
+	}
+
+	/* The event reader's counterpart to find_path: each tag inherits the
+	 * matches of its parent that lead to it, and values are taken at the
+	 * end of a match.
+	 */
+	void add_events(InputStream &s) {
+		EventReader reader(s);
+		frames.clear();
+		matches.clear();
+		while(true) {
+			EventReader::Event event = reader.next();
+			if(event == EventReader::EVENT_END_OF_DOCUMENT) {
+				return;
+			}
+			if(event == EventReader::EVENT_END_COMPOUND || event == EventReader::EVENT_END_LIST) {
+				end_frame();
+				continue;
+			}
+
+			size_t begin = matches.size();
+			if(frames.empty()) {
+				matches.push_back(Match{ROWS, 0});
+				for(size_t i : document_columns) {
+					matches.push_back(Match{i, 0});
+				}
+			} else if(frames.back().collect) {
+				collect_element(reader);
+				continue;
+			} else {
+				const Frame &parent = frames.back();
+				for(size_t i = parent.begin; i < begin; ++i) {
+					Match match = matches[i];
+					if(!parent.compound) {
+						matches.push_back(match);
+					} else if(match.pos < path(match.target).size() && path(match.target)[match.pos] == reader.name()) {
+						matches.push_back(Match{match.target, match.pos + 1});
+					}
+				}
+			}
+
+			switch(event) {
+				case EventReader::EVENT_BEGIN_COMPOUND:
+					begin_compound(reader, begin);
+					break;
+				case EventReader::EVENT_BEGIN_LIST:
+					begin_list(reader, begin);
+					break;
+				case EventReader::EVENT_ARRAY:
+					array_value(reader, begin);
+					matches.resize(begin);
+					break;
+				default:
+					scalar_event(reader, begin);
+					matches.resize(begin);
+					break;
+			}
+		}
+	}
+
+	bool at_end(const Match &match) const {
+		return match.pos == path(match.target).size();
+	}
+
+	void begin_compound(EventReader &reader, size_t begin) {
+		bool row = false;
+		for(size_t i = begin; i < matches.size(); ++i) {
+			row = row || (matches[i].target == ROWS && at_end(matches[i]));
+		}
+		if(row) {
+			begin_row();
+			for(size_t i : row_columns) {
+				matches.push_back(Match{i, 0});
+			}
+		}
+		if(matches.size() == begin) {
+			reader.skip();
+			return;
+		}
+		frames.push_back(Frame{begin, true, row, false});
+	}
+
+	void begin_list(EventReader &reader, size_t begin) {
+		if(detail::looked_through(reader.element_type())) {
+			if(matches.size() == begin) {
+				reader.skip();
+			} else {
+				frames.push_back(Frame{begin, false, false, false});
+			}
+			return;
+		}
+		// Not looked through, so this list is only of use as a value.
+		bool numbers = reader.element_type() != TAG_TYPE_STRING && reader.element_type() != TAG_TYPE_BYTE_ARRAY &&
+			reader.element_type() != TAG_TYPE_INT_ARRAY && reader.element_type() != TAG_TYPE_LONG_ARRAY;
+		size_t kept = begin;
+		for(size_t i = begin; numbers && i < matches.size(); ++i) {
+			Match match = matches[i];
+			if(match.target != ROWS && at_end(match) && specs[match.target].list && !slots[match.target].present) {
+				slots[match.target].clear();
+				matches[kept++] = match;
+			}
+		}
+		matches.resize(kept);
+		if(matches.size() == begin) {
+			reader.skip();
+			return;
+		}
+		frames.push_back(Frame{begin, false, false, true});
+	}
+
+	void collect_element(EventReader &reader) {
+		const Frame &frame = frames.back();
+		for(size_t i = frame.begin; i < matches.size(); ++i) {
+			Slot &slot = slots[matches[i].target];
+			ColumnType type = specs[matches[i].target].type;
+			if(slot.failed) {
+				continue;
+			}
+			if(reader.event() == EventReader::EVENT_INT) {
+				slot.failed = !encode_int(type, reader.int_value(), slot.bytes);
+			} else {
+				slot.failed = !encode_float(type, reader.float_value(), slot.bytes);
+			}
+		}
+	}
+
+	void end_frame() {
+		Frame frame = frames.back();
+		frames.pop_back();
+		if(frame.collect) {
+			for(size_t i = frame.begin; i < matches.size(); ++i) {
+				Slot &slot = slots[matches[i].target];
+				if(slot.failed) {
+					slot.clear();
+				} else {
+					slot.present = true;
+				}
+			}
+		}
+		if(frame.row) {
+			end_row();
+		}
+		matches.resize(frame.begin);
+	}
+
+	void scalar_event(EventReader &reader, size_t begin) {
+		for(size_t i = begin; i < matches.size(); ++i) {
+			const Match &match = matches[i];
+			if(match.target == ROWS || !at_end(match) || specs[match.target].list) {
+				continue;
+			}
+			Slot &slot = slots[match.target];
+			ColumnType type = specs[match.target].type;
+			if(slot.present) {
+				continue;
+			}
+			switch(reader.event()) {
+				case EventReader::EVENT_INT:
+					slot.present = encode_int(type, reader.int_value(), slot.bytes);
+					break;
+				case EventReader::EVENT_FLOAT:
+					slot.present = encode_float(type, reader.float_value(), slot.bytes);
+					break;
+				default:
+					if(type == COLUMN_STRING) {
+						const Array<unsigned char> &data = reader.string_value().data;
+						slot.bytes.assign(data.begin(), data.end());
+						slot.present = true;
+					}
+					break;
+			}
+		}
+	}
+
+	void array_value(EventReader &reader, size_t begin) {
+		bool read = false;
+		for(size_t i = begin; i < matches.size(); ++i) {
+			const Match &match = matches[i];
+			if(match.target == ROWS || !at_end(match) || !specs[match.target].list || slots[match.target].present) {
+				continue;
+			}
+			if(!read) {
+				read_array(reader);
+				read = true;
+			}
+			Slot &slot = slots[match.target];
+			ColumnType type = specs[match.target].type;
+			switch(reader.type()) {
+				case TAG_TYPE_BYTE_ARRAY:
+					slot.present = encode_values(type, reinterpret_cast<const int8_t *>(bytes.data()), bytes.size(), slot.bytes);
+					break;
+				case TAG_TYPE_INT_ARRAY:
+					slot.present = encode_values(type, ints.data(), ints.size(), slot.bytes);
+					break;
+				default:
+					slot.present = encode_values(type, longs.data(), longs.size(), slot.bytes);
+					break;
+			}
+		}
+	}
+
+	template<typename T>
+	static void read_all(EventReader &reader, std::vector<T> &out) {
+		// The length has been read from the document, so it's grown into rather than trusted.
+		const size_t piece = 64 * 1024;
+		out.clear();
+		while(true) {
+			size_t at = out.size();
+			out.resize(at + piece);
+			size_t read = reader.read_array(&out[at], piece);
+			out.resize(at + read);
+			if(read == 0) {
+				return;
+			}
+		}
+	}
+
+	void read_array(EventReader &reader) {
+		switch(reader.type()) {
+			case TAG_TYPE_BYTE_ARRAY:
+				read_all(reader, bytes);
+				break;
+			case TAG_TYPE_INT_ARRAY:
+				read_all(reader, ints);
+				break;
+			default:
+				read_all(reader, longs);
+				break;
+		}
+	}
+
+	ColumnBatch take_batch() {
+		ColumnBatch batch;
+		batch.row_count = row_count;
+		for(ColumnBuilder &builder : builders) {
+			batch.columns.push_back(std::move(builder.column));
+			builder.reset();
+		}
+		row_count = 0;
+		return batch;
+	}
+
+	Path rows;
+	std::vector<ExportColumn> specs;
+	std::vector<Path> paths;
+	std::vector<size_t> row_columns;
+	std::vector<size_t> document_columns;
+	std::vector<ColumnBuilder> builders;
+	// Rows taken in full, in every column.
+	size_t row_count;
+	std::vector<Slot> slots;
+	size_t document_rows;
+
+	detail::PendingTags pending_rows;
+	detail::PendingTags pending_values;
+
+	std::vector<Frame> frames;
+	std::vector<Match> matches;
+	std::vector<unsigned char> bytes;
+	std::vector<int32_t> ints;
+	std::vector<int64_t> longs;
+};
+
+ColumnarExporter::ColumnarExporter(const ExportOptions &options) : m_state(new State(options)) {}
+
+ColumnarExporter::~ColumnarExporter() {}
+
+void ColumnarExporter::add(const Tag &document) {
+	m_state->begin_document();
+	try {
+		m_state->add_tree(document);
+		m_state->end_document();
+	} catch(...) {
+		m_state->rewind();
+		throw;
+	}
+}
+
+void ColumnarExporter::add(const RootTag &document) {
+	if(document.tag) {
+		add(*document.tag);
+	}
+}
+
+void ColumnarExporter::add(InputStream &s) {
+	m_state->begin_document();
+	try {
+		m_state->add_events(s);
+		m_state->end_document();
+	} catch(...) {
+		m_state->rewind();
+		throw;
+	}
+}
+
+size_t ColumnarExporter::row_count() const {
+	return m_state->row_count;
+}
+
+ColumnBatch ColumnarExporter::take_batch() {
+	return m_state->take_batch();
+}
+
+namespace {
+	/* The exporters of export_regions, one per thread at a time, though not
+	 * tied to any: a thread takes whichever is free for each chunk.
+	 */
+	class ExporterPool {
+	public:
+		explicit ExporterPool(const ExportOptions &options) : m_options(options) {}
+
+		std::unique_ptr<ColumnarExporter> take() {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if(!m_free.empty()) {
+					std::unique_ptr<ColumnarExporter> exporter = std::move(m_free.back());
+					m_free.pop_back();
+					return exporter;
+				}
+			}
+			return std::unique_ptr<ColumnarExporter>(new ColumnarExporter(m_options));
+		}
+
+		void give(std::unique_ptr<ColumnarExporter> &&exporter) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_free.push_back(std::move(exporter));
+		}
+
+		std::vector<std::unique_ptr<ColumnarExporter>> &exporters() { return m_free; }
+
+	private:
+		const ExportOptions &m_options;
+		std::mutex m_mutex;
+		std::vector<std::unique_ptr<ColumnarExporter>> m_free;
+	};
+
+	// Hands an exporter back to the pool, however the chunk went.
+	class Lease {
+	public:
+		explicit Lease(ExporterPool &pool) : m_pool(pool), m_exporter(pool.take()) {}
+		~Lease() { m_pool.give(std::move(m_exporter)); }
+		ColumnarExporter &operator * () { return *m_exporter; }
+	private:
+		ExporterPool &m_pool;
+		std::unique_ptr<ColumnarExporter> m_exporter;
+	};
+}
+
+void export_regions(const std::vector<std::string> &region_paths, const ExportOptions &options,
+	const BatchCallback &callback)
+{
+	if(options.batch_rows == 0) {
+		throw std::invalid_argument("ExportOptions::batch_rows must be at least 1.");
+	}
+	// Checks the columns before any region is opened.
+	ExporterPool pool(options);
+	pool.give(pool.take());
+
+	Projection projection;
+	std::vector<std::string> rows = split_names(options.rows);
+	bool row_columns = false;
+	for(const ExportColumn &column : options.columns) {
+		std::vector<std::string> path = column.document ? std::vector<std::string>() : rows;
+		std::vector<std::string> names = split_names(column.path);
+		path.insert(path.end(), names.begin(), names.end());
+		projection.add(path);
+		row_columns = row_columns || !column.document;
+	}
+	// Without any, the rows are still wanted, if only to be counted.
+	if(!row_columns) {
+		projection.add(rows);
+	}
+	LoadOptions load = options.load;
+	load.projection = &projection;
+
+	load_regions(region_paths, [&](const std::string &, size_t, RootTag &chunk) {
+		ColumnBatch batch;
+		{
+			Lease exporter(pool);
+			(*exporter).add(chunk);
+			if((*exporter).row_count() < options.batch_rows) {
+				return;
+			}
+			batch = (*exporter).take_batch();
+		}
+		callback(batch);
+	}, load);
+
+	for(std::unique_ptr<ColumnarExporter> &exporter : pool.exporters()) {
+		if(exporter->row_count()) {
+			ColumnBatch batch = exporter->take_batch();
+			callback(batch);
+		}
+	}
+}
+
+}
+}
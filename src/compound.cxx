@@ -0,0 +1,115 @@
+#include "nbt.h"
+
+
+namespace nbt {
+
+const size_t CompoundMap::INDEX_THRESHOLD;
+
+size_t CompoundMap::find_index(const Utf8String &key) const {
+	if(m_index.empty()) {
+		for(size_t i = 0; i < m_entries.size(); ++i) {
+			if(m_entries[i].first == key) {
+				return i;
+			}
+		}
+		return m_entries.size();
+	}
+
+	size_t mask = m_index.size() - 1;
+	for(size_t slot = Utf8StringHash()(key) & mask;; slot = (slot + 1) & mask) {
+		uint32_t entry = m_index[slot];
+		if(entry == 0) {
+			return m_entries.size();
+		}
+		if(m_entries[entry - 1].first == key) {
+			return entry - 1;
+		}
+	}
+}
+
+void CompoundMap::add_to_index(size_t entry) {
+	size_t mask = m_index.size() - 1;
+	size_t slot = Utf8StringHash()(m_entries[entry].first) & mask;
+	while(m_index[slot] != 0) {
+		slot = (slot + 1) & mask;
+	}
+	m_index[slot] = static_cast<uint32_t>(entry + 1);
+}
+
+void CompoundMap::rebuild_index() {
+	if(m_entries.size() <= INDEX_THRESHOLD) {
+		m_index.clear();
+		return;
+	}
+	// Keep it at most half full.
+	size_t slots = 64;
+	while(slots < m_entries.size() * 2) {
+		slots *= 2;
+	}
+	m_index.assign(slots, 0);
+	for(size_t i = 0; i < m_entries.size(); ++i) {
+		add_to_index(i);
+	}
+}
+
+std::pair<CompoundMap::iterator, bool> CompoundMap::insert(value_type &&value) {
+	size_t existing = find_index(value.first);
+	if(existing != m_entries.size()) {
+		return std::make_pair(m_entries.begin() + existing, false);
+	}
+	m_entries.push_back(std::move(value));
+	if(m_index.empty() ? m_entries.size() > INDEX_THRESHOLD : m_entries.size() * 2 > m_index.size()) {
+		rebuild_index();
+	} else if(!m_index.empty()) {
+		add_to_index(m_entries.size() - 1);
+	}
+	return std::make_pair(m_entries.end() - 1, true);
+}
+
+TagPtr<Tag> &CompoundMap::operator [] (const Utf8String &key) {
+	return insert(value_type(key, TagPtr<Tag>())).first->second;
+}
+
+size_t CompoundMap::erase(const Utf8String &key) {
+	const_iterator position = find(key);
+	if(position == end()) {
+		return 0;
+	}
+	erase(position);
+	return 1;
+}
+
+CompoundMap::iterator CompoundMap::erase(const_iterator position) {
+	size_t index = position - m_entries.begin();
+	m_entries.erase(m_entries.begin() + index);
+	// Everything after it has moved down one, so the index is out of date.
+	if(!m_index.empty()) {
+		rebuild_index();
+	}
+	return m_entries.begin() + index;
+}
+
+void CompoundMap::clear() {
+	m_entries.clear();
+	m_index.clear();
+}
+
+const size_t NameTable::DEFAULT_MAX_NAMES;
+
+bool NameTable::intern(const unsigned char *data, size_t size, Utf8String &name) {
+	auto found = m_names.find(Utf8String::borrow(data, size));
+	if(found != m_names.end()) {
+		name = Utf8String::borrow(found->data.data(), size);
+		return true;
+	}
+	if(m_names.size() >= m_max_names) {
+		return false;
+	}
+	unsigned char *copy = static_cast<unsigned char *>(m_storage.allocate(size, 1));
+	std::copy(data, data + size, copy);
+	name = Utf8String::borrow(copy, size);
+	m_names.insert(name);
+	return true;
+}
+
+}
@@ -0,0 +1,219 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nbt.h"
+
+
+namespace nbt {
+namespace utility {
+
+namespace {
+
+	/* Paths are kept as a tree of these, and only spelled out for the
+	 * differences found, so that deep trees don't take quadratic time.
+	 */
+	struct PathNode {
+		size_t parent;
+		// The key, for compounds' children; null for lists' elements.
+		const Utf8String *key;
+		size_t index;
+	};
+
+	const size_t NO_PARENT = SIZE_MAX;
+
+	class Paths {
+	public:
+		Paths() {
+			PathNode root = {NO_PARENT, nullptr, 0};
+			m_nodes.push_back(root);
+		}
+
+		size_t child(size_t parent, const Utf8String &key) {
+			PathNode node = {parent, &key, 0};
+			m_nodes.push_back(node);
+			return m_nodes.size() - 1;
+		}
+
+		size_t child(size_t parent, size_t index) {
+			PathNode node = {parent, nullptr, index};
+			m_nodes.push_back(node);
+			return m_nodes.size() - 1;
+		}
+
+		std::string spell(size_t node) const {
+			std::vector<size_t> chain;
+			for(; m_nodes[node].parent != NO_PARENT; node = m_nodes[node].parent) {
+				chain.push_back(node);
+			}
+			std::string path;
+			for(size_t i = chain.size(); i-- > 0;) {
+				const PathNode &part = m_nodes[chain[i]];
+				if(part.key) {
+					if(!path.empty()) {
+						path += '.';
+					}
+					path.append(reinterpret_cast<const char *>(part.key->data.data()), part.key->data.size());
+				} else {
+					path += '[';
+					path += std::to_string(part.index);
+					path += ']';
+				}
+			}
+			return path;
+		}
+
+	private:
+		std::vector<PathNode> m_nodes;
+	};
+
+	struct Pending {
+		const Tag *before;
+		const Tag *after;
+		size_t path;
+	};
+
+	/* Compares two tags of the same type, given as `after` through visit() and
+	 * `before` on the side. Compounds and lists of tags queue up their
+	 * children (in reverse, so they come off the stack in order) rather than
+	 * being descended into.
+	 */
+	class Differ {
+	public:
+		Differ(const Tag &before, size_t path, Paths &paths, std::vector<TreeDifference> &out,
+			std::vector<Pending> &pending) :
+			m_before(before), m_path(path), m_paths(paths), m_out(out), m_pending(pending) {}
+
+		template<typename T>
+		void operator () (const BasicTag<T> &after) {
+			const BasicTag<T> &before = static_cast<const BasicTag<T> &>(m_before);
+			// Bit for bit, as they'd be written.
+			if(std::memcmp(&before.value, &after.value, sizeof(T)) != 0) {
+				changed();
+			}
+		}
+
+		void operator () (const ByteArrayTag &after) {
+			if(static_cast<const ByteArrayTag &>(m_before).value != after.value) {
+				changed();
+			}
+		}
+
+		void operator () (const StringTag &after) {
+			if(static_cast<const StringTag &>(m_before).value != after.value) {
+				changed();
+			}
+		}
+
+		template<typename T>
+		void operator () (const ListTag<BasicTag<T>> &after) {
+			const ListTag<BasicTag<T>> &before = static_cast<const ListTag<BasicTag<T>> &>(m_before);
+			if(!same_values(before.values, after.values)) {
+				changed();
+			}
+		}
+
+		template<typename T>
+		void operator () (const ListTag<T> &after) {
+			const ListTag<T> &before = static_cast<const ListTag<T> &>(m_before);
+			if(before.element_type() != after.element_type() || before.values.size() != after.values.size()) {
+				changed();
+				return;
+			}
+			for(size_t i = after.values.size(); i-- > 0;) {
+				Pending child = {before.values[i].get(), after.values[i].get(), m_paths.child(m_path, i)};
+				m_pending.push_back(child);
+			}
+		}
+
+		void operator () (const CompoundTag &after) {
+			const CompoundMap &before = static_cast<const CompoundTag &>(m_before).values;
+			size_t first_child = m_pending.size();
+			for(const CompoundMap::value_type &entry : before) {
+				CompoundMap::const_iterator match = after.values.find(entry.first);
+				if(match == after.values.end()) {
+					add(TreeDifference::REMOVED, m_paths.child(m_path, entry.first));
+				} else {
+					Pending child = {entry.second.get(), match->second.get(), m_paths.child(m_path, entry.first)};
+					m_pending.push_back(child);
+				}
+			}
+			for(const CompoundMap::value_type &entry : after.values) {
+				if(before.find(entry.first) == before.end()) {
+					add(TreeDifference::ADDED, m_paths.child(m_path, entry.first));
+				}
+			}
+			std::reverse(m_pending.begin() + first_child, m_pending.end());
+		}
+
+		void operator () (const IntArrayTag &after) {
+			if(!same_values(static_cast<const IntArrayTag &>(m_before).values, after.values)) {
+				changed();
+			}
+		}
+
+		void operator () (const LongArrayTag &after) {
+			if(!same_values(static_cast<const LongArrayTag &>(m_before).values, after.values)) {
+				changed();
+			}
+		}
+
+	private:
+		template<typename Container>
+		static bool same_values(const Container &before, const Container &after) {
+			return before.size() == after.size() &&
+				(before.empty() || std::memcmp(before.data(), after.data(), before.size() * sizeof(before[0])) == 0);
+		}
+
+		void add(TreeDifference::Kind kind, size_t path) {
+			TreeDifference difference = {kind, m_paths.spell(path)};
+			m_out.push_back(std::move(difference));
+		}
+
+		void changed() {
+			add(TreeDifference::CHANGED, m_path);
+		}
+
+		const Tag &m_before;
+		size_t m_path;
+		Paths &m_paths;
+		std::vector<TreeDifference> &m_out;
+		std::vector<Pending> &m_pending;
+	};
+
+	void diff_into(const Tag *before, const Tag *after, std::vector<TreeDifference> &out) {
+		Paths paths;
+		std::vector<Pending> pending;
+		Pending root = {before, after, 0};
+		pending.push_back(root);
+		while(!pending.empty()) {
+			Pending item = pending.back();
+			pending.pop_back();
+			if(!item.before || !item.after || item.before->type() != item.after->type()) {
+				if(item.before != item.after) {
+					TreeDifference difference = {TreeDifference::CHANGED, paths.spell(item.path)};
+					out.push_back(std::move(difference));
+				}
+				continue;
+			}
+			visit(*item.after, Differ(*item.before, item.path, paths, out, pending));
+		}
+	}
+
+}
+
+std::vector<TreeDifference> diff(const Tag &before, const Tag &after) {
+	std::vector<TreeDifference> out;
+	diff_into(&before, &after, out);
+	return out;
+}
+
+std::vector<TreeDifference> diff(const RootTag &before, const RootTag &after) {
+	std::vector<TreeDifference> out;
+	diff_into(before.tag.get(), after.tag.get(), out);
+	return out;
+}
+
+}
+}
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <climits>
+
+#include <zlib.h>
+
+#include "nbt.h"
+
+
+namespace nbt {
+namespace io {
+
+namespace {
+	// What each end of zlib is happy to take in one go.
+	const size_t MAX_ZLIB_CHUNK = UINT_MAX;
+	// How much compressed data to read from an istream at a time.
+	const size_t INPUT_BUFFER_SIZE = 16 * 1024;
+
+	int window_bits_for(CompressionFormat format) {
+		int window_bits = MAX_WBITS;
+		if(format == COMPRESSION_GZIP) {
+			window_bits += 16;
+		} else if(format == COMPRESSION_DETECT) {
+			window_bits += 32;
+		}
+		return window_bits;
+	}
+}
+
+struct InflateInputStream::State {
+	z_stream z;
+	// Compressed data, when reading from an istream.
+	std::vector<unsigned char> input;
+};
+
+const size_t InflateInputStream::DEFAULT_BUFFER_SIZE;
+
+InflateInputStream::InflateInputStream(const unsigned char *data, size_t size,
+	CompressionFormat format, size_t buffer_size) :
+	m_state(new State()), m_istream(nullptr), m_source_position(data), m_source_end(data + size),
+	m_window(buffer_size), m_finished(false)
+{
+	init(format);
+}
+
+InflateInputStream::InflateInputStream(std::istream &stream, CompressionFormat format, size_t buffer_size) :
+	m_state(new State()), m_istream(&stream), m_source_position(nullptr), m_source_end(nullptr),
+	m_window(buffer_size), m_finished(false)
+{
+	m_state->input.resize(INPUT_BUFFER_SIZE);
+	init(format);
+}
+
+InflateInputStream::~InflateInputStream() {
+	inflateEnd(&m_state->z);
+}
+
+void InflateInputStream::init(CompressionFormat format) {
+	if(m_window.empty()) {
+		throw std::invalid_argument("InflateInputStream needs a buffer.");
+	}
+	m_state->z.zalloc = Z_NULL;
+	m_state->z.zfree = Z_NULL;
+	m_state->z.opaque = Z_NULL;
+	m_state->z.next_in = Z_NULL;
+	m_state->z.avail_in = 0;
+	if(inflateInit2(&m_state->z, window_bits_for(format)) != Z_OK) {
+		throw std::bad_alloc();
+	}
+}
+
+void InflateInputStream::reset(const unsigned char *data, size_t size, CompressionFormat format) {
+	if(inflateReset2(&m_state->z, window_bits_for(format)) != Z_OK) {
+		throw std::logic_error("inflateReset2 failed.");
+	}
+	m_state->z.next_in = Z_NULL;
+	m_state->z.avail_in = 0;
+	m_istream = nullptr;
+	m_source_position = data;
+	m_source_end = data + size;
+	m_buffer_position = nullptr;
+	m_buffer_end = nullptr;
+	m_finished = false;
+}
+
+bool InflateInputStream::refill_input() {
+	z_stream &z = m_state->z;
+	if(m_istream == nullptr) {
+		size_t available = std::min(static_cast<size_t>(m_source_end - m_source_position), MAX_ZLIB_CHUNK);
+		z.next_in = const_cast<unsigned char *>(m_source_position);
+		z.avail_in = static_cast<uInt>(available);
+		m_source_position += available;
+		return available != 0;
+	}
+
+	m_istream->read(reinterpret_cast<char *>(&m_state->input[0]), m_state->input.size());
+	if(m_istream->bad()) {
+		throw IoError();
+	}
+	size_t filled = m_istream->gcount();
+	if(m_istream->eof()) {
+		m_istream->clear();
+	}
+	z.next_in = &m_state->input[0];
+	z.avail_in = static_cast<uInt>(filled);
+	return filled != 0;
+}
+
+/* Inflates up to `size` bytes into `data`, stopping short only at the end
+ * of the compressed stream or of the data.
+ */
+size_t InflateInputStream::inflate_into(unsigned char *data, size_t size) {
+	z_stream &z = m_state->z;
+	size_t produced = 0;
+	while(produced < size && !m_finished) {
+		if(z.avail_in == 0 && !refill_input()) {
+			break;
+		}
+		size_t chunk = std::min(size - produced, MAX_ZLIB_CHUNK);
+		z.next_out = data + produced;
+		z.avail_out = static_cast<uInt>(chunk);
+		int result = inflate(&z, Z_NO_FLUSH);
+		produced += chunk - z.avail_out;
+		if(result == Z_STREAM_END) {
+			m_finished = true;
+		} else if(result == Z_MEM_ERROR) {
+			throw std::bad_alloc();
+		} else if(result != Z_OK && result != Z_BUF_ERROR) {
+			throw IoError("Corrupt compressed NBT stream.");
+		}
+	}
+	return produced;
+}
+
+uint64_t InflateInputStream::position() const {
+	return m_state->z.total_out - (m_buffer_end - m_buffer_position);
+}
+
+void InflateInputStream::read(unsigned char *data, size_t size) {
+	while(true) {
+		size_t buffered = std::min(static_cast<size_t>(m_buffer_end - m_buffer_position), size);
+		std::copy(m_buffer_position, m_buffer_position + buffered, data);
+		m_buffer_position += buffered;
+		data += buffered;
+		size -= buffered;
+		if(size == 0) {
+			return;
+		}
+
+		// As with BufferedIStreamInputStream, big reads skip the window.
+		if(size >= m_window.size()) {
+			if(inflate_into(data, size) < size) {
+				throw PrematureEof();
+			}
+			return;
+		}
+
+		size_t filled = inflate_into(&m_window[0], m_window.size());
+		m_buffer_position = &m_window[0];
+		m_buffer_end = m_buffer_position + filled;
+		if(filled == 0) {
+			throw PrematureEof();
+		}
+	}
+}
+
+}
+}
@@ -0,0 +1,182 @@
+#include <stdexcept>
+
+#include "nbt.h"
+#include "reader.h"
+#include "writer.h"
+
+
+namespace nbt {
+
+LazyCompoundTag::LazyCompoundTag(const unsigned char *data, size_t size) : m_scanned_size(0) {
+	const unsigned char *position = data;
+	const unsigned char *end = data + size;
+	while(true) {
+		if(position == end) {
+			throw io::PrematureEof();
+		}
+		io::TagTypeId tag_type = *position;
+		if(tag_type == io::TAG_TYPE_END) {
+			++position;
+			break;
+		}
+
+		Entry entry;
+		entry.type = tag_type;
+		entry.source = position;
+		if(end - position < 3) {
+			throw io::PrematureEof();
+		}
+		size_t name_length = (static_cast<size_t>(position[1]) << 8) | position[2];
+		position += 3;
+		if(static_cast<size_t>(end - position) < name_length) {
+			throw io::PrematureEof();
+		}
+		entry.name = Utf8String::borrow(position, name_length);
+		position += name_length;
+		entry.payload = position;
+		entry.payload_size = io::detail::payload_size(position, end - position, tag_type);
+		position += entry.payload_size;
+		entry.source_size = position - entry.source;
+		m_entries.push_back(std::move(entry));
+	}
+	m_scanned_size = position - data;
+}
+
+LazyCompoundTag::~LazyCompoundTag() {}
+
+LazyCompoundTag::Entry *LazyCompoundTag::find(const Utf8String &name) {
+	for(Entry &entry : m_entries) {
+		if(entry.name == name) {
+			return &entry;
+		}
+	}
+	return nullptr;
+}
+
+const LazyCompoundTag::Entry *LazyCompoundTag::find(const Utf8String &name) const {
+	return const_cast<LazyCompoundTag *>(this)->find(name);
+}
+
+Tag *LazyCompoundTag::get(const Utf8String &name) {
+	Entry *entry = find(name);
+	if(!entry) {
+		return nullptr;
+	}
+	if(!entry->tag) {
+		if(entry->lazy) {
+			entry->tag = entry->lazy->decode();
+			entry->lazy.reset();
+		} else {
+			io::MemoryInputStream s(entry->payload, entry->payload_size);
+			io::ReadOptions options;
+			options.borrow_buffers = true;
+			entry->tag = io::detail::read_payload(s, entry->type, options);
+		}
+		// It can be changed through the pointer from here on, so it's
+		// always written out anew.
+		entry->source = nullptr;
+	}
+	return entry->tag.get();
+}
+
+LazyCompoundTag *LazyCompoundTag::lazy(const Utf8String &name) {
+	Entry *entry = find(name);
+	if(!entry || entry->type != io::TAG_TYPE_COMPOUND) {
+		return nullptr;
+	}
+	if(entry->tag) {
+		throw std::logic_error("LazyCompoundTag::lazy called on a child that has already been decoded.");
+	}
+	if(!entry->lazy) {
+		entry->lazy.reset(new LazyCompoundTag(entry->payload, entry->payload_size));
+	}
+	return entry->lazy.get();
+}
+
+void LazyCompoundTag::set(const Utf8String &name, TagPtr<Tag> &&tag) {
+	if(!tag) {
+		throw std::logic_error("LazyCompoundTag::set called with a null tag.");
+	}
+	Entry *entry = find(name);
+	if(!entry) {
+		m_entries.push_back(Entry());
+		entry = &m_entries.back();
+		// The name passed in may well be borrowed from somewhere short-lived.
+		entry->name = Utf8String(name.data.data(), name.data.size());
+		entry->payload = nullptr;
+		entry->payload_size = 0;
+	}
+	entry->type = tag->type();
+	entry->source = nullptr;
+	entry->source_size = 0;
+	entry->tag = std::move(tag);
+	entry->lazy.reset();
+}
+
+bool LazyCompoundTag::erase(const Utf8String &name) {
+	for(auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+		if(it->name == name) {
+			m_entries.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+TagPtr<CompoundTag> LazyCompoundTag::decode() {
+	TagPtr<CompoundTag> compound(new CompoundTag());
+	for(Entry &entry : m_entries) {
+		get(entry.name);
+		compound->values.insert(CompoundTag::container_type::value_type(entry.name, std::move(entry.tag)));
+	}
+	m_entries.clear();
+	return compound;
+}
+
+void LazyCompoundTag::write(io::OutputStream &s) const {
+	for(const Entry &entry : m_entries) {
+		if(entry.lazy) {
+			io::detail::write_type_and_name(s, io::TAG_TYPE_COMPOUND, entry.name);
+			entry.lazy->write(s);
+		} else if(entry.tag) {
+			io::detail::write_type_and_name(s, entry.tag->type(), entry.name);
+			io::detail::write_tag_payload(s, *entry.tag);
+		} else {
+			s.write_buffered(entry.source, entry.source_size);
+		}
+	}
+	const unsigned char end = io::TAG_TYPE_END;
+	s.write_buffered(&end, 1);
+}
+
+namespace io {
+
+LazyRootTag read_lazy_nbt(const unsigned char *data, size_t size) {
+	if(size < 3) {
+		throw PrematureEof();
+	}
+	if(data[0] != TAG_TYPE_COMPOUND) {
+		throw IoError("read_lazy_nbt needs a document whose root is a compound.");
+	}
+	size_t name_length = (static_cast<size_t>(data[1]) << 8) | data[2];
+	if(size - 3 < name_length) {
+		throw PrematureEof();
+	}
+	LazyRootTag root_tag;
+	root_tag.name = Utf8String::borrow(data + 3, name_length);
+	size_t header_size = 3 + name_length;
+	root_tag.tag.reset(new LazyCompoundTag(data + header_size, size - header_size));
+	return root_tag;
+}
+
+void write_nbt(OutputStream &s, const LazyRootTag &root_tag) {
+	if(!root_tag.tag) {
+		throw std::logic_error("write_nbt was passed a LazyRootTag without a tag.");
+	}
+	detail::write_type_and_name(s, TAG_TYPE_COMPOUND, root_tag.name);
+	root_tag.tag->write(s);
+	s.flush();
+}
+
+}
+}
@@ -0,0 +1,97 @@
+#ifndef NBT_PATH_H
+#define NBT_PATH_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nbt.h"
+
+
+namespace nbt {
+namespace io {
+namespace detail {
+
+	// The keys of a dotted path such as "Level.Sections.Y".
+	typedef std::vector<Utf8String> TagPath;
+
+	// An empty path names the root itself.
+	inline TagPath split_path(const std::string &path) {
+		TagPath names;
+		if(path.empty()) {
+			return names;
+		}
+		size_t start = 0;
+		while(true) {
+			size_t dot = path.find('.', start);
+			size_t end = dot == std::string::npos ? path.size() : dot;
+			names.push_back(Utf8String(reinterpret_cast<const unsigned char *>(path.data()) + start, end - start));
+			if(dot == std::string::npos) {
+				break;
+			}
+			start = dot + 1;
+		}
+		return names;
+	}
+
+	// Whether find_path looks through a list with these elements.
+	inline bool looked_through(TagTypeId element_type) {
+		return element_type == TAG_TYPE_COMPOUND || element_type == TAG_TYPE_LIST;
+	}
+
+	typedef std::vector<std::pair<const Tag *, size_t>> PendingTags;
+
+	/* Calls found(tag) for every tag at `path` under `root`, in document
+	 * order, until it returns true. Lists of compounds and of lists are
+	 * looked through on the way, and if `through_final_lists`, at the end
+	 * too, so that their elements are found rather than the lists. There's
+	 * no recursing, however deep the lists go; `pending` is only scratch
+	 * space, passed in so that it can be reused.
+	 */
+	template<typename F>
+	void find_path(const Tag &root, const TagPath &path, bool through_final_lists, PendingTags &pending, F found) {
+		pending.assign(1, std::make_pair(&root, static_cast<size_t>(0)));
+		while(!pending.empty()) {
+			const Tag *tag = pending.back().first;
+			size_t depth = pending.back().second;
+			pending.pop_back();
+			if(tag->type() == TAG_TYPE_LIST && (depth < path.size() || through_final_lists) &&
+				looked_through(static_cast<const ListTagBase *>(tag)->element_type()))
+			{
+				const ListTagBase *list = static_cast<const ListTagBase *>(tag);
+				// Pushed backwards, to come off the stack in order.
+				if(list->element_type() == TAG_TYPE_COMPOUND) {
+					const auto &values = static_cast<const ListTag<CompoundTag> *>(list)->values;
+					for(size_t i = values.size(); i-- > 0;) {
+						if(values[i]) {
+							pending.push_back(std::make_pair(values[i].get(), depth));
+						}
+					}
+				} else {
+					const auto &values = static_cast<const ListTag<Tag> *>(list)->values;
+					for(size_t i = values.size(); i-- > 0;) {
+						if(values[i]) {
+							pending.push_back(std::make_pair(values[i].get(), depth));
+						}
+					}
+				}
+			} else if(depth == path.size()) {
+				if(found(*tag)) {
+					return;
+				}
+			} else if(tag->type() == TAG_TYPE_COMPOUND) {
+				const CompoundMap &values = static_cast<const CompoundTag *>(tag)->values;
+				auto child = values.find(path[depth]);
+				if(child != values.end() && child->second) {
+					pending.push_back(std::make_pair(child->second.get(), depth + 1));
+				}
+			}
+		}
+	}
+
+}
+}
+}
+
+#endif
@@ -1,7 +1,15 @@
+#include <chrono>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 
+#ifdef NBT_USDT_PROBES
+  #include <sys/sdt.h>
+#endif
+
 #include "nbt.h"
+#include "byteswap.h"
+#include "reader.h"
 
 
 #ifdef __GNUC__
@@ -15,28 +23,295 @@ namespace nbt {
 namespace io {
 namespace detail {
 
-	template<size_t size, typename RT, typename IT>
-	RT twos_complement_decode(IT v) {
-		IT sign_bit = ((IT) 1) << (size * 8 - 1);
-		if (v & sign_bit) {
-			IT abs_value = (~v) + 1;
-			return -((RT) abs_value - 1) - 1;
-		} else {
-			return (RT) v;
+	/* How much a length read from a stream that can't say how much it has
+	 * left is trusted with up front; see plausible_count.
+	 */
+	const size_t UNVOUCHED_BYTES = 1024 * 1024;
+
+	/* Turns the raw, unsigned, big-endian-decoded bits of a value into the
+	 * value itself.
+	 */
+	template<typename T, typename RawType, size_t raw_type_size>
+	struct ValueDecoder {
+		static T decode(RawType v) {
+			return twos_complement_decode<raw_type_size, T, RawType>(v);
+		}
+	};
+
+	// NOTE: These assume your platform has IEEE floats, but that's probably
+	// the case.
+	template<>
+	struct ValueDecoder<float, uint32_t, 4> {
+		static float decode(uint32_t v) {
+			float f;
+			std::memcpy(&f, &v, sizeof(f));
+			return f;
+		}
+	};
+	template<>
+	struct ValueDecoder<double, uint64_t, 8> {
+		static double decode(uint64_t v) {
+			double d;
+			std::memcpy(&d, &v, sizeof(d));
+			return d;
+		}
+	};
+
+	struct SkipFrame {
+		TagTypeId type;
+		TagTypeId element_type;
+		size_t remaining;
+	};
+
+	/* Memory for TagReadStates, which come and go once per compound and
+	 * list. Freed ones go on a free list for their size, for the next one;
+	 * a Reader keeps its pool from one document to the next.
+	 */
+	class StatePool {
+	public:
+		StatePool() : m_arena(4096) {
+			std::fill(m_free, m_free + CLASS_COUNT, nullptr);
+		}
+
+		void *allocate(size_t size) {
+			size_t size_class = (sizeof(Header) + size + GRANULE - 1) / GRANULE;
+			if(size_class >= CLASS_COUNT) {
+				throw std::logic_error("StatePool asked for a state bigger than any there is.");
+			}
+			Header *header = m_free[size_class];
+			if(header) {
+				m_free[size_class] = header->next;
+			} else {
+				header = static_cast<Header *>(m_arena.allocate(size_class * GRANULE, GRANULE));
+			}
+			header->pool = this;
+			header->size_class = size_class;
+			return header + 1;
+		}
+
+		static void release(void *p) {
+			Header *header = static_cast<Header *>(p) - 1;
+			StatePool *pool = header->pool;
+			header->next = pool->m_free[header->size_class];
+			pool->m_free[header->size_class] = header;
+		}
+
+	private:
+		static const size_t GRANULE = 16;
+		static const size_t CLASS_COUNT = 16;
+
+		struct Header {
+			union {
+				StatePool *pool;
+				// Once it's on a free list.
+				Header *next;
+			};
+			size_t size_class;
+		};
+		static_assert(sizeof(Header) == GRANULE, "A StatePool header should take up a granule.");
+
+		Arena m_arena;
+		Header *m_free[CLASS_COUNT];
+	};
+
+	class TagReadState;
+	typedef std::vector<std::unique_ptr<TagReadState>> IoReadState;
+
+	/* What a read leaves behind that the next one can use, if it's given
+	 * the chance: see Reader.
+	 */
+	struct ReadScratch {
+		// First, so it outlives the states in io_state.
+		StatePool states;
+		IoReadState io_state;
+		// For skipping what a projection leaves out.
+		std::vector<SkipFrame> skip_stack;
+		std::vector<unsigned char> name_buffer;
+	};
+
+	/* Thrown by FeedInputStream when it runs out, which only means the
+	 * step it was in the middle of has to wait for more bytes.
+	 */
+	struct NeedMoreInput {};
+
+	/* The bytes fed to an IncrementalReader that it hasn't finished with.
+	 * Every read either finds its bytes all there or throws NeedMoreInput;
+	 * the reader then rewinds to the mark it left after its last complete
+	 * step, and tries that step again once enough bytes have arrived.
+	 */
+	class FeedInputStream : public InputStream {
+	public:
+		FeedInputStream() : m_mark(0), m_wanted(0), m_dropped(0) {}
+
+		virtual void read(unsigned char *UNUSED(data), size_t size) {
+			want(size);
+		}
+
+		virtual void skip(size_t size) {
+			want(size);
+		}
+
+		virtual uint64_t position() const {
+			return m_dropped + offset();
+		}
+
+		/* Adds bytes, dropping the ones before the mark, and rewinds to
+		 * the mark.
+		 */
+		void append(const unsigned char *data, size_t size) {
+			if(m_mark) {
+				m_data.erase(m_data.begin(), m_data.begin() + m_mark);
+				m_dropped += m_mark;
+				m_wanted = m_wanted > m_mark ? m_wanted - m_mark : 0;
+				m_mark = 0;
+			}
+			m_data.insert(m_data.end(), data, data + size);
+			m_buffer_position = m_data.data();
+			m_buffer_end = m_data.data() + m_data.size();
 		}
-	}
 
-	template<typename T, size_t size>
-	T read_big_endian_unsigned_int(InputStream &s) {
-		unsigned char data[size];
-		s.read(data, size);
+		void clear() {
+			m_data.clear();
+			m_buffer_position = m_buffer_end = nullptr;
+			m_mark = m_wanted = m_dropped = 0;
+		}
+
+		void mark() { m_mark = offset(); }
+		void rewind() { m_buffer_position = m_data.data() + m_mark; }
+
+		// Whether the step that last ran out could get further now.
+		bool has_wanted() const { return m_data.size() >= m_wanted; }
+		size_t buffered() const { return m_data.size() - m_mark; }
+
+	private:
+		size_t offset() const { return m_buffer_position - m_data.data(); }
+
+		void want(size_t size) {
+			m_wanted = offset() + size;
+			throw NeedMoreInput();
+		}
+
+		std::vector<unsigned char> m_data;
+		size_t m_mark;
+		// The size m_data needs to be for the step that ran out.
+		size_t m_wanted;
+		// How many bytes have been dropped from the front of m_data.
+		uint64_t m_dropped;
+	};
 
-		T n = 0;
-		for(size_t i = 0; i < size; ++i) {
-			n = (n << 8) | static_cast<T>(data[i]);
+	/* Everything a read needs to carry around besides the state stack. */
+	class ReadContext {
+	public:
+		ReadContext(InputStream &p_stream, const ReadOptions &p_options, ReadScratch &p_scratch,
+			ReadStats *p_stats = nullptr) :
+			stream(p_stream), options(p_options), stats(p_stats), feed(nullptr), states(p_scratch.states),
+			io_state(p_scratch.io_state), skip_stack(p_scratch.skip_stack), name_buffer(p_scratch.name_buffer)
+		{
+			start_document();
 		}
 
-		return n;
+		// Where ReadLimits::max_bytes counts from.
+		void start_document() {
+			if(options.limits.max_bytes) {
+				start = stream.position();
+				if(start == InputStream::UNKNOWN_POSITION) {
+					throw std::invalid_argument("ReadLimits::max_bytes needs a stream that knows its position.");
+				}
+			}
+		}
+
+		/* The limits, for a list or array of `count` elements of at least
+		 * `min_size` bytes each that's about to be read.
+		 */
+		void check_length(uint64_t count, size_t min_size) {
+			if(options.limits.max_length && count > options.limits.max_length) {
+				throw IoError("NBT list or array is longer than ReadLimits::max_length allows.");
+			}
+			check_bytes(count * min_size);
+		}
+
+		// That `size` more bytes wouldn't take the document past max_bytes.
+		void check_bytes(uint64_t size) {
+			uint64_t max_bytes = options.limits.max_bytes;
+			if(max_bytes) {
+				uint64_t read = stream.position() - start;
+				if(read > max_bytes || size > max_bytes - read) {
+					throw IoError("NBT document is bigger than ReadLimits::max_bytes allows.");
+				}
+			}
+		}
+
+		// For a compound or list about to be read at `depth`.
+		void check_depth(size_t depth) {
+			if(options.limits.max_depth && depth > options.limits.max_depth) {
+				throw IoError("NBT document is nested deeper than ReadLimits::max_depth allows.");
+			}
+		}
+
+		/* Lets an IncrementalReader know that what has been read so far
+		 * won't need reading again, for states that read several tags in
+		 * one go.
+		 */
+		void commit() {
+			if(feed) {
+				feed->mark();
+			}
+		}
+
+		/* Allocates a tag from the arena, if we have one. */
+		template<typename T, typename... Args>
+		TagPtr<T> new_tag(Args&&... args) {
+			TagPtr<T> tag;
+			if(options.arena) {
+				tag = TagPtr<T>(options.arena->create<T>(std::forward<Args>(args)...));
+			} else {
+				tag = TagPtr<T>(new T(std::forward<Args>(args)...));
+			}
+			if(stats) {
+				++stats->tags[tag->type()];
+				++stats->allocations;
+			}
+			return tag;
+		}
+
+		void count_allocation() {
+			if(stats) {
+				++stats->allocations;
+			}
+		}
+
+		InputStream &stream;
+		const ReadOptions &options;
+		// The stats for this document alone, if we're keeping any.
+		ReadStats *stats;
+		// Set when reading for an IncrementalReader.
+		FeedInputStream *feed;
+		StatePool &states;
+		IoReadState &io_state;
+		std::vector<SkipFrame> &skip_stack;
+		std::vector<unsigned char> &name_buffer;
+		uint64_t start;
+	};
+
+	/* Reads `count` packed values straight into `values`, byte swapping
+	 * them in place. The count is checked against ReadLimits::max_length
+	 * first, and read_packed_vector only sizes `values` for all of it up
+	 * front if the stream vouches for that many bytes; otherwise it grows
+	 * a megabyte at a time as they turn up, so a lying length can't make
+	 * the read allocate more than the document holds.
+	 *
+	 * Unlike ValueDecoder, this takes the swapped bits as they are, which
+	 * assumes two's complement integers and IEEE floats. That's everything
+	 * we'll ever run on.
+	 */
+	template<typename T, size_t raw_type_size, typename Container>
+	void read_packed_values(ReadContext &ctx, Container &values, size_t count) {
+		static_assert(sizeof(T) == raw_type_size, "Packed values must be the same size on disk as in memory.");
+		if(count > SIZE_MAX / raw_type_size) {
+			throw IoError("Packed NBT payload too large.");
+		}
+		ctx.check_length(count, raw_type_size);
+		read_packed_vector(ctx.stream, values, count, raw_type_size);
 	}
 
 	template<typename TagType, typename RawType, size_t raw_type_size>
@@ -48,102 +323,327 @@ namespace detail {
 		return TagType(value);
 	}
 
-	ByteArrayTag read_byte_array_tag(InputStream &s) {
-		uint32_t length = read_big_endian_unsigned_int<uint32_t, 4>(s);
+	/* Reads `length` bytes, borrowing them from the stream if we've been
+	 * asked to and the stream is able to.
+	 */
+	Array<unsigned char> read_bytes(ReadContext &ctx, size_t length) {
+		ctx.check_bytes(length);
+		if(ctx.options.borrow_buffers) {
+			const unsigned char *lent = ctx.stream.lend(length);
+			if(lent) {
+				return Array<unsigned char>::borrow(lent, length);
+			}
+		}
+		if(length > Array<unsigned char>::INLINE_CAPACITY) {
+			ctx.count_allocation();
+		}
+		// Short ones fit inside the Array, which beats even the arena.
+		if(ctx.options.arena && length > Array<unsigned char>::INLINE_CAPACITY) {
+			unsigned char *bytes = static_cast<unsigned char *>(ctx.options.arena->allocate(length, 1));
+			ctx.stream.read_buffered(bytes, length);
+			return Array<unsigned char>::borrow(bytes, length);
+		}
+		Array<unsigned char> bytes;
+		ctx.stream.read_buffered(bytes.assign_uninitialized(length), length);
+		return bytes;
+	}
+
+	nbt::Utf8String keep_string(ReadContext &ctx, const Utf8String &transient, bool lent);
+
+	ByteArrayTag read_byte_array_tag(ReadContext &ctx) {
+		uint32_t length = read_big_endian_unsigned_int<uint32_t, 4>(ctx.stream);
+		ctx.check_length(length, 1);
 		ByteArrayTag tag;
-		tag.value.resize(length);
-		s.read(&tag.value[0], length);
+		if(plausible_count(ctx.stream, length, 1, 1) == length) {
+			tag.value = read_bytes(ctx, length);
+		} else {
+			// Not having taken the length's word for it, this reads into
+			// a vector that grows as the bytes turn up, and copies that.
+			std::vector<unsigned char> bytes;
+			read_packed_vector(ctx.stream, bytes, length, 1);
+			tag.value = keep_string(ctx, Utf8String::borrow(bytes.data(), bytes.size()), false).data;
+		}
 		return tag;
 	}
 
-	IntArrayTag read_int_array_tag(InputStream &s) {
-		uint32_t length = read_big_endian_unsigned_int<uint32_t, 4>(s);
-		IntArrayTag tag;
-		tag.values.reserve(length);
-		for(uint32_t idx = 0; idx < length; ++idx) {
-			uint32_t encoded_int = read_big_endian_unsigned_int<uint32_t, 4>(s);
-			int32_t decoded_int = twos_complement_decode<4, uint32_t, int32_t>(encoded_int);
-			tag.values.push_back(decoded_int);
+	IntArrayTag read_int_array_tag(ReadContext &ctx) {
+		uint32_t length = read_big_endian_unsigned_int<uint32_t, 4>(ctx.stream);
+		IntArrayTag tag(ctx.options.arena);
+		if(length) {
+			ctx.count_allocation();
 		}
+		read_packed_values<int32_t, 4>(ctx, tag.values, length);
 		return tag;
 	}
 
-	template<typename FloatTagType>
-	FloatTagType read_float_tag(InputStream &s) {
-		FloatTagType tag;
-		// NOTE: We don't have a good IEEE float decoder. This will only work
-		// if your platform has IEEE floats, but that's probably the case.
-		s.read(reinterpret_cast<unsigned char *>(&tag.value), sizeof(tag.value));
+	LongArrayTag read_long_array_tag(ReadContext &ctx) {
+		uint32_t length = read_big_endian_unsigned_int<uint32_t, 4>(ctx.stream);
+		LongArrayTag tag(ctx.options.arena);
+		if(length) {
+			ctx.count_allocation();
+		}
+		read_packed_values<int64_t, 8>(ctx, tag.values, length);
 		return tag;
 	}
 
-	nbt::Utf8String read_string(InputStream &s) {
-		uint16_t string_length = read_big_endian_unsigned_int<uint16_t, 2>(s);
+	template<typename FloatTagType, typename RawType>
+	FloatTagType read_float_tag(InputStream &s) {
+		typedef typename FloatTagType::value_type value_type;
+		RawType raw = read_big_endian_unsigned_int<RawType, sizeof(RawType)>(s);
+		return FloatTagType(ValueDecoder<value_type, RawType, sizeof(RawType)>::decode(raw));
+	}
+
+	nbt::Utf8String read_string(ReadContext &ctx) {
+		uint16_t string_length = read_big_endian_unsigned_int<uint16_t, 2>(ctx.stream);
 		Utf8String string;
-		string.data.resize(string_length);
-		s.read(&string.data[0], string_length);
+		string.data = read_bytes(ctx, string_length);
 		return string;
 	}
 
-	StringTag read_string_tag(InputStream &s) {
+	/* Reads a string that's only needed for a moment: it's borrowed from the
+	 * stream if possible, and otherwise read into ctx.name_buffer, and only
+	 * good until the next read either way. keep_string makes it last.
+	 */
+	nbt::Utf8String read_transient_string(ReadContext &ctx, bool &lent) {
+		uint16_t string_length = read_big_endian_unsigned_int<uint16_t, 2>(ctx.stream);
+		const unsigned char *data = ctx.stream.lend(string_length);
+		lent = data != nullptr;
+		if(!lent) {
+			if(ctx.name_buffer.size() < string_length) {
+				ctx.name_buffer.resize(string_length);
+			}
+			data = ctx.name_buffer.data();
+			ctx.stream.read_buffered(ctx.name_buffer.data(), string_length);
+		}
+		return Utf8String::borrow(data, string_length);
+	}
+
+	nbt::Utf8String keep_string(ReadContext &ctx, const Utf8String &transient, bool lent) {
+		const unsigned char *data = transient.data.data();
+		size_t length = transient.data.size();
+		if(lent && ctx.options.borrow_buffers) {
+			return transient;
+		}
+		if(length > Array<unsigned char>::INLINE_CAPACITY) {
+			ctx.count_allocation();
+		}
+		if(ctx.options.arena && length > Array<unsigned char>::INLINE_CAPACITY) {
+			unsigned char *bytes = static_cast<unsigned char *>(ctx.options.arena->allocate(length, 1));
+			std::copy(data, data + length, bytes);
+			return Utf8String::borrow(bytes, length);
+		}
+		return Utf8String(data, length);
+	}
+
+	/* The name of a compound's child, interned if we've been given a
+	 * NameTable.
+	 */
+	nbt::Utf8String keep_name(ReadContext &ctx, const Utf8String &transient, bool lent) {
+		if(ctx.options.names) {
+			Utf8String name;
+			if(ctx.options.names->intern(transient.data.data(), transient.data.size(), name)) {
+				return name;
+			}
+		}
+		return keep_string(ctx, transient, lent);
+	}
+
+	nbt::Utf8String read_name(ReadContext &ctx) {
+		if(!ctx.options.names) {
+			return read_string(ctx);
+		}
+		bool lent;
+		Utf8String name = read_transient_string(ctx, lent);
+		return keep_name(ctx, name, lent);
+	}
+
+	StringTag read_string_tag(ReadContext &ctx) {
 		StringTag tag;
-		tag.value = read_string(s);
+		tag.value = read_string(ctx);
 		return tag;
 	}
 
-	std::unique_ptr<Tag> read_simple_tag(InputStream &s, TagTypeId tag_type) {
+	TagPtr<Tag> read_simple_tag(ReadContext &ctx, TagTypeId tag_type) {
+		InputStream &s = ctx.stream;
 		switch(tag_type) {
 			case TAG_TYPE_BYTE:
-				return std::unique_ptr<Tag>(new ByteTag(read_simple_payload<ByteTag, uint8_t, 1>(s)));
+				return ctx.new_tag<ByteTag>(read_simple_payload<ByteTag, uint8_t, 1>(s));
 			case TAG_TYPE_SHORT:
-				return std::unique_ptr<Tag>(new ShortTag(read_simple_payload<ShortTag, uint16_t, 2>(s)));
+				return ctx.new_tag<ShortTag>(read_simple_payload<ShortTag, uint16_t, 2>(s));
 			case TAG_TYPE_INT:
-				return std::unique_ptr<Tag>(new IntTag(read_simple_payload<IntTag, uint32_t, 4>(s)));
+				return ctx.new_tag<IntTag>(read_simple_payload<IntTag, uint32_t, 4>(s));
 			case TAG_TYPE_LONG:
-				return std::unique_ptr<Tag>(new LongTag(read_simple_payload<LongTag, uint64_t, 8>(s)));
+				return ctx.new_tag<LongTag>(read_simple_payload<LongTag, uint64_t, 8>(s));
 			case TAG_TYPE_FLOAT:
-				return std::unique_ptr<Tag>(new FloatTag(read_float_tag<FloatTag>(s)));
+				return ctx.new_tag<FloatTag>(read_float_tag<FloatTag, uint32_t>(s));
 			case TAG_TYPE_DOUBLE:
-				return std::unique_ptr<Tag>(new DoubleTag(read_float_tag<DoubleTag>(s)));
+				return ctx.new_tag<DoubleTag>(read_float_tag<DoubleTag, uint64_t>(s));
 			case TAG_TYPE_BYTE_ARRAY:
-				return std::unique_ptr<Tag>(new ByteArrayTag(read_byte_array_tag(s)));
+				return ctx.new_tag<ByteArrayTag>(read_byte_array_tag(ctx));
 			case TAG_TYPE_STRING:
-				return std::unique_ptr<Tag>(new StringTag(read_string_tag(s)));
+				return ctx.new_tag<StringTag>(read_string_tag(ctx));
 			case TAG_TYPE_LIST:
 				throw std::logic_error("read_simple_tag should not be called for TAG_TYPE_LIST.");
 			case TAG_TYPE_COMPOUND:
 				throw std::logic_error("read_simple_tag should not be called for TAG_TYPE_COMPOUND.");
 			case TAG_TYPE_INT_ARRAY:
-				return std::unique_ptr<Tag>(new IntArrayTag(read_int_array_tag(s)));
+				return ctx.new_tag<IntArrayTag>(read_int_array_tag(ctx));
+			case TAG_TYPE_LONG_ARRAY:
+				return ctx.new_tag<LongArrayTag>(read_long_array_tag(ctx));
 			default:
 				throw IoError(std::string("Unknown tag type in NBT: ") + std::to_string(tag_type));
 		}
 	}
 
-	class TagReadState;
-	typedef std::vector<std::unique_ptr<TagReadState>> IoReadState;
+	/* The size of a payload that's the same size every time, or 0 for the
+	 * others.
+	 */
+	size_t fixed_payload_size(TagTypeId tag_type) {
+		switch(tag_type) {
+			case TAG_TYPE_BYTE:
+				return 1;
+			case TAG_TYPE_SHORT:
+				return 2;
+			case TAG_TYPE_INT:
+			case TAG_TYPE_FLOAT:
+				return 4;
+			case TAG_TYPE_LONG:
+			case TAG_TYPE_DOUBLE:
+				return 8;
+			default:
+				return 0;
+		}
+	}
+
+	size_t array_element_size(TagTypeId tag_type) {
+		switch(tag_type) {
+			case TAG_TYPE_BYTE_ARRAY:
+				return 1;
+			case TAG_TYPE_INT_ARRAY:
+				return 4;
+			case TAG_TYPE_LONG_ARRAY:
+				return 8;
+			default:
+				return 0;
+		}
+	}
+
+	/* Begins skipping a compound or list, whose header (if any) has yet to
+	 * be read.
+	 */
+	template<typename Frame>
+	void push_skip_frame(InputStream &s, std::vector<Frame> &stack, TagTypeId tag_type) {
+		Frame frame = {tag_type, TAG_TYPE_END, 0};
+		if(tag_type == TAG_TYPE_LIST) {
+			frame.element_type = read_big_endian_unsigned_int<unsigned char, 1>(s);
+			frame.remaining = read_big_endian_unsigned_int<uint32_t, 4>(s);
+		}
+		stack.push_back(frame);
+	}
+
+	/* Skips a value's payload, or for compounds and lists, pushes a frame
+	 * for skip_nested to carry on with.
+	 */
+	template<typename Frame>
+	void skip_value(InputStream &s, std::vector<Frame> &stack, TagTypeId tag_type) {
+		size_t fixed_size = fixed_payload_size(tag_type);
+		size_t element_size = array_element_size(tag_type);
+		if(fixed_size) {
+			s.skip_buffered(fixed_size);
+		} else if(element_size) {
+			size_t length = read_big_endian_unsigned_int<uint32_t, 4>(s);
+			s.skip_buffered(length * element_size);
+		} else if(tag_type == TAG_TYPE_STRING) {
+			s.skip_buffered(read_big_endian_unsigned_int<uint16_t, 2>(s));
+		} else if(tag_type == TAG_TYPE_LIST || tag_type == TAG_TYPE_COMPOUND) {
+			push_skip_frame(s, stack, tag_type);
+		} else {
+			throw IoError(std::string("Unknown tag type in NBT: ") + std::to_string(tag_type));
+		}
+	}
+
+	/* Skips over what's left of the compounds and lists on `stack` above
+	 * `target_depth`, innermost first, without decoding any of it. Frame is
+	 * anything with type, element_type and remaining members.
+	 */
+	template<typename Frame>
+	void skip_nested(InputStream &s, std::vector<Frame> &stack, size_t target_depth) {
+		while(stack.size() > target_depth) {
+			Frame &frame = stack.back();
+			TagTypeId tag_type;
+			if(frame.type == TAG_TYPE_COMPOUND) {
+				tag_type = read_big_endian_unsigned_int<unsigned char, 1>(s);
+				if(tag_type == TAG_TYPE_END) {
+					stack.pop_back();
+					continue;
+				}
+				s.skip_buffered(read_big_endian_unsigned_int<uint16_t, 2>(s));
+			} else {
+				if(frame.remaining == 0) {
+					stack.pop_back();
+					continue;
+				}
+				tag_type = frame.element_type;
+				size_t fixed_size = fixed_payload_size(tag_type);
+				if(fixed_size) {
+					// Skip the whole list at once.
+					if(frame.remaining > SIZE_MAX / fixed_size) {
+						throw IoError("List tag too large to skip.");
+					}
+					s.skip_buffered(frame.remaining * fixed_size);
+					frame.remaining = 0;
+					continue;
+				}
+				--frame.remaining;
+			}
+
+			skip_value(s, stack, tag_type);
+		}
+	}
+
+	/* Skips a whole payload of the given type. `stack` is scratch space,
+	 * kept by the caller so it needn't be allocated every time.
+	 */
+	void skip_payload(InputStream &s, TagTypeId tag_type, std::vector<SkipFrame> &stack) {
+		stack.clear();
+		skip_value(s, stack, tag_type);
+		skip_nested(s, stack, 0);
+	}
+
 	class TagReadState {
 	public:
+		// States are made with new (ctx.states), and deleted as usual.
+		static void *operator new(size_t size, StatePool &pool) {
+			return pool.allocate(size);
+		}
+		// For when a constructor throws.
+		static void operator delete(void *p, StatePool &UNUSED(pool)) {
+			StatePool::release(p);
+		}
+		static void operator delete(void *p) {
+			StatePool::release(p);
+		}
+
 		virtual ~TagReadState() {};
-		virtual void continue_read(InputStream &s, IoReadState &io_state) = 0;
-		virtual void add_tag(std::unique_ptr<Tag> &&tag) = 0;
+		virtual void continue_read(ReadContext &ctx, IoReadState &io_state) = 0;
+		virtual void add_tag(TagPtr<Tag> &&tag) = 0;
 	protected:
-		void finish_tag(std::unique_ptr<Tag> &&tag, IoReadState &io_state) {
+		void finish_tag(TagPtr<Tag> &&tag, IoReadState &io_state) {
 			io_state[io_state.size() - 2]->add_tag(std::move(tag));
 			io_state.pop_back();
 			return;
 		}
 	};
 
-	std::unique_ptr<TagReadState> new_read_state_for(InputStream &s, TagTypeId tag_type);
+	std::unique_ptr<TagReadState> new_read_state_for(ReadContext &ctx, TagTypeId tag_type, size_t node);
 
 	class ReadRootTagState : public TagReadState {
 	public:
 		ReadRootTagState(RootTag &tag) : m_root_tag(tag) {}
-		void continue_read(InputStream &UNUSED(s), IoReadState &io_state) {
+		void continue_read(ReadContext &UNUSED(ctx), IoReadState &io_state) {
 			io_state.pop_back();
 		}
-		void add_tag(std::unique_ptr<Tag> &&tag) {
+		void add_tag(TagPtr<Tag> &&tag) {
 			m_root_tag.tag = std::move(tag);
 		}
 	private:
@@ -152,119 +652,183 @@ namespace detail {
 
 	class ReadCompoundTagState : public TagReadState {
 	public:
-		ReadCompoundTagState() : m_tag(new CompoundTag()) {}
+		/* `node` is where we are in ReadOptions::projection, if there is
+		 * one; Projection::EVERYTHING if not.
+		 */
+		ReadCompoundTagState(ReadContext &ctx, size_t node) :
+			m_tag(ctx.new_tag<CompoundTag>(ctx.options.arena)), m_node(node) {}
 
-		void continue_read(InputStream &s, IoReadState &io_state) {
-			TagTypeId tag_type_id = detail::read_big_endian_unsigned_int<unsigned char, 1>(s);
+		void continue_read(ReadContext &ctx, IoReadState &io_state) {
+			// Numbers are read without any other check on the way.
+			ctx.check_bytes(0);
+			TagTypeId tag_type_id = detail::read_big_endian_unsigned_int<unsigned char, 1>(ctx.stream);
 			if(tag_type_id == TAG_TYPE_END) {
 				finish_tag(std::move(m_tag), io_state);
 				return;
 			}
-			m_next_tag_name = read_string(s);
+			size_t child = Projection::EVERYTHING;
+			if(m_node == Projection::EVERYTHING) {
+				m_next_tag_name = read_name(ctx);
+			} else {
+				// Don't copy the names of things we're about to skip.
+				bool lent;
+				Utf8String name = read_transient_string(ctx, lent);
+				child = ctx.options.projection->child(m_node, name);
+				if(child == Projection::NOTHING) {
+					skip_payload(ctx.stream, tag_type_id, ctx.skip_stack);
+					return;
+				}
+				m_next_tag_name = keep_name(ctx, name, lent);
+			}
 			if(tag_type_id == TAG_TYPE_COMPOUND || tag_type_id == TAG_TYPE_LIST) {
-				io_state.push_back(new_read_state_for(s, tag_type_id));
+				io_state.push_back(new_read_state_for(ctx, tag_type_id, child));
 			} else {
-				std::unique_ptr<Tag> tag = read_simple_tag(s, tag_type_id);
-				m_tag->values.insert(std::pair<Utf8String, std::unique_ptr<Tag>>(m_next_tag_name, std::move(tag)));
+				TagPtr<Tag> tag = read_simple_tag(ctx, tag_type_id);
+				m_tag->values.insert(CompoundTag::container_type::value_type(std::move(m_next_tag_name), std::move(tag)));
 			}
 		}
 
-		void add_tag(std::unique_ptr<Tag> &&tag) {
+		void add_tag(TagPtr<Tag> &&tag) {
 			m_tag->values.insert(
-				std::pair<Utf8String, std::unique_ptr<Tag>>(
-					m_next_tag_name, std::move(tag)));
+				CompoundTag::container_type::value_type(
+					std::move(m_next_tag_name), std::move(tag)));
 		}
 	private:
-		std::unique_ptr<CompoundTag> m_tag;
+		TagPtr<CompoundTag> m_tag;
+		size_t m_node;
 		Utf8String m_next_tag_name;
 	};
 
 	template<typename T>
 	class ReadListTagState : public TagReadState {
 	public:
-		ReadListTagState(TagTypeId type_id, size_t reads) :
+		ReadListTagState(ReadContext &ctx, TagTypeId type_id, size_t reads, size_t node) :
 			m_type_id(type_id),
-			m_list_tag(new ListTag<T>()),
-			m_remaining_reads(reads)
-		{}
+			m_list_tag(ctx.new_tag<ListTag<T>>(ctx.options.arena, type_id)),
+			m_remaining_reads(reads),
+			m_node(node)
+		{
+			m_list_tag->values.reserve(plausible_count(ctx.stream, reads, min_payload_size(type_id), sizeof(TagPtr<T>)));
+		}
 
-		void continue_read(InputStream &s, IoReadState &io_state) {
+		void continue_read(ReadContext &ctx, IoReadState &io_state) {
 			if(m_type_id == TAG_TYPE_COMPOUND || m_type_id == TAG_TYPE_LIST) {
 				if(m_remaining_reads == 0) {
 					finish_tag(std::move(m_list_tag), io_state);
 				} else {
-					io_state.push_back(new_read_state_for(s, m_type_id));
+					io_state.push_back(new_read_state_for(ctx, m_type_id, m_node));
 					--m_remaining_reads;
 				}
 			} else {
 				// Just read everything in one pass.
-				for(size_t idx = 0; idx < m_remaining_reads; ++idx) {
-					add_tag(read_simple_tag(s, m_type_id));
+				while(m_remaining_reads) {
+					add_tag(read_simple_tag(ctx, m_type_id));
+					--m_remaining_reads;
+					ctx.commit();
 				}
 				finish_tag(std::move(m_list_tag), io_state);
 			}
 		}
 
-		void add_tag(std::unique_ptr<Tag> &&tag) {
-			T *real_ptr = dynamic_cast<T *>(tag.get());
-			if(real_ptr == nullptr) {
+		void add_tag(TagPtr<Tag> &&tag) {
+			if(tag->type() != ListElementTypeOf<T>::value) {
 				throw std::logic_error("add_tag called on ReadListTagState with a tag of a type different than the list.");
 			} else {
-				std::unique_ptr<T> wrapped_ptr = std::unique_ptr<T>(real_ptr);
-				tag.release();
+				TagPtr<T> wrapped_ptr = TagPtr<T>(static_cast<T *>(tag.release()));
 				add_typed_tag(std::move(wrapped_ptr));
 			}
 		}
 
 	private:
-		void add_typed_tag(std::unique_ptr<T> &&tag) {
+		void add_typed_tag(TagPtr<T> &&tag) {
 			m_list_tag->values.push_back(std::move(tag));
 		}
 
 		TagTypeId m_type_id;
-		std::unique_ptr<ListTag<T>> m_list_tag;
+		TagPtr<ListTag<T>> m_list_tag;
 		size_t m_remaining_reads;
+		// Lists are looked through by projections, so this is passed on as is.
+		size_t m_node;
+	};
+
+	/* Lists of numbers don't need a tag per element; they're read in a single
+	 * pass, straight into the list's packed storage.
+	 */
+	template<typename T, size_t raw_type_size>
+	class ReadPackedListTagState : public TagReadState {
+	public:
+		ReadPackedListTagState(ReadContext &ctx, size_t length) :
+			m_list_tag(ctx.new_tag<ListTag<BasicTag<T>>>(ctx.options.arena)),
+			m_length(length)
+		{}
+
+		void continue_read(ReadContext &ctx, IoReadState &io_state) {
+			if(ctx.stats && m_length) {
+				ctx.stats->tags[BasicTagTypeOf<T>::value] += m_length;
+				++ctx.stats->allocations;
+			}
+			read_packed_values<T, raw_type_size>(ctx, m_list_tag->values, m_length);
+			finish_tag(std::move(m_list_tag), io_state);
+		}
+
+		void add_tag(TagPtr<Tag> &&UNUSED(tag)) {
+			throw std::logic_error("add_tag should not be called on ReadPackedListTagState.");
+		}
+
+	private:
+		TagPtr<ListTag<BasicTag<T>>> m_list_tag;
+		size_t m_length;
 	};
 
-	TagReadState *new_list_read_state(TagTypeId inner_tag_type, size_t length) {
+	TagReadState *new_list_read_state(ReadContext &ctx, TagTypeId inner_tag_type, size_t length, size_t node) {
 		switch(inner_tag_type) {
 			case TAG_TYPE_END:
+				// Minecraft writes empty lists this way.
+				if(length == 0) {
+					return new (ctx.states) ReadListTagState<Tag>(ctx, inner_tag_type, length, node);
+				}
 				throw IoError("List tag had a tag type of \"TAG_End\".");
 			case TAG_TYPE_BYTE:
-				return new ReadListTagState<ByteTag>(inner_tag_type, length);
+				return new (ctx.states) ReadPackedListTagState<int8_t, 1>(ctx, length);
 			case TAG_TYPE_SHORT:
-				return new ReadListTagState<ShortTag>(inner_tag_type, length);
+				return new (ctx.states) ReadPackedListTagState<int16_t, 2>(ctx, length);
 			case TAG_TYPE_INT:
-				return new ReadListTagState<IntTag>(inner_tag_type, length);
+				return new (ctx.states) ReadPackedListTagState<int32_t, 4>(ctx, length);
 			case TAG_TYPE_LONG:
-				return new ReadListTagState<LongTag>(inner_tag_type, length);
+				return new (ctx.states) ReadPackedListTagState<int64_t, 8>(ctx, length);
 			case TAG_TYPE_FLOAT:
-				return new ReadListTagState<FloatTag>(inner_tag_type, length);
+				return new (ctx.states) ReadPackedListTagState<float, 4>(ctx, length);
 			case TAG_TYPE_DOUBLE:
-				return new ReadListTagState<DoubleTag>(inner_tag_type, length);
+				return new (ctx.states) ReadPackedListTagState<double, 8>(ctx, length);
 			case TAG_TYPE_BYTE_ARRAY:
-				return new ReadListTagState<ByteArrayTag>(inner_tag_type, length);
+				return new (ctx.states) ReadListTagState<ByteArrayTag>(ctx, inner_tag_type, length, node);
 			case TAG_TYPE_STRING:
-				return new ReadListTagState<StringTag>(inner_tag_type, length);
+				return new (ctx.states) ReadListTagState<StringTag>(ctx, inner_tag_type, length, node);
 			case TAG_TYPE_LIST:
 				// We don't have just a "List" type.
-				return new ReadListTagState<Tag>(inner_tag_type, length);
+				return new (ctx.states) ReadListTagState<Tag>(ctx, inner_tag_type, length, node);
 			case TAG_TYPE_COMPOUND:
-				return new ReadListTagState<CompoundTag>(inner_tag_type, length);
+				return new (ctx.states) ReadListTagState<CompoundTag>(ctx, inner_tag_type, length, node);
 			case TAG_TYPE_INT_ARRAY:
-				return new ReadListTagState<IntArrayTag>(inner_tag_type, length);
+				return new (ctx.states) ReadListTagState<IntArrayTag>(ctx, inner_tag_type, length, node);
+			case TAG_TYPE_LONG_ARRAY:
+				return new (ctx.states) ReadListTagState<LongArrayTag>(ctx, inner_tag_type, length, node);
 			default:
 				throw IoError(std::string("Unknown tag type in NBT for list: ") + std::to_string(inner_tag_type));
 		}
 	}
 
-	std::unique_ptr<TagReadState> new_read_state_for(InputStream &s, TagTypeId tag_type) {
+	std::unique_ptr<TagReadState> new_read_state_for(ReadContext &ctx, TagTypeId tag_type, size_t node) {
+		// The root's state is only a holder, and IncrementalReader doesn't
+		// push it until it has the root's.
+		ctx.check_depth(std::max<size_t>(ctx.io_state.size(), 1));
 		if(tag_type == TAG_TYPE_COMPOUND) {
-			return std::unique_ptr<TagReadState>(new ReadCompoundTagState());
+			return std::unique_ptr<TagReadState>(new (ctx.states) ReadCompoundTagState(ctx, node));
 		} else if(tag_type == TAG_TYPE_LIST) {
-			TagTypeId inner_tag_type = read_big_endian_unsigned_int<unsigned char, 1>(s);
-			size_t length = read_big_endian_unsigned_int<uint32_t, 4>(s);
-			return std::unique_ptr<TagReadState>(new_list_read_state(inner_tag_type, length));
+			TagTypeId inner_tag_type = read_big_endian_unsigned_int<unsigned char, 1>(ctx.stream);
+			size_t length = read_big_endian_unsigned_int<uint32_t, 4>(ctx.stream);
+			ctx.check_length(length, min_payload_size(inner_tag_type));
+			return std::unique_ptr<TagReadState>(new_list_read_state(ctx, inner_tag_type, length, node));
 		} else {
 			throw std::logic_error(
 				"new_read_state_for should not be called except for tags of"
@@ -272,25 +836,657 @@ namespace detail {
 		}
 	}
 
-	void process_read_state(InputStream &s, IoReadState &io_state) {
+	void process_read_state(ReadContext &ctx, IoReadState &io_state) {
 		while(!io_state.empty()) {
-			io_state[io_state.size() - 1]->continue_read(s, io_state);
+			// Not counting the root's state, which is only a holder.
+			if(ctx.stats && io_state.size() - 1 > ctx.stats->max_depth) {
+				ctx.stats->max_depth = io_state.size() - 1;
+			}
+			io_state[io_state.size() - 1]->continue_read(ctx, io_state);
+		}
+	}
+
+	/* Reads everything about a tag but its type and name. */
+	TagPtr<Tag> read_payload(ReadContext &ctx, TagTypeId tag_type, size_t node) {
+		if(tag_type != TAG_TYPE_LIST && tag_type != TAG_TYPE_COMPOUND) {
+			return read_simple_tag(ctx, tag_type);
 		}
+		RootTag holder;
+		IoReadState &io_state = ctx.io_state;
+		// If the read throws, the states it leaves go now, before anything
+		// they point into (such as an arena) does.
+		struct Clear {
+			IoReadState &io_state;
+			~Clear() { io_state.clear(); }
+		} clear = {io_state};
+		io_state.push_back(std::unique_ptr<TagReadState>(new (ctx.states) ReadRootTagState(holder)));
+		io_state.push_back(new_read_state_for(ctx, tag_type, node));
+		process_read_state(ctx, io_state);
+		return std::move(holder.tag);
+	}
+
+}
+
+const size_t Projection::EVERYTHING;
+const size_t Projection::NOTHING;
+
+void Projection::add(const std::string &path) {
+	std::vector<std::string> names;
+	size_t start = 0;
+	while(true) {
+		size_t dot = path.find('.', start);
+		names.push_back(path.substr(start, dot == std::string::npos ? std::string::npos : dot - start));
+		if(dot == std::string::npos) {
+			break;
+		}
+		start = dot + 1;
+	}
+	add(names);
+}
+
+void Projection::add(const std::vector<std::string> &path) {
+	size_t node = 0;
+	for(const std::string &name_string : path) {
+		Utf8String name(reinterpret_cast<const unsigned char *>(name_string.data()), name_string.size());
+		size_t next = NOTHING;
+		for(const auto &entry : m_nodes[node].children) {
+			if(entry.first == name) {
+				next = entry.second;
+				break;
+			}
+		}
+		if(next == NOTHING) {
+			next = m_nodes.size();
+			m_nodes[node].children.push_back(std::make_pair(name, next));
+			m_nodes.push_back(Node());
+		}
+		node = next;
+	}
+	m_nodes[node].whole = true;
+}
+
+size_t Projection::child(size_t node, const Utf8String &name) const {
+	if(node == EVERYTHING || m_nodes[node].whole) {
+		return EVERYTHING;
+	}
+	for(const auto &entry : m_nodes[node].children) {
+		if(entry.first == name) {
+			return m_nodes[entry.second].whole ? EVERYTHING : entry.second;
+		}
+	}
+	return NOTHING;
+}
+
+void ReadStats::reset() {
+	documents = 0;
+	failures = 0;
+	std::fill(tags, tags + TAG_TYPE_LONG_ARRAY + 1, 0);
+	bytes_read = 0;
+	max_depth = 0;
+	allocations = 0;
+	stream_nanoseconds = 0;
+	total_nanoseconds = 0;
+}
+
+void ReadStats::add(const ReadStats &other) {
+	documents += other.documents;
+	failures += other.failures;
+	for(size_t i = 0; i <= TAG_TYPE_LONG_ARRAY; ++i) {
+		tags[i] += other.tags[i];
+	}
+	bytes_read += other.bytes_read;
+	max_depth = std::max(max_depth, other.max_depth);
+	allocations += other.allocations;
+	stream_nanoseconds += other.stream_nanoseconds;
+	total_nanoseconds += other.total_nanoseconds;
+}
+
+namespace detail {
+	uint64_t nanoseconds_since(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/* Stands in for a stream while we keep stats, to count what's read from
+	 * it and time its read()s. It reads straight out of the stream's own
+	 * buffer, so the buffered path costs what it always does, and only
+	 * hands the buffer back when it runs dry.
+	 */
+	class StatsInputStream : public InputStream {
+	public:
+		StatsInputStream(InputStream &inner, ReadStats &stats) :
+			m_inner(inner), m_stats(stats), m_buffer_start(nullptr)
+		{
+			take_buffer();
+		}
+
+		~StatsInputStream() {
+			give_back_buffer();
+		}
+
+		virtual void read(unsigned char *data, size_t size) {
+			give_back_buffer();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			m_inner.read_buffered(data, size);
+			m_stats.stream_nanoseconds += nanoseconds_since(start);
+			m_stats.bytes_read += size;
+			take_buffer();
+		}
+
+		virtual void skip(size_t size) {
+			give_back_buffer();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			m_inner.skip_buffered(size);
+			m_stats.stream_nanoseconds += nanoseconds_since(start);
+			m_stats.bytes_read += size;
+			take_buffer();
+		}
+
+		virtual uint64_t position() const {
+			uint64_t position = m_inner.position();
+			if(position == UNKNOWN_POSITION) {
+				return position;
+			}
+			// The stream's own position stops where we took its buffer.
+			return position + (m_buffer_position - m_buffer_start);
+		}
+
+		virtual uint64_t remaining() const {
+			uint64_t remaining = m_inner.remaining();
+			if(remaining == UNKNOWN_POSITION) {
+				return remaining;
+			}
+			return remaining - (m_buffer_position - m_buffer_start);
+		}
+
+	private:
+		void take_buffer() {
+			m_buffer_start = m_buffer_position = m_inner.m_buffer_position;
+			m_buffer_end = m_inner.m_buffer_end;
+			m_buffer_lendable = m_inner.m_buffer_lendable;
+		}
+
+		void give_back_buffer() {
+			if(!m_buffer_start) {
+				return;
+			}
+			m_stats.bytes_read += m_buffer_position - m_buffer_start;
+			m_inner.m_buffer_position = m_buffer_position;
+			m_buffer_start = m_buffer_position = m_buffer_end = nullptr;
+		}
+
+		InputStream &m_inner;
+		ReadStats &m_stats;
+		// Where m_buffer_position was when we took the buffer.
+		const unsigned char *m_buffer_start;
+	};
+
+	RootTag read_document(InputStream &s, const ReadOptions &options, ReadScratch &scratch, ReadStats *stats) {
+		ReadContext ctx(s, options, scratch, stats);
+		unsigned char tag_type_id = read_big_endian_unsigned_int<unsigned char, 1>(s);
+		RootTag root_tag;
+
+		root_tag.name = read_string(ctx);
+		if(tag_type_id == TAG_TYPE_LIST || tag_type_id == TAG_TYPE_COMPOUND) {
+			size_t node = options.projection ? 0 : Projection::EVERYTHING;
+			root_tag.tag = read_payload(ctx, tag_type_id, node);
+		}
+		return root_tag;
+	}
+
+	void finish_document_stats(ReadStats &document, const ReadOptions &options, std::chrono::steady_clock::time_point start) {
+		document.total_nanoseconds = nanoseconds_since(start);
+		document.documents = 1;
+		options.stats->add(document);
+#ifdef NBT_USDT_PROBES
+		DTRACE_PROBE4(nbt, read__done, document.bytes_read, document.failures,
+			document.total_nanoseconds, document.stream_nanoseconds);
+#endif
+		if(options.stats->on_document) {
+			options.stats->on_document(document);
+		}
+	}
+
+	RootTag read_document_with_stats(InputStream &s, const ReadOptions &options, ReadScratch &scratch) {
+#ifdef NBT_USDT_PROBES
+		DTRACE_PROBE(nbt, read__start);
+#endif
+		ReadStats document;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		RootTag root_tag;
+		try {
+			StatsInputStream counted(s, document);
+			root_tag = read_document(counted, options, scratch, &document);
+		} catch(...) {
+			document.failures = 1;
+			finish_document_stats(document, options, start);
+			throw;
+		}
+		finish_document_stats(document, options, start);
+		return root_tag;
+	}
+
+	RootTag read_document(InputStream &s, const ReadOptions &options, ReadScratch &scratch) {
+		if(options.stats) {
+			return read_document_with_stats(s, options, scratch);
+		}
+		return read_document(s, options, scratch, nullptr);
 	}
 }
 
 RootTag read_nbt(InputStream &s) {
-	unsigned char tag_type_id = detail::read_big_endian_unsigned_int<unsigned char, 1>(s);
-	RootTag root_tag;
+	return read_nbt(s, ReadOptions());
+}
+
+RootTag read_nbt(InputStream &s, const ReadOptions &options) {
+	detail::ReadScratch scratch;
+	return detail::read_document(s, options, scratch);
+}
 
-	root_tag.name = detail::read_string(s);
-	if(tag_type_id == TAG_TYPE_LIST || tag_type_id == TAG_TYPE_COMPOUND) {
-		detail::IoReadState io_state;
-		io_state.push_back(std::unique_ptr<detail::TagReadState>(new detail::ReadRootTagState(root_tag)));
-		io_state.push_back(detail::new_read_state_for(s, tag_type_id));
-		detail::process_read_state(s, io_state);
+
+struct Reader::State {
+	State(const ReadOptions &p_options, bool use_arena) : options(p_options) {
+		if(use_arena) {
+			arena.reset(new Arena());
+			options.arena = arena.get();
+		}
+	}
+
+	ReadOptions options;
+	std::unique_ptr<Arena> arena;
+	detail::ReadScratch scratch;
+};
+
+Reader::Reader(const ReadOptions &options, bool use_arena) : m_state(new State(options, use_arena)) {}
+
+Reader::~Reader() {}
+
+RootTag Reader::read(InputStream &s) {
+	if(m_state->arena) {
+		m_state->arena->reset();
+	}
+	return detail::read_document(s, m_state->options, m_state->scratch);
+}
+
+size_t Reader::read_many(const unsigned char *data, size_t size, const std::function<void(RootTag &root)> &callback) {
+	MemoryInputStream s(data, size);
+	size_t count = 0;
+	while(s.position() < size) {
+		RootTag root = read(s);
+		++count;
+		callback(root);
+	}
+	return count;
+}
+
+void skip_tag(InputStream &s, TagTypeId tag_type) {
+	std::vector<detail::SkipFrame> stack;
+	detail::skip_payload(s, tag_type, stack);
+}
+
+struct IncrementalReader::State {
+	enum Phase {
+		PHASE_HEADER,
+		PHASE_BODY,
+		PHASE_FINISHED
+	};
+
+	State(const ReadOptions &p_options) :
+		options(p_options), ctx(stream, options, scratch), phase(PHASE_HEADER)
+	{
+		ctx.feed = &stream;
+		// Lent bytes would move as the buffer grows.
+		options.borrow_buffers = false;
+		options.stats = nullptr;
+	}
+
+	void reset() {
+		scratch.io_state.clear();
+		root = RootTag();
+		phase = PHASE_HEADER;
+	}
+
+	void read_header() {
+		ctx.start_document();
+		TagTypeId tag_type = detail::read_big_endian_unsigned_int<unsigned char, 1>(stream);
+		Utf8String name = detail::read_string(ctx);
+		if(tag_type != TAG_TYPE_LIST && tag_type != TAG_TYPE_COMPOUND) {
+			root.name = std::move(name);
+			phase = PHASE_FINISHED;
+			return;
+		}
+		size_t node = options.projection ? 0 : Projection::EVERYTHING;
+		std::unique_ptr<detail::TagReadState> body = detail::new_read_state_for(ctx, tag_type, node);
+		root.name = std::move(name);
+		scratch.io_state.push_back(std::unique_ptr<detail::TagReadState>(
+			new (scratch.states) detail::ReadRootTagState(root)));
+		scratch.io_state.push_back(std::move(body));
+		phase = PHASE_BODY;
+	}
+
+	ReadOptions options;
+	detail::ReadScratch scratch;
+	detail::FeedInputStream stream;
+	detail::ReadContext ctx;
+	Phase phase;
+	RootTag root;
+};
+
+IncrementalReader::IncrementalReader(const ReadOptions &options) : m_state(new State(options)) {}
+
+IncrementalReader::~IncrementalReader() {
+	// The states point into the tree being built.
+	m_state->scratch.io_state.clear();
+}
+
+IncrementalReader::Status IncrementalReader::feed(const unsigned char *data, size_t size) {
+	State &state = *m_state;
+	if(state.phase == State::PHASE_FINISHED) {
+		state.reset();
+	}
+	state.stream.append(data, size);
+	if(!state.stream.has_wanted()) {
+		return NEED_MORE;
+	}
+	detail::IoReadState &io_state = state.scratch.io_state;
+	try {
+		if(state.phase == State::PHASE_HEADER) {
+			state.read_header();
+			state.stream.mark();
+		}
+		while(!io_state.empty()) {
+			io_state.back()->continue_read(state.ctx, io_state);
+			state.stream.mark();
+		}
+	} catch(detail::NeedMoreInput &) {
+		state.stream.rewind();
+		return NEED_MORE;
+	} catch(...) {
+		state.reset();
+		state.stream.clear();
+		throw;
+	}
+	state.phase = State::PHASE_FINISHED;
+	return DONE;
+}
+
+RootTag IncrementalReader::take() {
+	if(m_state->phase != State::PHASE_FINISHED) {
+		throw std::logic_error("IncrementalReader::take called before a document was done.");
+	}
+	RootTag root = std::move(m_state->root);
+	m_state->reset();
+	return root;
+}
+
+size_t IncrementalReader::buffered() const {
+	return m_state->stream.buffered();
+}
+
+void IncrementalReader::reset() {
+	m_state->reset();
+	m_state->stream.clear();
+}
+
+
+namespace detail {
+	TagPtr<Tag> read_payload(InputStream &s, TagTypeId tag_type, const ReadOptions &options) {
+		ReadScratch scratch;
+		ReadContext ctx(s, options, scratch);
+		return read_payload(ctx, tag_type, options.projection ? 0 : Projection::EVERYTHING);
+	}
+
+	void read_packed_payload(InputStream &s, void *data, size_t count, size_t raw_type_size) {
+		unsigned char *bytes = static_cast<unsigned char *>(data);
+		s.read_buffered(bytes, count * raw_type_size);
+		nbt::detail::byteswap_big_endian(bytes, count, raw_type_size);
+	}
+
+	size_t min_payload_size(TagTypeId tag_type) {
+		switch(tag_type) {
+			case TAG_TYPE_COMPOUND:
+				// Its TAG_End.
+				return 1;
+			case TAG_TYPE_STRING:
+				return 2;
+			case TAG_TYPE_BYTE_ARRAY:
+			case TAG_TYPE_INT_ARRAY:
+			case TAG_TYPE_LONG_ARRAY:
+				return 4;
+			case TAG_TYPE_LIST:
+				return 5;
+			default:
+				return fixed_payload_size(tag_type);
+		}
+	}
+
+	size_t plausible_count(InputStream &s, size_t count, size_t min_size, size_t element_size) {
+		uint64_t remaining = s.remaining();
+		if(remaining != InputStream::UNKNOWN_POSITION) {
+			if(min_size && count > remaining / min_size) {
+				throw PrematureEof();
+			}
+			return count;
+		}
+		return std::min(count, UNVOUCHED_BYTES / std::max<size_t>(element_size, 1));
+	}
+
+	void throw_schema_type_mismatch(const char *field, TagTypeId tag_type) {
+		throw IoError(std::string("Unexpected ") + utility::tag_type_name(tag_type) + " for field " + field + ".");
+	}
+
+	size_t payload_size(const unsigned char *data, size_t size, TagTypeId tag_type) {
+		MemoryInputStream s(data, size);
+		std::vector<SkipFrame> stack;
+		skip_payload(s, tag_type, stack);
+		return s.position();
+	}
+}
+
+
+EventReader::EventReader(InputStream &s) :
+	m_stream(s), m_started(false), m_event(EVENT_END_OF_DOCUMENT), m_type(TAG_TYPE_END),
+	m_int_value(0), m_float_value(0), m_element_type(TAG_TYPE_END), m_length(0), m_array_remaining(0)
+{}
+
+EventReader::Event EventReader::next() {
+	if(m_array_remaining) {
+		skip();
+	}
+	m_name = Utf8String();
+	if(m_stack.empty()) {
+		if(m_started) {
+			return m_event = EVENT_END_OF_DOCUMENT;
+		}
+		m_started = true;
+		TagTypeId tag_type = detail::read_big_endian_unsigned_int<unsigned char, 1>(m_stream);
+		if(tag_type == TAG_TYPE_END) {
+			return m_event = EVENT_END_OF_DOCUMENT;
+		}
+		m_name = read_string(m_name_buffer);
+		return begin_value(tag_type);
+	}
+
+	Frame &frame = m_stack.back();
+	if(frame.type == TAG_TYPE_COMPOUND) {
+		TagTypeId tag_type = detail::read_big_endian_unsigned_int<unsigned char, 1>(m_stream);
+		if(tag_type == TAG_TYPE_END) {
+			m_stack.pop_back();
+			m_type = TAG_TYPE_COMPOUND;
+			return m_event = EVENT_END_COMPOUND;
+		}
+		m_name = read_string(m_name_buffer);
+		return begin_value(tag_type);
+	}
+	if(frame.remaining == 0) {
+		m_stack.pop_back();
+		m_type = TAG_TYPE_LIST;
+		return m_event = EVENT_END_LIST;
+	}
+	--frame.remaining;
+	return begin_value(frame.element_type);
+}
+
+EventReader::Event EventReader::begin_value(TagTypeId tag_type) {
+	m_type = tag_type;
+	switch(tag_type) {
+		case TAG_TYPE_BYTE:
+			m_int_value = detail::read_big_endian_int<int8_t, 1>(m_stream);
+			return m_event = EVENT_INT;
+		case TAG_TYPE_SHORT:
+			m_int_value = detail::read_big_endian_int<int16_t, 2>(m_stream);
+			return m_event = EVENT_INT;
+		case TAG_TYPE_INT:
+			m_int_value = detail::read_big_endian_int<int32_t, 4>(m_stream);
+			return m_event = EVENT_INT;
+		case TAG_TYPE_LONG:
+			m_int_value = detail::read_big_endian_int<int64_t, 8>(m_stream);
+			return m_event = EVENT_INT;
+		case TAG_TYPE_FLOAT:
+			m_float_value = detail::ValueDecoder<float, uint32_t, 4>::decode(
+				detail::read_big_endian_unsigned_int<uint32_t, 4>(m_stream));
+			return m_event = EVENT_FLOAT;
+		case TAG_TYPE_DOUBLE:
+			m_float_value = detail::ValueDecoder<double, uint64_t, 8>::decode(
+				detail::read_big_endian_unsigned_int<uint64_t, 8>(m_stream));
+			return m_event = EVENT_FLOAT;
+		case TAG_TYPE_STRING:
+			m_string_value = read_string(m_string_buffer);
+			return m_event = EVENT_STRING;
+		case TAG_TYPE_BYTE_ARRAY:
+		case TAG_TYPE_INT_ARRAY:
+		case TAG_TYPE_LONG_ARRAY:
+			m_element_type = tag_type;
+			m_length = m_array_remaining = detail::read_big_endian_unsigned_int<uint32_t, 4>(m_stream);
+			return m_event = EVENT_ARRAY;
+		case TAG_TYPE_LIST: {
+			Frame frame;
+			frame.type = TAG_TYPE_LIST;
+			frame.element_type = detail::read_big_endian_unsigned_int<unsigned char, 1>(m_stream);
+			frame.remaining = detail::read_big_endian_unsigned_int<uint32_t, 4>(m_stream);
+			if(frame.element_type == TAG_TYPE_END && frame.remaining != 0) {
+				throw IoError("List tag had a tag type of \"TAG_End\".");
+			}
+			m_element_type = frame.element_type;
+			m_length = frame.remaining;
+			m_stack.push_back(frame);
+			return m_event = EVENT_BEGIN_LIST;
+		}
+		case TAG_TYPE_COMPOUND: {
+			Frame frame = {TAG_TYPE_COMPOUND, TAG_TYPE_END, 0};
+			m_stack.push_back(frame);
+			return m_event = EVENT_BEGIN_COMPOUND;
+		}
+		default:
+			throw IoError(std::string("Unknown tag type in NBT: ") + std::to_string(tag_type));
+	}
+}
+
+/* Borrows the string from the stream if it can, and otherwise reads it into
+ * `buffer`, which is reused from one string to the next.
+ */
+Utf8String EventReader::read_string(std::vector<unsigned char> &buffer) {
+	uint16_t length = detail::read_big_endian_unsigned_int<uint16_t, 2>(m_stream);
+	const unsigned char *lent = m_stream.lend(length);
+	if(lent) {
+		return Utf8String::borrow(lent, length);
+	}
+	if(buffer.size() < length) {
+		buffer.resize(length);
+	}
+	m_stream.read_buffered(buffer.data(), length);
+	return Utf8String::borrow(buffer.data(), length);
+}
+
+void EventReader::skip() {
+	if(m_event == EVENT_ARRAY) {
+		size_t remaining = m_array_remaining;
+		m_array_remaining = 0;
+		m_stream.skip_buffered(remaining * detail::array_element_size(m_type));
+		return;
+	}
+	if(m_event != EVENT_BEGIN_COMPOUND && m_event != EVENT_BEGIN_LIST) {
+		return;
+	}
+
+	Event skipped = m_event;
+	detail::skip_nested(m_stream, m_stack, m_stack.size() - 1);
+	if(skipped == EVENT_BEGIN_COMPOUND) {
+		m_event = EVENT_END_COMPOUND;
+		m_type = TAG_TYPE_COMPOUND;
+	} else {
+		m_event = EVENT_END_LIST;
+		m_type = TAG_TYPE_LIST;
+	}
+}
+
+void EventReader::check_array(TagTypeId tag_type) {
+	if(m_event != EVENT_ARRAY || m_type != tag_type) {
+		throw std::logic_error("read_array called with the wrong type for the array, or outside of one.");
+	}
+}
+
+size_t EventReader::read_array(unsigned char *data, size_t count) {
+	check_array(TAG_TYPE_BYTE_ARRAY);
+	count = std::min(count, m_array_remaining);
+	m_stream.read_buffered(data, count);
+	m_array_remaining -= count;
+	return count;
+}
+
+size_t EventReader::read_array(int32_t *data, size_t count) {
+	check_array(TAG_TYPE_INT_ARRAY);
+	count = std::min(count, m_array_remaining);
+	m_stream.read_buffered(reinterpret_cast<unsigned char *>(data), count * 4);
+	nbt::detail::byteswap_big_endian(reinterpret_cast<unsigned char *>(data), count, 4);
+	m_array_remaining -= count;
+	return count;
+}
+
+size_t EventReader::read_array(int64_t *data, size_t count) {
+	check_array(TAG_TYPE_LONG_ARRAY);
+	count = std::min(count, m_array_remaining);
+	m_stream.read_buffered(reinterpret_cast<unsigned char *>(data), count * 8);
+	nbt::detail::byteswap_big_endian(reinterpret_cast<unsigned char *>(data), count, 8);
+	m_array_remaining -= count;
+	return count;
+}
+
+void read_nbt_events(InputStream &s, EventHandler &handler) {
+	EventReader reader(s);
+	while(true) {
+		switch(reader.next()) {
+			case EventReader::EVENT_BEGIN_COMPOUND:
+				if(!handler.begin_compound(reader.name())) {
+					reader.skip();
+				}
+				break;
+			case EventReader::EVENT_END_COMPOUND:
+				handler.end_compound();
+				break;
+			case EventReader::EVENT_BEGIN_LIST:
+				if(!handler.begin_list(reader.name(), reader.element_type(), reader.length())) {
+					reader.skip();
+				}
+				break;
+			case EventReader::EVENT_END_LIST:
+				handler.end_list();
+				break;
+			case EventReader::EVENT_INT:
+				handler.int_value(reader.name(), reader.type(), reader.int_value());
+				break;
+			case EventReader::EVENT_FLOAT:
+				handler.float_value(reader.name(), reader.type(), reader.float_value());
+				break;
+			case EventReader::EVENT_STRING:
+				handler.string_value(reader.name(), reader.string_value());
+				break;
+			case EventReader::EVENT_ARRAY:
+				handler.array(reader.name(), reader.type(), reader);
+				break;
+			case EventReader::EVENT_END_OF_DOCUMENT:
+				return;
+		}
 	}
-	return root_tag;
 }
 
 }
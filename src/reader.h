@@ -0,0 +1,27 @@
+#ifndef NBT_READER_H
+#define NBT_READER_H
+
+#include <cstddef>
+
+#include "nbt.h"
+
+
+namespace nbt {
+namespace io {
+namespace detail {
+
+	/* Reads a tag's payload (everything after its type and name) from `s`,
+	 * as read_nbt would.
+	 */
+	TagPtr<Tag> read_payload(InputStream &s, TagTypeId tag_type, const ReadOptions &options);
+
+	/* The size of the payload of the given type at the start of `data`,
+	 * found by skipping over it. Throws PrematureEof if it runs past `size`.
+	 */
+	size_t payload_size(const unsigned char *data, size_t size, TagTypeId tag_type);
+
+}
+}
+}
+
+#endif
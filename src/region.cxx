@@ -0,0 +1,156 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nbt.h"
+
+
+namespace nbt {
+namespace io {
+
+namespace {
+	uint32_t load_big_endian_uint32(const unsigned char *data) {
+		return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+			(static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+	}
+
+	IoError system_error(const std::string &what, const std::string &path) {
+		return IoError(what + " " + path + ": " + std::strerror(errno));
+	}
+
+	// Closes a file descriptor on the way out, however that is.
+	class FileDescriptor {
+	public:
+		explicit FileDescriptor(int fd) : m_fd(fd) {}
+		~FileDescriptor() {
+			if(m_fd >= 0) {
+				close(m_fd);
+			}
+		}
+		int get() const { return m_fd; }
+	private:
+		int m_fd;
+	};
+}
+
+const size_t RegionFile::CHUNKS_PER_SIDE;
+const size_t RegionFile::CHUNK_COUNT;
+const size_t RegionFile::SECTOR_SIZE;
+const size_t RegionFile::HEADER_SIZE;
+
+RegionFile::RegionFile(const std::string &path) : m_data(nullptr), m_size(0) {
+	FileDescriptor fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	if(fd.get() < 0) {
+		throw system_error("Couldn't open region file", path);
+	}
+	struct stat st;
+	if(fstat(fd.get(), &st) != 0) {
+		throw system_error("Couldn't stat region file", path);
+	}
+	if(st.st_size == 0) {
+		return;
+	}
+	if(static_cast<size_t>(st.st_size) < HEADER_SIZE) {
+		throw IoError("Region file " + path + " is too short to hold its header.");
+	}
+
+	void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd.get(), 0);
+	if(mapped == MAP_FAILED) {
+		throw system_error("Couldn't map region file", path);
+	}
+	// Chunks are read one at a time and in no particular order, so
+	// reading ahead is mostly wasted.
+	posix_madvise(mapped, st.st_size, POSIX_MADV_RANDOM);
+	m_data = static_cast<const unsigned char *>(mapped);
+	m_size = st.st_size;
+}
+
+RegionFile::~RegionFile() {
+	if(m_data) {
+		munmap(const_cast<unsigned char *>(m_data), m_size);
+	}
+}
+
+RegionFile::ChunkLocation RegionFile::location(size_t index) const {
+	if(index >= CHUNK_COUNT) {
+		throw std::out_of_range("Chunk index out of range.");
+	}
+	ChunkLocation location = {0, 0};
+	if(m_data) {
+		uint32_t entry = load_big_endian_uint32(m_data + index * 4);
+		location.sector_offset = entry >> 8;
+		location.sector_count = entry & 0xff;
+	}
+	return location;
+}
+
+uint32_t RegionFile::timestamp(size_t index) const {
+	if(index >= CHUNK_COUNT) {
+		throw std::out_of_range("Chunk index out of range.");
+	}
+	if(!m_data) {
+		return 0;
+	}
+	return load_big_endian_uint32(m_data + SECTOR_SIZE + index * 4);
+}
+
+RegionFile::ChunkData RegionFile::chunk_data(size_t index) const {
+	ChunkData chunk = {0, nullptr, 0};
+	ChunkLocation location = this->location(index);
+	if(location.sector_count == 0) {
+		return chunk;
+	}
+
+	// Each chunk starts with its length, which counts the compression
+	// byte after it, and is padded out to a whole number of sectors.
+	size_t offset = static_cast<size_t>(location.sector_offset) * SECTOR_SIZE;
+	if(offset < HEADER_SIZE || offset > m_size || m_size - offset < 5) {
+		throw IoError("Region file header points outside the file.");
+	}
+	size_t length = load_big_endian_uint32(m_data + offset);
+	if(length == 0 || length > m_size - offset - 4) {
+		throw IoError("Region file chunk runs past the end of the file.");
+	}
+	chunk.compression = m_data[offset + 4];
+	chunk.data = m_data + offset + 5;
+	chunk.size = length - 1;
+	posix_madvise(const_cast<unsigned char *>(m_data) + (offset & ~(SECTOR_SIZE - 1)),
+		length + 4, POSIX_MADV_WILLNEED);
+	return chunk;
+}
+
+RootTag RegionFile::read_chunk(size_t index) const {
+	return read_chunk(index, ReadOptions());
+}
+
+RootTag RegionFile::read_chunk(size_t index, const ReadOptions &options) const {
+	ChunkData chunk = chunk_data(index);
+	if(!chunk.data) {
+		throw std::out_of_range("Chunk isn't in the region file.");
+	}
+	switch(chunk.compression) {
+		case CHUNK_GZIP: {
+			GzipInputStream s(chunk.data, chunk.size);
+			return read_nbt(s, options);
+		}
+		case CHUNK_ZLIB: {
+			ZlibInputStream s(chunk.data, chunk.size);
+			return read_nbt(s, options);
+		}
+		case CHUNK_UNCOMPRESSED: {
+			MemoryInputStream s(chunk.data, chunk.size);
+			return read_nbt(s, options);
+		}
+		default:
+			throw IoError("Unsupported region file chunk compression.");
+	}
+}
+
+}
+}
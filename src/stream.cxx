@@ -0,0 +1,186 @@
+#include "nbt.h"
+
+
+namespace nbt {
+namespace io {
+
+namespace {
+	// Skips smaller than this are cheaper to read through than to seek over.
+	const size_t SEEK_THRESHOLD = 16 * 1024;
+
+	/* Seeks `size` bytes ahead, if the istream can seek at all; if it
+	 * can't, does nothing and returns false.
+	 */
+	bool seek_forward(std::istream &is, size_t size) {
+		std::streampos here = is.tellg();
+		if(here == std::streampos(-1)) {
+			return false;
+		}
+		is.seekg(0, std::ios::end);
+		std::streampos end = is.tellg();
+		if(!is || end == std::streampos(-1)) {
+			is.clear();
+			is.seekg(here);
+			return false;
+		}
+		if(static_cast<uint64_t>(end - here) < size) {
+			throw PrematureEof();
+		}
+		if(!is.seekg(here + static_cast<std::streamoff>(size))) {
+			throw IoError();
+		}
+		return true;
+	}
+}
+
+const uint64_t InputStream::UNKNOWN_POSITION;
+
+void InputStream::skip(size_t size) {
+	unsigned char scratch[4096];
+	while(size > 0) {
+		size_t n = std::min(size, sizeof(scratch));
+		read_buffered(scratch, n);
+		size -= n;
+	}
+}
+
+void IStreamInputStream::skip(size_t size) {
+	if(size >= SEEK_THRESHOLD && seek_forward(m_istream, size)) {
+		m_position += size;
+		return;
+	}
+	InputStream::skip(size);
+}
+
+const size_t BufferedIStreamInputStream::DEFAULT_BUFFER_SIZE;
+
+void BufferedIStreamInputStream::read(unsigned char *data, size_t size) {
+	// Start with whatever is left over in the buffer.
+	size_t buffered = m_buffer_end - m_buffer_position;
+	if(buffered > size) {
+		buffered = size;
+	}
+	std::copy(m_buffer_position, m_buffer_position + buffered, data);
+	m_buffer_position += buffered;
+	data += buffered;
+	size -= buffered;
+	if(size == 0) {
+		return;
+	}
+
+	// Reads at least as big as the buffer would just get copied through it,
+	// so skip the middleman.
+	if(size >= m_buffer.size()) {
+		if(!m_istream.read(reinterpret_cast<char *>(data), size)) {
+			if(m_istream.bad()) {
+				throw IoError();
+			} else {
+				throw PrematureEof();
+			}
+		}
+		m_istream_position += size;
+		return;
+	}
+
+	m_istream.read(reinterpret_cast<char *>(&m_buffer[0]), m_buffer.size());
+	if(m_istream.bad()) {
+		throw IoError();
+	}
+	size_t filled = m_istream.gcount();
+	m_istream_position += filled;
+	// Hitting EOF while filling the buffer is fine, as long as we got what
+	// we needed; clear it so the caller can keep using the istream.
+	if(m_istream.eof()) {
+		m_istream.clear();
+	}
+	m_buffer_position = &m_buffer[0];
+	m_buffer_end = m_buffer_position + filled;
+	if(filled < size) {
+		m_buffer_position = m_buffer_end;
+		throw PrematureEof();
+	}
+	std::copy(m_buffer_position, m_buffer_position + size, data);
+	m_buffer_position += size;
+}
+
+void BufferedIStreamInputStream::skip(size_t size) {
+	size_t buffered = std::min(static_cast<size_t>(m_buffer_end - m_buffer_position), size);
+	m_buffer_position += buffered;
+	size -= buffered;
+	if(size >= std::max(m_buffer.size(), SEEK_THRESHOLD) && seek_forward(m_istream, size)) {
+		m_istream_position += size;
+		return;
+	}
+	// With the buffer empty, this refills it as it goes.
+	InputStream::skip(size);
+}
+
+
+const size_t OStreamOutputStream::DEFAULT_BUFFER_SIZE;
+
+OStreamOutputStream::OStreamOutputStream(std::ostream &stream, size_t buffer_size) :
+	m_ostream(stream), m_buffer(buffer_size)
+{
+	m_buffer_position = m_buffer.data();
+	m_buffer_end = m_buffer.data() + m_buffer.size();
+}
+
+OStreamOutputStream::~OStreamOutputStream() {
+	try {
+		flush();
+	} catch(...) {
+	}
+}
+
+void OStreamOutputStream::write(const unsigned char *data, size_t size) {
+	flush();
+	if(size >= m_buffer.size()) {
+		if(!m_ostream.write(reinterpret_cast<const char *>(data), size)) {
+			throw IoError("I/O error while writing NBT stream.");
+		}
+		return;
+	}
+	m_buffer_position = std::copy(data, data + size, m_buffer_position);
+}
+
+void OStreamOutputStream::flush() {
+	size_t pending = m_buffer_position - m_buffer.data();
+	m_buffer_position = m_buffer.data();
+	if(pending && !m_ostream.write(reinterpret_cast<const char *>(m_buffer.data()), pending)) {
+		throw IoError("I/O error while writing NBT stream.");
+	}
+}
+
+std::vector<unsigned char> MemoryOutputStream::take() {
+	m_buffer.resize(size());
+	std::vector<unsigned char> taken;
+	taken.swap(m_buffer);
+	m_buffer_position = nullptr;
+	m_buffer_end = nullptr;
+	return taken;
+}
+
+void MemoryOutputStream::write(const unsigned char *data, size_t size) {
+	grow(size);
+	m_buffer_position = std::copy(data, data + size, m_buffer_position);
+}
+
+void MemoryOutputStream::reserve(size_t size) {
+	size_t used = this->size();
+	if(used + size > m_buffer.size()) {
+		m_buffer.resize(used + size);
+		m_buffer_position = m_buffer.data() + used;
+		m_buffer_end = m_buffer.data() + m_buffer.size();
+	}
+}
+
+void MemoryOutputStream::grow(size_t extra) {
+	size_t used = size();
+	size_t capacity = std::max(std::max(used + extra, m_buffer.size() * 2), static_cast<size_t>(256));
+	m_buffer.resize(capacity);
+	m_buffer_position = m_buffer.data() + used;
+	m_buffer_end = m_buffer.data() + capacity;
+}
+
+}
+}
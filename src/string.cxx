@@ -1,4 +1,4 @@
-#include <climits>
+#include <cstring>
 
 
 #include "nbt.h"
@@ -8,38 +8,103 @@ namespace nbt {
 namespace detail {
 
 	/*
-	 * This is the FNV-1a hash.
-	 * It is only specialized for systems with CHAR_BIT, and 4 or 8 byte
-	 * size_t's.
+	 * This is wyhash (the final version 4, by Wang Yi, released into the
+	 * public domain), which eats 8 bytes at a time instead of FNV-1a's one.
+	 * Hashes don't leave the process, so reads are in host byte order.
 	 */
-	template<size_t size_t_size, size_t charbits>
-	struct FnvHash1AConstants;
-
-	template<>
-	struct FnvHash1AConstants<8, 8> {
-		static const size_t fnv_prime = 1099511628211ULL;
-		static const size_t fnv_offset_bias = 14695981039346656037ULL;
-	};
-	template<>
-	struct FnvHash1AConstants<4, 8> {
-		static const size_t fnv_prime = 16777619UL;
-		static const size_t fnv_offset_bias = 2166136261UL;
-	};
-
-
-	template<typename IT>
-	size_t fnv_hash(IT begin, IT end) {
-		size_t hash_value = FnvHash1AConstants<sizeof(size_t), CHAR_BIT>::fnv_offset_bias;
-		for(; begin != end; ++begin) {
-			hash_value = hash_value * FnvHash1AConstants<sizeof(size_t), CHAR_BIT>::fnv_prime;
-			hash_value = hash_value ^ *begin;
+	const uint64_t WY_P0 = 0xa0761d6478bd642fULL;
+	const uint64_t WY_P1 = 0xe7037ed1a0b428dbULL;
+	const uint64_t WY_P2 = 0x8ebc6af09c88c6e3ULL;
+	const uint64_t WY_P3 = 0x589965cc75374cc3ULL;
+
+	// The full 128-bit product of a and b, low half into a and high into b.
+	inline void wy_multiply(uint64_t &a, uint64_t &b) {
+#ifdef __SIZEOF_INT128__
+		__uint128_t product = static_cast<__uint128_t>(a) * b;
+		a = static_cast<uint64_t>(product);
+		b = static_cast<uint64_t>(product >> 64);
+#else
+		uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t>(a), lb = static_cast<uint32_t>(b);
+		uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+		uint64_t t = rl + (rm0 << 32);
+		uint64_t carry = t < rl;
+		uint64_t low = t + (rm1 << 32);
+		carry += low < t;
+		b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+		a = low;
+#endif
+	}
+
+	inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+		wy_multiply(a, b);
+		return a ^ b;
+	}
+
+	inline uint64_t wy_read8(const unsigned char *p) {
+		uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint64_t wy_read4(const unsigned char *p) {
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	// 1 to 3 bytes, which may overlap.
+	inline uint64_t wy_read3(const unsigned char *p, size_t size) {
+		return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[size >> 1]) << 8) | p[size - 1];
+	}
+
+	uint64_t wyhash(const unsigned char *p, size_t size) {
+		uint64_t seed = wy_mix(WY_P0, WY_P1);
+		uint64_t a, b;
+		if(size <= 16) {
+			if(size >= 4) {
+				size_t step = (size >> 3) << 2;
+				a = (wy_read4(p) << 32) | wy_read4(p + step);
+				b = (wy_read4(p + size - 4) << 32) | wy_read4(p + size - 4 - step);
+			} else if(size > 0) {
+				a = wy_read3(p, size);
+				b = 0;
+			} else {
+				a = b = 0;
+			}
+		} else {
+			size_t remaining = size;
+			if(remaining > 48) {
+				uint64_t seed1 = seed, seed2 = seed;
+				do {
+					seed = wy_mix(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+					seed1 = wy_mix(wy_read8(p + 16) ^ WY_P2, wy_read8(p + 24) ^ seed1);
+					seed2 = wy_mix(wy_read8(p + 32) ^ WY_P3, wy_read8(p + 40) ^ seed2);
+					p += 48;
+					remaining -= 48;
+				} while(remaining > 48);
+				seed ^= seed1 ^ seed2;
+			}
+			while(remaining > 16) {
+				seed = wy_mix(wy_read8(p) ^ WY_P1, wy_read8(p + 8) ^ seed);
+				p += 16;
+				remaining -= 16;
+			}
+			a = wy_read8(p + remaining - 16);
+			b = wy_read8(p + remaining - 8);
 		}
-		return hash_value;
+		a ^= WY_P1;
+		b ^= seed;
+		wy_multiply(a, b);
+		return wy_mix(a ^ WY_P0 ^ size, b ^ WY_P1);
 	}
 }
 
 size_t Utf8StringHash::operator () (const nbt::Utf8String &s) const {
-	return nbt::detail::fnv_hash(s.data.begin(), s.data.end());
+	return (*this)(s.data.data(), s.data.size());
+}
+
+size_t Utf8StringHash::operator () (const unsigned char *data, size_t size) const {
+	return static_cast<size_t>(nbt::detail::wyhash(data, size));
 }
 
 }
@@ -1,239 +1,633 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 
 #include "nbt.h"
 
 
+#ifdef __GNUC__
+  #define UNUSED(x) UNUSED_ ## x __attribute__((__unused__))
+#else
+  #define UNUSED(x) UNUSED_ ## x
+#endif
+
+
 namespace nbt {
 namespace utility {
 
 
-/* TagNameLookup is a class to look up, at compile time, the "pretty" name of
- * the type of the tag. This is something like, "TAG_Compound".
- */
-template<typename T>
-struct TagNameLookup;
-
-#define TAG_NAME_LOOKUP(cls, cls_name) \
-	template<> \
-	struct TagNameLookup<cls> { \
-		static const char * const name; \
-	}; \
-	const char * const TagNameLookup<cls>::name = cls_name;
-
-TAG_NAME_LOOKUP(ByteTag, "TAG_Byte")
-TAG_NAME_LOOKUP(ShortTag, "TAG_Short")
-TAG_NAME_LOOKUP(IntTag, "TAG_Int")
-TAG_NAME_LOOKUP(LongTag, "TAG_Long")
-TAG_NAME_LOOKUP(FloatTag, "TAG_Float")
-TAG_NAME_LOOKUP(DoubleTag, "TAG_Double")
-TAG_NAME_LOOKUP(ByteArrayTag, "TAG_Byte_Array")
-TAG_NAME_LOOKUP(StringTag, "TAG_String")
-TAG_NAME_LOOKUP(ListTagBase, "TAG_List")
-TAG_NAME_LOOKUP(CompoundTag, "TAG_Compound")
-TAG_NAME_LOOKUP(IntArrayTag, "TAG_Int_Array")
-
-#undef TAG_NAME_LOOKUP
-
-
-/* An optional class. A wrapped class that contains a single instance of T, but
- * only sometimes.
- * This is similar to a nullable pointer.
- */
+const char *tag_type_name(io::TagTypeId type) {
+	static const char * const names[] = {
+		"TAG_End",
+		"TAG_Byte",
+		"TAG_Short",
+		"TAG_Int",
+		"TAG_Long",
+		"TAG_Float",
+		"TAG_Double",
+		"TAG_Byte_Array",
+		"TAG_String",
+		"TAG_List",
+		"TAG_Compound",
+		"TAG_Int_Array",
+		"TAG_Long_Array",
+	};
+	if(type < sizeof(names) / sizeof(names[0])) {
+		return names[type];
+	}
+	return "TAG_Unknown";
+}
 
-template<typename T>
-class Optional {
+
+namespace {
+
+/* Collects text on its way to a stream, so that printing makes one
+ * ostream::write every few kilobytes rather than an operator<< per token.
+ */
+class TextBuffer {
 public:
-	Optional() : m_has_value(false), m_value() {}
-	Optional(const T &v) : m_has_value(true), m_value(v) {}
+	explicit TextBuffer(std::ostream &os) : m_stream(os), m_size(0) {}
 
-	bool has_value() const { return m_has_value; }
-	T &value() { check_value(); return m_value; }
-	const T &value() const { check_value(); return m_value; }
-private:
-	void check_value() const { 
-		if(!m_has_value) {
-			throw std::logic_error("Optional didn't contain a value.");
+	void put(char c) {
+		if(m_size == sizeof(m_buffer)) {
+			flush();
+		}
+		m_buffer[m_size++] = c;
+	}
+
+	void put(const char *s, size_t size) {
+		if(size > sizeof(m_buffer) - m_size) {
+			flush();
+			if(size > sizeof(m_buffer)) {
+				m_stream.write(s, size);
+				return;
+			}
+		}
+		std::memcpy(m_buffer + m_size, s, size);
+		m_size += size;
+	}
+
+	void put(const char *s) {
+		put(s, std::strlen(s));
+	}
+
+	void put(const Utf8String &s) {
+		put(reinterpret_cast<const char *>(s.data.data()), s.data.size());
+	}
+
+	void put_repeated(const char *s, size_t size, size_t count) {
+		for(size_t i = 0; i < count; ++i) {
+			put(s, size);
 		}
 	}
 
-	bool m_has_value;
-	T m_value;
+	void put_integer(int64_t value) {
+		uint64_t magnitude = static_cast<uint64_t>(value);
+		if(value < 0) {
+			put('-');
+			magnitude = 0 - magnitude;
+		}
+		put_unsigned(magnitude);
+	}
+
+	void put_unsigned(uint64_t value) {
+		static const char digit_pairs[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+		char digits[20];
+		char *p = digits + sizeof(digits);
+		while(value >= 100) {
+			size_t pair = static_cast<size_t>(value % 100) * 2;
+			value /= 100;
+			*--p = digit_pairs[pair + 1];
+			*--p = digit_pairs[pair];
+		}
+		if(value >= 10) {
+			size_t pair = static_cast<size_t>(value) * 2;
+			*--p = digit_pairs[pair + 1];
+			*--p = digit_pairs[pair];
+		} else {
+			*--p = static_cast<char>('0' + value);
+		}
+		put(p, digits + sizeof(digits) - p);
+	}
+
+	// As printf's %.*g, which is also what operator<< does by default.
+	void put_float(double value, int precision) {
+		char text[32];
+		int size = std::snprintf(text, sizeof(text), "%.*g", precision, value);
+		put(text, size);
+	}
+
+	/* The fewest digits that read back as the same value: value_type is
+	 * float or double, and says which.
+	 */
+	template<typename value_type>
+	void put_shortest_float(value_type value) {
+		const int min_precision = sizeof(value_type) == 4 ? 6 : 15;
+		const int max_precision = sizeof(value_type) == 4 ? 9 : 17;
+		char text[32];
+		int size = 0;
+		for(int precision = min_precision; precision <= max_precision; ++precision) {
+			size = std::snprintf(text, sizeof(text), "%.*g", precision, static_cast<double>(value));
+			if(static_cast<value_type>(std::strtod(text, nullptr)) == value) {
+				break;
+			}
+		}
+		put(text, size);
+	}
+
+	void flush() {
+		m_stream.write(m_buffer, m_size);
+		m_size = 0;
+	}
+
+private:
+	std::ostream &m_stream;
+	char m_buffer[8192];
+	size_t m_size;
 };
 
 
-/* A class to pretty-print NBT data. This class itself is private, and holds
- * during-print information, such as indentation level and the stream.
+/* Finds the number and the elements of whatever kind of list a ListTagBase
+ * is, for those that have a tag per element.
  */
+class ListSize {
+public:
+	template<typename T>
+	size_t operator () (const ListTag<T> &tag) { return tag.values.size(); }
+	template<typename T>
+	size_t operator () (const T &UNUSED(tag)) { return 0; }
+};
 
-class PrettyPrinter {
+class ListElement {
 public:
-	PrettyPrinter(std::ostream &os, const std::string &indent) : m_stream(os), m_indent_count(), m_indent(indent) {}
+	explicit ListElement(size_t index) : m_index(index) {}
+
+	template<typename T>
+	const Tag *operator () (const ListTag<T> &tag) { return tag.values[m_index].get(); }
+	template<typename T>
+	const Tag *operator () (const ListTag<BasicTag<T>> &UNUSED(tag)) { return nullptr; }
+	template<typename T>
+	const Tag *operator () (const T &UNUSED(tag)) { return nullptr; }
 
-	void pretty_print(const RootTag &root_tag) {
-		print_tag(*root_tag.tag, Optional<Utf8String>(root_tag.name));
+private:
+	size_t m_index;
+};
+
+bool is_packed_list(const ListTagBase &tag) {
+	switch(tag.element_type()) {
+		case io::TAG_TYPE_BYTE:
+		case io::TAG_TYPE_SHORT:
+		case io::TAG_TYPE_INT:
+		case io::TAG_TYPE_LONG:
+		case io::TAG_TYPE_FLOAT:
+		case io::TAG_TYPE_DOUBLE:
+			return true;
+		default:
+			return false;
 	}
+}
+
+
+/* Walks a tree without recursing, so deep nesting can't overflow the
+ * stack, and hands each tag to a Style, which does the actual printing:
+ *
+ * - value(tag, name, first) for everything but compounds and lists with a
+ *   tag per element, which get
+ * - begin(tag, name, size, first) and end(tag, size).
+ *
+ * `name` is null for list elements, and `first` is whether the tag is the
+ * first in its compound or list. depth() is how many compounds and lists it
+ * is inside.
+ */
+template<typename Style>
+class Printer {
+public:
+	explicit Printer(std::ostream &os) : m_text(os), m_style(*this) {}
+
+	void print(const Tag &root, const Utf8String *name) {
+		start(root, name, true);
+		while(!m_stack.empty()) {
+			Frame &frame = m_stack.back();
+			if(frame.index == frame.size) {
+				const Tag &tag = *frame.tag;
+				size_t size = frame.size;
+				m_stack.pop_back();
+				m_style.end(tag, size);
+				continue;
+			}
+			bool first = frame.index == 0;
+			size_t index = frame.index++;
+			if(frame.tag->type() == io::TAG_TYPE_COMPOUND) {
+				const CompoundTag &compound = static_cast<const CompoundTag &>(*frame.tag);
+				const CompoundTag::container_type::value_type &entry = *(compound.values.begin() + index);
+				start(checked(entry.second.get()), &entry.first, first);
+			} else {
+				const ListTagBase &list = static_cast<const ListTagBase &>(*frame.tag);
+				start(checked(visit(list, ListElement(index))), nullptr, first);
+			}
+		}
+		m_text.flush();
+	}
+
+	TextBuffer &text() { return m_text; }
+	size_t depth() const { return m_stack.size(); }
 
 private:
+	struct Frame {
+		const Tag *tag;
+		size_t index;
+		size_t size;
+	};
+
+	static const Tag &checked(const Tag *tag) {
+		if(tag == nullptr) {
+			throw std::logic_error("Printing found a null tag.");
+		}
+		return *tag;
+	}
 
-	void print_indent() {
-		for(unsigned int i = 0; i < m_indent_count; ++i) {
-			m_stream << m_indent;
+	void start(const Tag &tag, const Utf8String *name, bool first) {
+		size_t size;
+		if(tag.type() == io::TAG_TYPE_COMPOUND) {
+			size = static_cast<const CompoundTag &>(tag).values.size();
+		} else if(tag.type() == io::TAG_TYPE_LIST && !is_packed_list(static_cast<const ListTagBase &>(tag))) {
+			size = visit(tag, ListSize());
+		} else {
+			m_style.value(tag, name, first);
+			return;
 		}
+		m_style.begin(tag, name, size, first);
+		Frame frame = {&tag, 0, size};
+		m_stack.push_back(frame);
+	}
+
+	TextBuffer m_text;
+	Style m_style;
+	std::vector<Frame> m_stack;
+};
+
+
+/* The indented, one-tag-a-line format of pretty_print. */
+class PrettyStyle {
+public:
+	explicit PrettyStyle(Printer<PrettyStyle> &printer) : m_printer(printer), m_text(printer.text()) {}
+
+	void value(const Tag &tag, const Utf8String *name, bool UNUSED(first)) {
+		preamble(tag, name);
+		visit(tag, ValuePrinter(*this));
 	}
 
-	std::string to_string(const Utf8String &s) {
-		if(s.data.empty()) {
-			return "";
+	void begin(const Tag &tag, const Utf8String *name, size_t size, bool UNUSED(first)) {
+		preamble(tag, name);
+		if(tag.type() == io::TAG_TYPE_COMPOUND) {
+			m_text.put(' ');
+			m_text.put_unsigned(size);
+			m_text.put(" entries\n");
 		} else {
-			// NOTE: This is a hack.
-			return std::string(reinterpret_cast<const char *>(&s.data[0]), s.data.size());
+			m_text.put_unsigned(size);
+			m_text.put(" entries of type ");
+			m_text.put(tag_type_name(static_cast<const ListTagBase &>(tag).element_type()));
+			m_text.put('\n');
 		}
+		indent(m_printer.depth());
+		m_text.put("{\n");
 	}
 
-	template<typename T>
-	void print_preamble(const Optional<Utf8String> &name) {
-		print_indent();
-		m_stream << TagNameLookup<T>::name;
-		if(name.has_value()) {
-			m_stream << "(\"" << to_string(name.value()) << "\")";
+	void end(const Tag &UNUSED(tag), size_t UNUSED(size)) {
+		indent(m_printer.depth());
+		m_text.put("}\n");
+	}
+
+private:
+	class ValuePrinter {
+	public:
+		explicit ValuePrinter(PrettyStyle &style) : m_style(style), m_text(style.m_text) {}
+
+		template<typename T>
+		void operator () (const BasicTag<T> &tag) {
+			m_text.put(' ');
+			m_style.number(tag.value);
+			m_text.put('\n');
+		}
+
+		void operator () (const ByteArrayTag &tag) {
+			m_text.put(" [");
+			m_text.put_unsigned(tag.value.size());
+			m_text.put(" bytes]\n");
+		}
+
+		void operator () (const StringTag &tag) {
+			m_text.put(' ');
+			m_text.put(tag.value);
+			m_text.put('\n');
+		}
+
+		template<typename T>
+		void operator () (const ListTag<BasicTag<T>> &tag) {
+			size_t depth = m_style.m_printer.depth();
+			const char *element_name = tag_type_name(tag.element_type());
+			m_text.put_unsigned(tag.values.size());
+			m_text.put(" entries of type ");
+			m_text.put(element_name);
+			m_text.put('\n');
+			m_style.indent(depth);
+			m_text.put("{\n");
+			for(const T &value : tag.values) {
+				m_style.indent(depth + 1);
+				m_text.put(element_name);
+				m_text.put(": ");
+				m_style.number(value);
+				m_text.put('\n');
+			}
+			m_style.indent(depth);
+			m_text.put("}\n");
 		}
-		m_stream << ':';
+
+		// Only packed lists come here; the others are begun and ended.
+		template<typename T>
+		void operator () (const ListTag<T> &UNUSED(tag)) {}
+
+		void operator () (const CompoundTag &UNUSED(tag)) {}
+
+		void operator () (const IntArrayTag &tag) {
+			m_text.put(" [");
+			m_text.put_unsigned(tag.values.size());
+			m_text.put(" ints]\n");
+		}
+
+		void operator () (const LongArrayTag &tag) {
+			m_text.put(" [");
+			m_text.put_unsigned(tag.values.size());
+			m_text.put(" longs]\n");
+		}
+
+	private:
+		PrettyStyle &m_style;
+		TextBuffer &m_text;
+	};
+
+	void preamble(const Tag &tag, const Utf8String *name) {
+		indent(m_printer.depth());
+		m_text.put(tag_type_name(tag.type()));
+		if(name) {
+			m_text.put("(\"", 2);
+			m_text.put(*name);
+			m_text.put("\")", 2);
+		}
+		m_text.put(':');
+	}
+
+	void indent(size_t depth) {
+		m_text.put_repeated("    ", 4, depth);
 	}
 
 	template<typename T>
-	void print_simple_tag(const T &tag, const Optional<Utf8String> &name) {
-		print_preamble<T>(name);
-		m_stream << ' ' << tag.value << '\n';
+	void number(T value) {
+		m_text.put_integer(value);
 	}
 
-	void print_byte_tag(const ByteTag &tag, const Optional<Utf8String> &name) {
-		print_preamble<ByteTag>(name);
-		m_stream << ' ' << static_cast<int>(tag.value) << '\n';
+	void number(float value) {
+		m_text.put_float(value, 6);
 	}
 
-	void print_byte_array_tag(const ByteArrayTag &tag, const Optional<Utf8String> &name) {
-		print_preamble<ByteArrayTag>(name);
-		m_stream << " [" << tag.value.size() << " bytes]\n";
+	void number(double value) {
+		m_text.put_float(value, 6);
 	}
 
-	void print_string_tag(const StringTag &tag, const Optional<Utf8String> &name) {
-		print_preamble<StringTag>(name);
-		m_stream << ' ' << to_string(tag.value) << '\n';
+	Printer<PrettyStyle> &m_printer;
+	TextBuffer &m_text;
+};
+
+
+/* SNBT, or with `json` set, JSON; both on a single line. */
+template<bool json>
+class CompactStyle {
+public:
+	explicit CompactStyle(Printer<CompactStyle> &printer) : m_text(printer.text()) {}
+
+	void value(const Tag &tag, const Utf8String *name, bool first) {
+		separator(name, first);
+		visit(tag, ValuePrinter(*this));
 	}
 
-	template<typename T>
-	void print_list_specific_tag(const ListTag<T> &tag, const Optional<Utf8String> &name) {
-		print_preamble<ListTagBase>(name);
-		m_stream << tag.values.size() << " entries of type " << TagNameLookup<T>::name << '\n';
-		print_indent();
-		m_stream << "{\n";
-		++m_indent_count;
-		for(const auto &entry : tag.values) {
-			print_tag(*entry, Optional<Utf8String>());
-		}
-		--m_indent_count;
-		print_indent();
-		m_stream << "}\n";
-	}
-
-	void print_list_tag(const ListTagBase &tag, const Optional<Utf8String> &name) {
-		#define INNER_LIST_TRY_TYPE(inner_type) \
-			const ListTag<inner_type> *inner_type##_pointer = dynamic_cast<const ListTag<inner_type> *>(&tag); \
-			if(inner_type##_pointer) { \
-				print_list_specific_tag(*inner_type##_pointer, name); \
-				return; \
-			}
-		INNER_LIST_TRY_TYPE(ByteTag)
-		INNER_LIST_TRY_TYPE(ShortTag)
-		INNER_LIST_TRY_TYPE(IntTag)
-		INNER_LIST_TRY_TYPE(LongTag)
-		INNER_LIST_TRY_TYPE(FloatTag)
-		INNER_LIST_TRY_TYPE(DoubleTag)
-		INNER_LIST_TRY_TYPE(StringTag)
-		INNER_LIST_TRY_TYPE(ListTagBase)
-		INNER_LIST_TRY_TYPE(CompoundTag)
-		INNER_LIST_TRY_TYPE(IntArrayTag)
-
-		#undef INNER_LIST_TRY_TYPE
-
-		throw std::runtime_error("print_list_tag was passed a Tag of a type it didn't recognize.");
-	}
-
-	void print_compound_tag(const CompoundTag &tag, const Optional<Utf8String> &name) {
-		print_preamble<CompoundTag>(name);
-		m_stream << ' ' << tag.values.size() << " entries\n";
-		print_indent();
-		m_stream << "{\n";
-		++m_indent_count;
-		for(const auto &entry : tag.values) {
-			print_tag(*entry.second, Optional<Utf8String>(entry.first));
-		}
-		--m_indent_count;
-		print_indent();
-		m_stream << "}\n";
-	}
-
-	void print_tag(const Tag &tag, const Optional<Utf8String> &name) {
-		const ByteTag *byte_tag = dynamic_cast<const ByteTag *>(&tag);
-		if(byte_tag) {
-			print_byte_tag(*byte_tag, name);
-			return;
+	void begin(const Tag &tag, const Utf8String *name, size_t UNUSED(size), bool first) {
+		separator(name, first);
+		m_text.put(tag.type() == io::TAG_TYPE_COMPOUND ? '{' : '[');
+	}
+
+	void end(const Tag &tag, size_t UNUSED(size)) {
+		m_text.put(tag.type() == io::TAG_TYPE_COMPOUND ? '}' : ']');
+	}
+
+private:
+	class ValuePrinter {
+	public:
+		explicit ValuePrinter(CompactStyle &style) : m_style(style), m_text(style.m_text) {}
+
+		template<typename T>
+		void operator () (const BasicTag<T> &tag) {
+			m_style.number(tag.value);
 		}
 
-		#define HANDLE_SIMPLE_TAG(tag_type, variable_name) \
-			const tag_type *simple_tag_##variable_name = dynamic_cast<const tag_type *>(&tag); \
-			if(simple_tag_##variable_name) { \
-				print_simple_tag(*simple_tag_##variable_name, name); \
-				return; \
-			}
-		HANDLE_SIMPLE_TAG(ShortTag, short_tag)
-		HANDLE_SIMPLE_TAG(IntTag, int_tag)
-		HANDLE_SIMPLE_TAG(LongTag, long_tag)
-		HANDLE_SIMPLE_TAG(FloatTag, float_tag)
-		HANDLE_SIMPLE_TAG(DoubleTag, double_tag)
+		void operator () (const ByteArrayTag &tag) {
+			m_style.array("[B;", tag.value.data(), tag.value.size());
+		}
 
-		#undef HANDLE_SIMPLE_TAG
+		void operator () (const StringTag &tag) {
+			m_style.string(tag.value);
+		}
 
-		const ByteArrayTag *ba_tag = dynamic_cast<const ByteArrayTag *>(&tag);
-		if(ba_tag) {
-			print_byte_array_tag(*ba_tag, name);
-			return;
+		template<typename T>
+		void operator () (const ListTag<BasicTag<T>> &tag) {
+			m_style.array("[", tag.values.data(), tag.values.size());
 		}
 
-		const ListTagBase *list_tag = dynamic_cast<const ListTagBase *>(&tag);
-		if(list_tag) {
-			print_list_tag(*list_tag, name);
-			return;
+		// Only packed lists come here; the others are begun and ended.
+		template<typename T>
+		void operator () (const ListTag<T> &UNUSED(tag)) {}
+
+		void operator () (const CompoundTag &UNUSED(tag)) {}
+
+		void operator () (const IntArrayTag &tag) {
+			m_style.array("[I;", tag.values.data(), tag.values.size());
 		}
 
-		const StringTag *str_tag = dynamic_cast<const StringTag *>(&tag);
-		if(str_tag) {
-			print_string_tag(*str_tag, name);
-			return;
+		void operator () (const LongArrayTag &tag) {
+			m_style.array("[L;", tag.values.data(), tag.values.size());
 		}
 
-		const CompoundTag *ct = dynamic_cast<const CompoundTag *>(&tag);
-		if(ct) {
-			print_compound_tag(*ct, name);
-			return;
+	private:
+		CompactStyle &m_style;
+		TextBuffer &m_text;
+	};
+
+	void separator(const Utf8String *name, bool first) {
+		if(!first) {
+			m_text.put(',');
+		}
+		if(name) {
+			if(json || !bare_key(*name)) {
+				string(*name);
+			} else {
+				m_text.put(*name);
+			}
+			m_text.put(':');
+		}
+	}
+
+	// What SNBT allows unquoted.
+	static bool bare_key(const Utf8String &name) {
+		if(name.data.empty()) {
+			return false;
+		}
+		for(unsigned char c : name.data) {
+			bool allowed = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+				c == '_' || c == '-' || c == '.' || c == '+';
+			if(!allowed) {
+				return false;
+			}
 		}
+		return true;
+	}
 
-		throw std::runtime_error("print_tag was passed a Tag of a type it didn't recognize.");
+	void string(const Utf8String &s) {
+		const char *begin = reinterpret_cast<const char *>(s.data.data());
+		const char *end = begin + s.data.size();
+		m_text.put('"');
+		// Copy runs of plain characters in one go.
+		const char *run = begin;
+		for(const char *p = begin; p != end; ++p) {
+			unsigned char c = *p;
+			bool control = json && c < 0x20;
+			if(c != '"' && c != '\\' && !control) {
+				continue;
+			}
+			m_text.put(run, p - run);
+			run = p + 1;
+			if(!control) {
+				m_text.put('\\');
+				m_text.put(*p);
+				continue;
+			}
+			switch(c) {
+				case '\n': m_text.put("\\n", 2); break;
+				case '\r': m_text.put("\\r", 2); break;
+				case '\t': m_text.put("\\t", 2); break;
+				case '\b': m_text.put("\\b", 2); break;
+				case '\f': m_text.put("\\f", 2); break;
+				default: {
+					char escape[7];
+					std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+					m_text.put(escape, 6);
+				}
+			}
+		}
+		m_text.put(run, end - run);
+		m_text.put('"');
 	}
 
+	// [B; and so on are SNBT's; JSON gets a plain array.
+	template<typename T>
+	void array(const char *snbt_open, const T *values, size_t size) {
+		m_text.put(json ? "[" : snbt_open);
+		for(size_t i = 0; i < size; ++i) {
+			if(i) {
+				m_text.put(',');
+			}
+			number(values[i]);
+		}
+		m_text.put(']');
+	}
 
-	std::ostream &m_stream;
-	unsigned int m_indent_count;
-	std::string m_indent;
+	void suffix(char c) {
+		if(!json) {
+			m_text.put(c);
+		}
+	}
+
+	void number(unsigned char value) {
+		m_text.put_integer(static_cast<int8_t>(value));
+		suffix('b');
+	}
+
+	void number(int8_t value) {
+		m_text.put_integer(value);
+		suffix('b');
+	}
+
+	void number(int16_t value) {
+		m_text.put_integer(value);
+		suffix('s');
+	}
+
+	void number(int32_t value) {
+		m_text.put_integer(value);
+	}
+
+	void number(int64_t value) {
+		m_text.put_integer(value);
+		suffix('L');
+	}
+
+	void number(float value) {
+		floating(value);
+		suffix('f');
+	}
+
+	void number(double value) {
+		floating(value);
+		suffix('d');
+	}
+
+	/* JSON has no infinities or NaNs, so they're null there; in SNBT
+	 * they're what Minecraft writes for them, though it can't read them.
+	 */
+	template<typename T>
+	void floating(T value) {
+		if(std::isfinite(value)) {
+			m_text.put_shortest_float(value);
+		} else if(json) {
+			m_text.put("null", 4);
+		} else if(std::isnan(value)) {
+			m_text.put("NaN", 3);
+		} else {
+			m_text.put(value < 0 ? "-Infinity" : "Infinity");
+		}
+	}
+
+	TextBuffer &m_text;
 };
 
+template<typename Style>
+void print_root(std::ostream &os, const RootTag &root_tag, bool with_name) {
+	if(!root_tag.tag) {
+		return;
+	}
+	Printer<Style> printer(os);
+	printer.print(*root_tag.tag, with_name ? &root_tag.name : nullptr);
+}
+
+}
+
 
 /* The public interface.
  */
 void pretty_print(std::ostream &os, const RootTag &root_tag) {
-	PrettyPrinter pp(os, "    ");
-	pp.pretty_print(root_tag);
+	print_root<PrettyStyle>(os, root_tag, true);
+}
+
+void write_snbt(std::ostream &os, const RootTag &root_tag) {
+	print_root<CompactStyle<false>>(os, root_tag, false);
+}
+
+void write_json(std::ostream &os, const RootTag &root_tag) {
+	print_root<CompactStyle<true>>(os, root_tag, false);
 }
 
 }
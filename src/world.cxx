@@ -0,0 +1,285 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "nbt.h"
+
+
+namespace nbt {
+namespace io {
+
+namespace {
+	/* How many chunks a thread takes on at once. Small enough that a
+	 * region's worth of work spreads over several threads, big enough
+	 * that they aren't forever stealing.
+	 */
+	const size_t CHUNK_BATCH_SIZE = 32;
+
+	/* Either a region file still to be opened (region is null), which
+	 * turns into batches of its chunks, or one of those batches.
+	 */
+	struct Task {
+		const std::string *path;
+		std::shared_ptr<RegionFile> region;
+		size_t first_chunk;
+		size_t last_chunk;
+	};
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		Arena arena;
+		// Names repeat from one chunk to the next, so this lives for the
+		// whole load.
+		NameTable names;
+		// Made on first use, then reset for every chunk.
+		std::unique_ptr<InflateInputStream> inflate;
+		// Added to LoadOptions::stats once the load is over.
+		ReadStats stats;
+	};
+
+	class Load {
+	public:
+		Load(size_t thread_count, const ChunkCallback &callback, const LoadOptions &options) :
+			m_workers(thread_count), m_outstanding(0), m_stopping(false), m_pushed(0),
+			m_callback(callback), m_options(options)
+		{
+			for(auto &worker : m_workers) {
+				worker.reset(new Worker());
+				if(options.stats) {
+					worker->stats.on_document = options.stats->on_document;
+				}
+			}
+		}
+
+		void push(size_t worker_index, const Task &task) {
+			++m_outstanding;
+			{
+				std::lock_guard<std::mutex> lock(m_workers[worker_index]->mutex);
+				m_workers[worker_index]->tasks.push_back(task);
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_idle_mutex);
+				++m_pushed;
+			}
+			m_idle.notify_one();
+		}
+
+		void run(size_t worker_index) {
+			Task task;
+			while(next_task(worker_index, task)) {
+				if(!m_stopping) {
+					if(task.region) {
+						read_chunks(*m_workers[worker_index], task);
+					} else {
+						open_region(worker_index, task);
+					}
+				}
+				if(--m_outstanding == 0) {
+					std::lock_guard<std::mutex> lock(m_idle_mutex);
+					m_idle.notify_all();
+				}
+			}
+		}
+
+		// Drops whatever is left to do.
+		void stop() {
+			m_stopping = true;
+		}
+
+		void add_stats() {
+			if(m_options.stats) {
+				for(auto &worker : m_workers) {
+					m_options.stats->add(worker->stats);
+				}
+			}
+		}
+
+		void rethrow() {
+			if(m_error) {
+				std::rethrow_exception(m_error);
+			}
+		}
+
+	private:
+		/* Takes the newest of our own tasks, or failing that the oldest of
+		 * someone else's; waits if there's still work in flight that might
+		 * turn into more tasks.
+		 */
+		bool next_task(size_t worker_index, Task &task) {
+			while(true) {
+				size_t pushed;
+				{
+					std::lock_guard<std::mutex> lock(m_idle_mutex);
+					pushed = m_pushed;
+				}
+				for(size_t i = 0; i < m_workers.size(); ++i) {
+					Worker &worker = *m_workers[(worker_index + i) % m_workers.size()];
+					std::lock_guard<std::mutex> lock(worker.mutex);
+					if(!worker.tasks.empty()) {
+						if(i == 0) {
+							task = worker.tasks.back();
+							worker.tasks.pop_back();
+						} else {
+							task = worker.tasks.front();
+							worker.tasks.pop_front();
+						}
+						return true;
+					}
+				}
+				// Anything pushed since the scan began might have been missed.
+				std::unique_lock<std::mutex> lock(m_idle_mutex);
+				m_idle.wait(lock, [&] { return m_pushed != pushed || m_outstanding == 0; });
+				if(m_outstanding == 0) {
+					return false;
+				}
+			}
+		}
+
+		void open_region(size_t worker_index, const Task &task) {
+			std::shared_ptr<RegionFile> region;
+			try {
+				region = std::make_shared<RegionFile>(*task.path);
+			} catch(...) {
+				fail(*task.path, RegionFile::CHUNK_COUNT, std::current_exception());
+				return;
+			}
+			for(size_t first = 0; first < RegionFile::CHUNK_COUNT; first += CHUNK_BATCH_SIZE) {
+				Task batch = {task.path, region, first, first + CHUNK_BATCH_SIZE};
+				push(worker_index, batch);
+			}
+		}
+
+		void read_chunks(Worker &worker, const Task &task) {
+			for(size_t index = task.first_chunk; index < task.last_chunk && !m_stopping; ++index) {
+				try {
+					read_chunk(worker, *task.region, *task.path, index);
+				} catch(...) {
+					fail(*task.path, index, std::current_exception());
+				}
+				worker.arena.reset();
+			}
+		}
+
+		void read_chunk(Worker &worker, const RegionFile &region, const std::string &path, size_t index) {
+			if(!region.has_chunk(index)) {
+				return;
+			}
+			if(m_options.filter && !m_options.filter(path, index, region)) {
+				return;
+			}
+			RegionFile::ChunkData chunk = region.chunk_data(index);
+			ReadOptions read_options;
+			read_options.projection = m_options.projection;
+			if(m_options.use_arenas) {
+				read_options.arena = &worker.arena;
+				read_options.names = &worker.names;
+			}
+			if(m_options.stats) {
+				read_options.stats = &worker.stats;
+			}
+			{
+				RootTag root;
+				switch(chunk.compression) {
+					case RegionFile::CHUNK_GZIP:
+					case RegionFile::CHUNK_ZLIB: {
+						CompressionFormat format = chunk.compression == RegionFile::CHUNK_GZIP ?
+							COMPRESSION_GZIP : COMPRESSION_ZLIB;
+						if(!worker.inflate) {
+							worker.inflate.reset(new InflateInputStream(chunk.data, chunk.size, format));
+						} else {
+							worker.inflate->reset(chunk.data, chunk.size, format);
+						}
+						root = read_nbt(*worker.inflate, read_options);
+						break;
+					}
+					case RegionFile::CHUNK_UNCOMPRESSED: {
+						MemoryInputStream s(chunk.data, chunk.size);
+						root = read_nbt(s, read_options);
+						break;
+					}
+					default:
+						throw IoError("Unsupported region file chunk compression.");
+				}
+				m_callback(path, index, root);
+			}
+		}
+
+		void fail(const std::string &path, size_t index, std::exception_ptr error) {
+			if(m_options.on_error) {
+				try {
+					m_options.on_error(path, index, error);
+					return;
+				} catch(...) {
+					error = std::current_exception();
+				}
+			}
+			std::lock_guard<std::mutex> lock(m_error_mutex);
+			if(!m_error) {
+				m_error = error;
+			}
+			m_stopping = true;
+		}
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::atomic<size_t> m_outstanding;
+		std::atomic<bool> m_stopping;
+		/* Idle threads wait on m_idle for m_pushed or m_outstanding to
+		 * change, so that notifies them with m_idle_mutex taken in between.
+		 */
+		std::mutex m_idle_mutex;
+		std::condition_variable m_idle;
+		size_t m_pushed;
+		std::mutex m_error_mutex;
+		std::exception_ptr m_error;
+		const ChunkCallback &m_callback;
+		const LoadOptions &m_options;
+	};
+}
+
+void load_regions(const std::vector<std::string> &region_paths, const ChunkCallback &callback) {
+	load_regions(region_paths, callback, LoadOptions());
+}
+
+void load_regions(const std::vector<std::string> &region_paths, const ChunkCallback &callback,
+	const LoadOptions &options)
+{
+	size_t thread_count = options.thread_count;
+	if(thread_count == 0) {
+		thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	Load load(thread_count, callback, options);
+	for(size_t i = 0; i < region_paths.size(); ++i) {
+		Task task = {&region_paths[i], nullptr, 0, 0};
+		load.push(i % thread_count, task);
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(thread_count - 1);
+	try {
+		for(size_t i = 1; i < thread_count; ++i) {
+			threads.push_back(std::thread(&Load::run, &load, i));
+		}
+	} catch(...) {
+		// The threads already started still have to finish before they go.
+		load.stop();
+		load.run(0);
+		for(auto &thread : threads) {
+			thread.join();
+		}
+		throw;
+	}
+	load.run(0);
+	for(auto &thread : threads) {
+		thread.join();
+	}
+	load.add_stats();
+	load.rethrow();
+}
+
+}
+}
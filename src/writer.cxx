@@ -0,0 +1,554 @@
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "nbt.h"
+#include "byteswap.h"
+#include "writer.h"
+
+
+namespace nbt {
+namespace io {
+namespace detail {
+
+	template<typename T, size_t size>
+	void write_big_endian_unsigned_int(OutputStream &s, T n) {
+		unsigned char data[size];
+		for(size_t i = 0; i < size; ++i) {
+			data[size - 1 - i] = static_cast<unsigned char>(n >> (i * 8));
+		}
+		s.write_buffered(data, size);
+	}
+
+	/* The raw bits of a value, to be written big-endian. As on the read side,
+	 * this assumes two's complement integers and IEEE floats.
+	 */
+	template<typename RawType, typename T>
+	RawType encode_value(T value) {
+		static_assert(sizeof(RawType) == sizeof(T), "Raw and encoded types must be the same size.");
+		RawType raw;
+		std::memcpy(&raw, &value, sizeof(raw));
+		return raw;
+	}
+
+	template<typename T>
+	struct RawTypeOf;
+	template<> struct RawTypeOf<int8_t> { typedef uint8_t type; };
+	template<> struct RawTypeOf<int16_t> { typedef uint16_t type; };
+	template<> struct RawTypeOf<int32_t> { typedef uint32_t type; };
+	template<> struct RawTypeOf<int64_t> { typedef uint64_t type; };
+	template<> struct RawTypeOf<float> { typedef uint32_t type; };
+	template<> struct RawTypeOf<double> { typedef uint64_t type; };
+
+	template<typename T>
+	void write_value(OutputStream &s, T value) {
+		typedef typename RawTypeOf<T>::type RawType;
+		write_big_endian_unsigned_int<RawType, sizeof(RawType)>(s, encode_value<RawType>(value));
+	}
+
+	/* Writes `count` values in bulk: straight into the stream's buffer if it
+	 * has room, and a chunk at a time through a bounce buffer if not.
+	 */
+	template<typename T>
+	void write_packed_values(OutputStream &s, const T *values, size_t count) {
+		if(count == 0) {
+			return;
+		}
+		size_t size = count * sizeof(T);
+		unsigned char *claimed = s.claim(size);
+		if(claimed) {
+			std::memcpy(claimed, values, size);
+			nbt::detail::byteswap_big_endian(claimed, count, sizeof(T));
+			return;
+		}
+
+		unsigned char chunk[4096];
+		const size_t per_chunk = sizeof(chunk) / sizeof(T);
+		for(size_t done = 0; done < count;) {
+			size_t n = std::min(per_chunk, count - done);
+			std::memcpy(chunk, values + done, n * sizeof(T));
+			nbt::detail::byteswap_big_endian(chunk, n, sizeof(T));
+			s.write_buffered(chunk, n * sizeof(T));
+			done += n;
+		}
+	}
+
+	void write_length(OutputStream &s, size_t length) {
+		if(length > 0x7fffffff) {
+			throw IoError("Array or list too long to write as NBT.");
+		}
+		write_big_endian_unsigned_int<uint32_t, 4>(s, static_cast<uint32_t>(length));
+	}
+
+	void write_string(OutputStream &s, const Utf8String &string) {
+		if(string.data.size() > 0xffff) {
+			throw IoError("String too long to write as NBT.");
+		}
+		write_big_endian_unsigned_int<uint16_t, 2>(s, static_cast<uint16_t>(string.data.size()));
+		s.write_buffered(string.data.data(), string.data.size());
+	}
+
+	/* The element type to write for a list. ListTag<Tag> only stays
+	 * TAG_End while it's empty.
+	 */
+	template<typename T>
+	TagTypeId written_element_type(const ListTag<T> &tag) {
+		if(tag.element_type() == TAG_TYPE_END && !tag.values.empty()) {
+			return TAG_TYPE_LIST;
+		}
+		return tag.element_type();
+	}
+
+	/* Like reading, writing keeps an explicit stack of states rather than
+	 * recursing, so deep trees can't overflow the call stack.
+	 */
+	class TagWriteState;
+	typedef std::vector<std::unique_ptr<TagWriteState>> IoWriteState;
+	class TagWriteState {
+	public:
+		virtual ~TagWriteState() {};
+		virtual void continue_write(OutputStream &s, IoWriteState &io_state) = 0;
+	};
+
+	void write_payload(OutputStream &s, const Tag &tag, IoWriteState &io_state);
+
+	class WriteCompoundTagState : public TagWriteState {
+	public:
+		WriteCompoundTagState(const CompoundTag &tag) :
+			m_position(tag.values.begin()), m_end(tag.values.end()) {}
+
+		void continue_write(OutputStream &s, IoWriteState &io_state) {
+			if(m_position == m_end) {
+				write_big_endian_unsigned_int<unsigned char, 1>(s, TAG_TYPE_END);
+				io_state.pop_back();
+				return;
+			}
+			const Utf8String &name = m_position->first;
+			const Tag *tag = m_position->second.get();
+			++m_position;
+			if(tag == nullptr) {
+				throw std::logic_error("write_nbt found a null tag in a CompoundTag.");
+			}
+			write_big_endian_unsigned_int<unsigned char, 1>(s, tag->type());
+			write_string(s, name);
+			write_payload(s, *tag, io_state);
+		}
+
+	private:
+		CompoundTag::container_type::const_iterator m_position;
+		CompoundTag::container_type::const_iterator m_end;
+	};
+
+	template<typename T>
+	class WriteListTagState : public TagWriteState {
+	public:
+		WriteListTagState(const ListTag<T> &tag) : m_tag(tag), m_index(0) {}
+
+		void continue_write(OutputStream &s, IoWriteState &io_state) {
+			if(m_index == m_tag.values.size()) {
+				io_state.pop_back();
+				return;
+			}
+			const Tag *tag = m_tag.values[m_index].get();
+			++m_index;
+			if(tag == nullptr) {
+				throw std::logic_error("write_nbt found a null tag in a ListTag.");
+			}
+			if(tag->type() != ListElementTypeOf<T>::value) {
+				throw std::logic_error("write_nbt found a tag in a ListTag of a different type.");
+			}
+			write_payload(s, *tag, io_state);
+		}
+
+	private:
+		const ListTag<T> &m_tag;
+		size_t m_index;
+	};
+
+	class PayloadWriter {
+	public:
+		PayloadWriter(OutputStream &s, IoWriteState &io_state) : m_stream(s), m_io_state(io_state) {}
+
+		template<typename T>
+		void operator () (const BasicTag<T> &tag) {
+			write_value(m_stream, tag.value);
+		}
+
+		void operator () (const ByteArrayTag &tag) {
+			write_length(m_stream, tag.value.size());
+			m_stream.write_buffered(tag.value.data(), tag.value.size());
+		}
+
+		void operator () (const StringTag &tag) {
+			write_string(m_stream, tag.value);
+		}
+
+		template<typename T>
+		void operator () (const ListTag<BasicTag<T>> &tag) {
+			write_big_endian_unsigned_int<unsigned char, 1>(m_stream, tag.element_type());
+			write_length(m_stream, tag.values.size());
+			write_packed_values(m_stream, tag.values.data(), tag.values.size());
+		}
+
+		template<typename T>
+		void operator () (const ListTag<T> &tag) {
+			write_big_endian_unsigned_int<unsigned char, 1>(m_stream, written_element_type(tag));
+			write_length(m_stream, tag.values.size());
+			m_io_state.push_back(std::unique_ptr<TagWriteState>(new WriteListTagState<T>(tag)));
+		}
+
+		void operator () (const CompoundTag &tag) {
+			m_io_state.push_back(std::unique_ptr<TagWriteState>(new WriteCompoundTagState(tag)));
+		}
+
+		void operator () (const IntArrayTag &tag) {
+			write_length(m_stream, tag.values.size());
+			write_packed_values(m_stream, tag.values.data(), tag.values.size());
+		}
+
+		void operator () (const LongArrayTag &tag) {
+			write_length(m_stream, tag.values.size());
+			write_packed_values(m_stream, tag.values.data(), tag.values.size());
+		}
+
+	private:
+		OutputStream &m_stream;
+		IoWriteState &m_io_state;
+	};
+
+	/* Writes everything about a tag but its type and name. Compounds and
+	 * lists push a state, which writes their contents.
+	 */
+	void write_payload(OutputStream &s, const Tag &tag, IoWriteState &io_state) {
+		visit(tag, PayloadWriter(s, io_state));
+	}
+
+	void process_write_state(OutputStream &s, IoWriteState &io_state) {
+		while(!io_state.empty()) {
+			io_state[io_state.size() - 1]->continue_write(s, io_state);
+		}
+	}
+
+	void write_type_and_name(OutputStream &s, TagTypeId tag_type, const Utf8String &name) {
+		write_big_endian_unsigned_int<unsigned char, 1>(s, tag_type);
+		write_string(s, name);
+	}
+
+	void write_tag_payload(OutputStream &s, const Tag &tag) {
+		IoWriteState io_state;
+		write_payload(s, tag, io_state);
+		process_write_state(s, io_state);
+	}
+
+	/* Adds up the size of a tag's payload, queueing up any children it has
+	 * rather than recursing into them.
+	 */
+	class PayloadSizer {
+	public:
+		PayloadSizer(size_t &size, std::vector<const Tag *> &pending) : m_size(size), m_pending(pending) {}
+
+		template<typename T>
+		void operator () (const BasicTag<T> &) {
+			m_size += sizeof(T);
+		}
+
+		void operator () (const ByteArrayTag &tag) {
+			m_size += 4 + tag.value.size();
+		}
+
+		void operator () (const StringTag &tag) {
+			m_size += 2 + tag.value.data.size();
+		}
+
+		template<typename T>
+		void operator () (const ListTag<BasicTag<T>> &tag) {
+			m_size += 5 + tag.values.size() * sizeof(T);
+		}
+
+		template<typename T>
+		void operator () (const ListTag<T> &tag) {
+			m_size += 5;
+			for(const auto &entry : tag.values) {
+				m_pending.push_back(entry.get());
+			}
+		}
+
+		void operator () (const CompoundTag &tag) {
+			// The children, and then TAG_End.
+			m_size += 1;
+			for(const auto &entry : tag.values) {
+				m_size += 3 + entry.first.data.size();
+				m_pending.push_back(entry.second.get());
+			}
+		}
+
+		void operator () (const IntArrayTag &tag) {
+			m_size += 4 + tag.values.size() * 4;
+		}
+
+		void operator () (const LongArrayTag &tag) {
+			m_size += 4 + tag.values.size() * 8;
+		}
+
+	private:
+		size_t &m_size;
+		std::vector<const Tag *> &m_pending;
+	};
+
+	// What patch_nbt() throws, to itself, on finding the shapes differ.
+	struct ShapeMismatch {};
+
+	/* Walks an encoded document and a tree side by side, collecting the
+	 * bytes where they differ, as patch_nbt() describes. Like writing, it
+	 * keeps a stack rather than recursing.
+	 */
+	class Patcher {
+	public:
+		Patcher(const unsigned char *data, size_t size) : m_stream(data, size), m_data(data) {}
+
+		void run(const RootTag &root_tag) {
+			if(!root_tag.tag) {
+				throw ShapeMismatch();
+			}
+			if(read_big_endian_unsigned_int<unsigned char, 1>(m_stream) != root_tag.tag->type()) {
+				throw ShapeMismatch();
+			}
+			string(root_tag.name);
+			visit(*root_tag.tag, *this);
+			while(!m_stack.empty()) {
+				Frame &frame = m_stack.back();
+				if(frame.tag->type() == TAG_TYPE_COMPOUND) {
+					continue_compound(frame);
+				} else {
+					continue_list(frame);
+				}
+			}
+		}
+
+		void apply(unsigned char *data, std::vector<ByteRange> &changed) const {
+			const unsigned char *bytes = m_bytes.data();
+			for(const ByteRange &range : m_ranges) {
+				std::memcpy(data + range.offset, bytes, range.size);
+				bytes += range.size;
+			}
+			changed.insert(changed.end(), m_ranges.begin(), m_ranges.end());
+		}
+
+		// For visit(): compares a tag's payload, or queues up its children.
+		template<typename T>
+		void operator () (const BasicTag<T> &tag) {
+			typedef typename RawTypeOf<T>::type RawType;
+			RawType raw = encode_value<RawType>(tag.value);
+			unsigned char encoded[sizeof(T)];
+			for(size_t i = 0; i < sizeof(T); ++i) {
+				encoded[sizeof(T) - 1 - i] = static_cast<unsigned char>(raw >> (i * 8));
+			}
+			compare(encoded, sizeof(T));
+		}
+
+		void operator () (const ByteArrayTag &tag) {
+			length(tag.value.size());
+			compare(tag.value.data(), tag.value.size());
+		}
+
+		void operator () (const StringTag &tag) {
+			string(tag.value);
+		}
+
+		template<typename T>
+		void operator () (const ListTag<BasicTag<T>> &tag) {
+			element_type(tag.element_type());
+			length(tag.values.size());
+			compare_packed(tag.values.data(), tag.values.size());
+		}
+
+		template<typename T>
+		void operator () (const ListTag<T> &tag) {
+			element_type(written_element_type(tag));
+			length(tag.values.size());
+			Frame frame = {&tag, 0, &Patcher::list_element<T>};
+			m_stack.push_back(frame);
+		}
+
+		void operator () (const CompoundTag &tag) {
+			Frame frame = {&tag, 0, nullptr};
+			m_stack.push_back(frame);
+		}
+
+		void operator () (const IntArrayTag &tag) {
+			length(tag.values.size());
+			compare_packed(tag.values.data(), tag.values.size());
+		}
+
+		void operator () (const LongArrayTag &tag) {
+			length(tag.values.size());
+			compare_packed(tag.values.data(), tag.values.size());
+		}
+
+	private:
+		struct Frame {
+			const Tag *tag;
+			// Children seen so far.
+			size_t index;
+			// For lists, the child at an index, if it's there.
+			const Tag *(*element)(const Tag &list, size_t index);
+		};
+
+		template<typename T>
+		static const Tag *list_element(const Tag &list, size_t index) {
+			const ListTag<T> &tag = static_cast<const ListTag<T> &>(list);
+			return index < tag.values.size() ? tag.values[index].get() : nullptr;
+		}
+
+		void continue_compound(Frame &frame) {
+			const CompoundMap &values = static_cast<const CompoundTag &>(*frame.tag).values;
+			TagTypeId tag_type = read_big_endian_unsigned_int<unsigned char, 1>(m_stream);
+			if(tag_type == TAG_TYPE_END) {
+				if(frame.index != values.size()) {
+					throw ShapeMismatch();
+				}
+				m_stack.pop_back();
+				return;
+			}
+			size_t name_length = read_big_endian_unsigned_int<uint16_t, 2>(m_stream);
+			const unsigned char *name = lend(name_length);
+			CompoundMap::const_iterator child = values.find(reinterpret_cast<const char *>(name), name_length);
+			if(child == values.end() || !child->second || child->second->type() != tag_type) {
+				throw ShapeMismatch();
+			}
+			++frame.index;
+			visit(*child->second, *this);
+		}
+
+		void continue_list(Frame &frame) {
+			const Tag *element = frame.element(*frame.tag, frame.index);
+			if(!element) {
+				// Lengths were checked already, so this is the end.
+				m_stack.pop_back();
+				return;
+			}
+			++frame.index;
+			visit(*element, *this);
+		}
+
+		void element_type(TagTypeId tag_type) {
+			if(read_big_endian_unsigned_int<unsigned char, 1>(m_stream) != tag_type) {
+				throw ShapeMismatch();
+			}
+		}
+
+		void length(size_t size) {
+			if(read_big_endian_unsigned_int<uint32_t, 4>(m_stream) != size) {
+				throw ShapeMismatch();
+			}
+		}
+
+		void string(const Utf8String &string) {
+			if(read_big_endian_unsigned_int<uint16_t, 2>(m_stream) != string.data.size()) {
+				throw ShapeMismatch();
+			}
+			compare(string.data.data(), string.data.size());
+		}
+
+		const unsigned char *lend(size_t size) {
+			const unsigned char *bytes = m_stream.lend(size);
+			if(!bytes) {
+				throw PrematureEof();
+			}
+			return bytes;
+		}
+
+		// Notes where the next `size` bytes differ from `expected`.
+		void compare(const unsigned char *expected, size_t size) {
+			const unsigned char *actual = lend(size);
+			if(std::memcmp(actual, expected, size) == 0) {
+				return;
+			}
+			size_t i = 0;
+			while(i < size) {
+				if(actual[i] == expected[i]) {
+					++i;
+					continue;
+				}
+				size_t start = i;
+				while(i < size && actual[i] != expected[i]) {
+					++i;
+				}
+				add_range(actual + start - m_data, expected + start, i - start);
+			}
+		}
+
+		template<typename T>
+		void compare_packed(const T *values, size_t count) {
+			unsigned char chunk[4096];
+			const size_t per_chunk = sizeof(chunk) / sizeof(T);
+			for(size_t done = 0; done < count;) {
+				size_t n = std::min(per_chunk, count - done);
+				std::memcpy(chunk, values + done, n * sizeof(T));
+				nbt::detail::byteswap_big_endian(chunk, n, sizeof(T));
+				compare(chunk, n * sizeof(T));
+				done += n;
+			}
+		}
+
+		void add_range(size_t offset, const unsigned char *bytes, size_t size) {
+			if(!m_ranges.empty() && m_ranges.back().offset + m_ranges.back().size == offset) {
+				m_ranges.back().size += size;
+			} else {
+				ByteRange range = {offset, size};
+				m_ranges.push_back(range);
+			}
+			m_bytes.insert(m_bytes.end(), bytes, bytes + size);
+		}
+
+		MemoryInputStream m_stream;
+		const unsigned char *m_data;
+		std::vector<Frame> m_stack;
+		std::vector<ByteRange> m_ranges;
+		// What goes in each of m_ranges, one after another.
+		std::vector<unsigned char> m_bytes;
+	};
+}
+
+bool patch_nbt(unsigned char *data, size_t size, const RootTag &root_tag, std::vector<ByteRange> &changed) {
+	detail::Patcher patcher(data, size);
+	try {
+		patcher.run(root_tag);
+	} catch(detail::ShapeMismatch &) {
+		return false;
+	}
+	patcher.apply(data, changed);
+	return true;
+}
+
+size_t encoded_size(const RootTag &root_tag) {
+	if(!root_tag.tag) {
+		throw std::logic_error("encoded_size was passed a RootTag without a tag.");
+	}
+	size_t size = 3 + root_tag.name.data.size();
+	std::vector<const Tag *> pending(1, root_tag.tag.get());
+	while(!pending.empty()) {
+		const Tag *tag = pending.back();
+		pending.pop_back();
+		if(tag == nullptr) {
+			throw std::logic_error("encoded_size found a null tag.");
+		}
+		visit(*tag, detail::PayloadSizer(size, pending));
+	}
+	return size;
+}
+
+void write_nbt(OutputStream &s, const RootTag &root_tag) {
+	if(!root_tag.tag) {
+		throw std::logic_error("write_nbt was passed a RootTag without a tag.");
+	}
+	if(s.wants_size_hint()) {
+		s.reserve(encoded_size(root_tag));
+	}
+	detail::write_type_and_name(s, root_tag.tag->type(), root_tag.name);
+	detail::write_tag_payload(s, *root_tag.tag);
+	s.flush();
+}
+
+}
+}
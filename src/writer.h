@@ -0,0 +1,22 @@
+#ifndef NBT_WRITER_H
+#define NBT_WRITER_H
+
+#include "nbt.h"
+
+
+namespace nbt {
+namespace io {
+namespace detail {
+
+	void write_type_and_name(OutputStream &s, TagTypeId tag_type, const Utf8String &name);
+
+	/* Writes a tag's payload (everything after its type and name), as
+	 * write_nbt would.
+	 */
+	void write_tag_payload(OutputStream &s, const Tag &tag);
+
+}
+}
+}
+
+#endif